@@ -5,6 +5,8 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <algorithm>
+#include <cstring>
 #include <ctime>
 
 // Read a shader source from a file
@@ -29,7 +31,53 @@ void display(GLuint &vao);
 // Initialize the data to be rendered
 void initialize(GLuint &vao);
 
-int main () {
+// An attribute of the vertices, its values are size floats per vertex, the offset is set by upload_vertices
+struct vertex_attribute {
+	const char *name;
+	GLint size;
+	const GLfloat *data;
+	size_t offset;
+};
+
+// Attributes of the vertices and how they are stored in the vertex buffer, either interleaved,
+// all the attributes of a vertex next to each other, or planar, all the values of an attribute together
+struct vertex_layout {
+	std::vector<vertex_attribute> attributes;
+	GLsizei vertex_count;
+	bool interleaved;
+	GLsizei stride;
+};
+
+// Add an attribute to a layout, its data must stay valid until the vertices are uploaded
+void add_vertex_attribute(vertex_layout &layout, const char *name, GLint size, const GLfloat *data);
+
+// Compute the stride and the offsets of the attributes, then fill the bound GL_ARRAY_BUFFER with the vertices
+void upload_vertices(vertex_layout &layout, GLsizei vertex_count, bool interleaved);
+
+// Point an attribute location to an attribute of the uploaded vertices and enable it
+void enable_vertex_attribute(const vertex_layout &layout, const char *name, GLint location);
+
+// Run with --planar to store all the positions then all the other attributes, instead of interleaved vertices
+bool interleaved_vertices = true;
+
+// Time the vertex fetch of planar and interleaved vertices, from 1M up to max_millions vertices, then exit
+void benchmark_vertex_layouts(int max_millions);
+
+int main (int argc, char **argv) {
+	// --bench-layout [max millions] compares the vertex layouts, up to 50M vertices by default
+	int benchmark_max_millions = 0;
+	for(int i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "--planar") == 0) {
+			interleaved_vertices = false;
+		}
+		else if(strcmp(argv[i], "--bench-layout") == 0) {
+			benchmark_max_millions = 50;
+			if(i + 1 < argc && atoi(argv[i + 1]) > 0) {
+				benchmark_max_millions = atoi(argv[++i]);
+			}
+		}
+	}
+
 	// Initialize GLFW
 	if ( !glfwInit()) {
 		std::cerr << "Failed to initialize GLFW! I'm out!" << std::endl;
@@ -74,6 +122,10 @@ int main () {
 	// Initialize the data to be rendered
 	initialize(vao);
 
+	if(benchmark_max_millions > 0) {
+		benchmark_vertex_layouts(benchmark_max_millions);
+	}
+
 	// Create a rendering loop
 	int running = GL_TRUE;
 
@@ -150,32 +202,152 @@ void initialize(GLuint &vao) {
 	GLuint vbo;
 	glGenBuffers(1, &vbo);
 
-	// Allocate space for vertex positions and colors
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices_position) + sizeof(colors), NULL, GL_STATIC_DRAW);
-
-	// Transfer the vertex positions:
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices_position), vertices_position);
+	// Describe the vertices, the stride and offsets of the attributes follow from the layout
+	vertex_layout layout;
+	add_vertex_attribute(layout, "position", 2, vertices_position);
+	add_vertex_attribute(layout, "color", 3, colors);
 
-	// Transfer the vertex colors:
-	glBufferSubData(GL_ARRAY_BUFFER, sizeof(vertices_position), sizeof(colors), colors);
+	// Transfer the vertex positions and colors
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	upload_vertices(layout, sizeof(vertices_position) / (2 * sizeof(GLfloat)), interleaved_vertices);
 
 	GLuint shaderProgram = create_program("shaders/vert.shader", "shaders/frag.shader");
 
 	// Get the location of the attributes that enters in the vertex shader
 	GLint position_attribute = glGetAttribLocation(shaderProgram, "position");
 
-	// Specify how the data for position can be accessed
-	glVertexAttribPointer(position_attribute, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-	// Enable the attribute
-	glEnableVertexAttribArray(position_attribute);
+	// Specify how the data for position can be accessed, and enable the attribute
+	enable_vertex_attribute(layout, "position", position_attribute);
 
 	// Color attribute
 	GLint color_attribute = glGetAttribLocation(shaderProgram, "color");
-	glVertexAttribPointer(color_attribute, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid *)sizeof(vertices_position));
-	glEnableVertexAttribArray(color_attribute);
+	enable_vertex_attribute(layout, "color", color_attribute);
+
+}
 
+// Add an attribute to a layout, its data must stay valid until the vertices are uploaded
+void add_vertex_attribute(vertex_layout &layout, const char *name, GLint size, const GLfloat *data) {
+	vertex_attribute attribute = { name, size, data, 0 };
+	layout.attributes.push_back(attribute);
+}
+
+// Compute the stride and the offsets of the attributes, then fill the bound GL_ARRAY_BUFFER with the vertices
+// Interleaved, the stride is the size of a whole vertex and an attribute starts at the sum of the sizes before it,
+// planar, each attribute is a tightly packed block of vertex_count values
+void upload_vertices(vertex_layout &layout, GLsizei vertex_count, bool interleaved) {
+	layout.vertex_count = vertex_count;
+	layout.interleaved = interleaved;
+	size_t vertex_size = 0;
+	for(size_t i = 0; i < layout.attributes.size(); ++i) {
+		layout.attributes[i].offset = interleaved ? vertex_size : vertex_size * vertex_count;
+		vertex_size += layout.attributes[i].size * sizeof(GLfloat);
+	}
+	layout.stride = interleaved ? (GLsizei)vertex_size : 0;
+
+	// The vertices are written straight in the buffer, without an intermediate copy
+	GLsizeiptr size = (GLsizeiptr)(vertex_size * vertex_count);
+	glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STATIC_DRAW);
+	unsigned char *dst = (unsigned char *)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	for(size_t i = 0; i < layout.attributes.size(); ++i) {
+		const vertex_attribute &attribute = layout.attributes[i];
+		size_t attribute_size = attribute.size * sizeof(GLfloat);
+		if(interleaved) {
+			for(GLsizei v = 0; v < vertex_count; ++v) {
+				memcpy(dst + attribute.offset + v * vertex_size, attribute.data + (size_t)v * attribute.size, attribute_size);
+			}
+		}
+		else {
+			memcpy(dst + attribute.offset, attribute.data, attribute_size * vertex_count);
+		}
+	}
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+}
+
+// Point an attribute location to an attribute of the uploaded vertices and enable it
+void enable_vertex_attribute(const vertex_layout &layout, const char *name, GLint location) {
+	for(size_t i = 0; i < layout.attributes.size(); ++i) {
+		const vertex_attribute &attribute = layout.attributes[i];
+		if(strcmp(attribute.name, name) == 0) {
+			glVertexAttribPointer(location, attribute.size, GL_FLOAT, GL_FALSE, layout.stride, (GLvoid *)attribute.offset);
+			glEnableVertexAttribArray(location);
+			return;
+		}
+	}
+	std::cerr << "The vertex layout has no attribute " << name << " I'm out!" << std::endl;
+	exit(-1);
+}
+
+// Time the vertex fetch of planar and interleaved vertices, from 1M up to max_millions vertices, then exit
+// Each triangle has its 3 vertices at the same place, so it is culled right after the vertex shader and
+// the time is mostly the fetch of the attributes, glDrawArrays doesn't reuse any vertex
+void benchmark_vertex_layouts(int max_millions) {
+	const int millions[] = { 1, 2, 5, 10, 20, 50 };
+	size_t max_count = 0;
+	for(size_t i = 0; i < sizeof(millions) / sizeof(millions[0]) && millions[i] <= max_millions; ++i) {
+		max_count = (size_t)millions[i] * 1000000;
+	}
+	if(max_count == 0) {
+		std::cerr << "The layout benchmark starts at 1M vertices. I'm out!" << std::endl;
+		exit(-1);
+	}
+
+	// The same vertices for all the sizes, a size uses the first ones
+	std::vector<GLfloat> positions(max_count * 2), colors(max_count * 3);
+	srand(1);
+	for(size_t v = 0; v < max_count; v += 3) {
+		float x = 2.0f * rand() / RAND_MAX - 1.0f, y = 2.0f * rand() / RAND_MAX - 1.0f;
+		for(size_t k = v; k < std::min(v + 3, max_count); ++k) {
+			positions[2 * k] = x;
+			positions[2 * k + 1] = y;
+			colors[3 * k] = (float)rand() / RAND_MAX;
+			colors[3 * k + 1] = (float)rand() / RAND_MAX;
+			colors[3 * k + 2] = (float)rand() / RAND_MAX;
+		}
+	}
+
+	GLint program;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+	GLint position_attribute = glGetAttribLocation(program, "position");
+	GLint color_attribute = glGetAttribLocation(program, "color");
+
+	std::cout << "vertices   layout        ms     M vertices/s   GB/s" << std::endl;
+	const int runs = 5;
+	for(size_t i = 0; i < sizeof(millions) / sizeof(millions[0]) && millions[i] <= max_millions; ++i) {
+		GLsizei count = millions[i] * 1000000;
+		for(int interleaved = 0; interleaved < 2; ++interleaved) {
+			GLuint vao, vbo;
+			glGenVertexArrays(1, &vao);
+			glBindVertexArray(vao);
+			glGenBuffers(1, &vbo);
+			glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+			vertex_layout layout;
+			add_vertex_attribute(layout, "position", 2, &positions[0]);
+			add_vertex_attribute(layout, "color", 3, &colors[0]);
+			upload_vertices(layout, count, interleaved != 0);
+			enable_vertex_attribute(layout, "position", position_attribute);
+			enable_vertex_attribute(layout, "color", color_attribute);
+
+			// The first draw also makes sure the buffer is resident
+			glDrawArrays(GL_TRIANGLES, 0, count);
+			glFinish();
+			double best = 1e30;
+			for(int run = 0; run < runs; ++run) {
+				double start = glfwGetTime();
+				glDrawArrays(GL_TRIANGLES, 0, count);
+				glFinish();
+				best = std::min(best, glfwGetTime() - start);
+			}
+			std::cout << millions[i] << "M" << (millions[i] < 10 ? "         " : "        ") <<
+				(interleaved ? "interleaved   " : "planar        ") << best * 1000.0 << "   " << count / best / 1e6 << "   " <<
+				count * 5.0 * sizeof(GLfloat) / best / 1e9 << std::endl;
+
+			glDeleteBuffers(1, &vbo);
+			glDeleteVertexArrays(1, &vao);
+		}
+	}
+	glfwTerminate();
+	exit(0);
 }
 
 // Called when the window is resized
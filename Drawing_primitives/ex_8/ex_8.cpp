@@ -5,6 +5,8 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <cstring>
+#include <cmath>
 #include <ctime>
 
 // Read a shader source from a file
@@ -29,7 +31,96 @@ void display(GLuint &vao);
 // Initialize the data to be rendered
 void initialize(GLuint &vao);
 
-int main () {
+// An attribute of the vertices, its values are size floats per vertex, the offset is set by upload_vertices
+struct vertex_attribute {
+	const char *name;
+	GLint size;
+	const GLfloat *data;
+	size_t offset;
+};
+
+// Attributes of the vertices and how they are stored in the vertex buffer, either interleaved,
+// all the attributes of a vertex next to each other, or planar, all the values of an attribute together
+struct vertex_layout {
+	std::vector<vertex_attribute> attributes;
+	GLsizei vertex_count;
+	bool interleaved;
+	GLsizei stride;
+};
+
+// Add an attribute to a layout, its data must stay valid until the vertices are uploaded
+void add_vertex_attribute(vertex_layout &layout, const char *name, GLint size, const GLfloat *data);
+
+// Compute the stride and the offsets of the attributes, returns the size of a vertex
+size_t set_vertex_offsets(vertex_layout &layout, GLsizei vertex_count, bool interleaved);
+
+// Compute the stride and the offsets of the attributes, then fill the bound GL_ARRAY_BUFFER with the vertices
+void upload_vertices(vertex_layout &layout, GLsizei vertex_count, bool interleaved);
+
+// Point an attribute location to an attribute of the uploaded vertices and enable it
+void enable_vertex_attribute(const vertex_layout &layout, const char *name, GLint location);
+
+// Run with --planar to store all the positions then all the other attributes, instead of interleaved vertices
+bool interleaved_vertices = true;
+
+// Number of segments of a stream buffer, the CPU waits only when the GPU is this many frames behind
+const int stream_segments = 3;
+
+// A vertex buffer rewritten every frame, split in segments used in turn, the fence of a segment
+// tells when the GPU is done with the frame that read it
+struct stream_buffer {
+	GLuint vbo;
+	GLsizeiptr segment_size;
+	int current;
+	bool persistent;
+	unsigned char *mapping;
+	GLsync fences[stream_segments];
+	int frames;
+	int waits;
+	unsigned long long bytes;
+};
+
+// Create a stream buffer, persistently mapped with ARB_buffer_storage, otherwise mapped every frame
+void create_stream_buffer(stream_buffer &stream, GLsizeiptr segment_size, bool persistent);
+
+// Get the current segment to write the vertices of a frame, waits only if the GPU still reads it,
+// returns NULL if the segment can't be mapped
+unsigned char *begin_stream_segment(stream_buffer &stream);
+
+// Finish the writes of the current segment, returns the offset of the segment in the buffer
+GLintptr end_stream_segment(stream_buffer &stream, GLsizeiptr used);
+
+// Fence the draws reading the current segment and move to the next one
+void fence_stream_segment(stream_buffer &stream);
+
+// Write the vertices of the animated quads at the given time
+void write_dynamic_quads(unsigned char *dst, int quads, double time);
+
+// Run with --dynamic [quads] to rewrite a grid of rotating quads every frame through a stream buffer,
+// --no-persistent maps the segments with glMapBufferRange even when ARB_buffer_storage is available
+int dynamic_quads = 0;
+bool persistent_mapping = true;
+stream_buffer dynamic_stream;
+
+// Interleaved vertex of the animated quads
+const int dynamic_vertex_floats = 5;
+
+int main (int argc, char **argv) {
+	for(int i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "--planar") == 0) {
+			interleaved_vertices = false;
+		}
+		else if(strcmp(argv[i], "--dynamic") == 0) {
+			dynamic_quads = 10000;
+			if(i + 1 < argc && atoi(argv[i + 1]) > 0) {
+				dynamic_quads = atoi(argv[++i]);
+			}
+		}
+		else if(strcmp(argv[i], "--no-persistent") == 0) {
+			persistent_mapping = false;
+		}
+	}
+
 	// Initialize GLFW
 	if ( !glfwInit()) {
 		std::cerr << "Failed to initialize GLFW! I'm out!" << std::endl;
@@ -90,6 +181,12 @@ int main () {
 	// Terminate GLFW
 	glfwTerminate();
 
+	if(dynamic_quads > 0) {
+		std::cout << "Stream buffer (" << (dynamic_stream.persistent ? "persistent" : "unsynchronized") << "): " <<
+			dynamic_stream.frames << " frames, " << dynamic_stream.bytes / (1024.0 * 1024.0) << " MB written, " <<
+			dynamic_stream.waits << " waits for the GPU" << std::endl;
+	}
+
 	return 0;
 }
 
@@ -98,7 +195,24 @@ void display(GLuint &vao) {
 	glClear(GL_COLOR_BUFFER_BIT);
 
 	glBindVertexArray(vao);
-	glDrawArrays(GL_TRIANGLES, 0, 6);
+	if(dynamic_quads > 0) {
+		// The segments have the same size in vertices, so the draw starts at the first vertex of the segment
+		GLsizei count = dynamic_quads * 6;
+		GLsizeiptr size = count * dynamic_vertex_floats * sizeof(GLfloat);
+		unsigned char *dst = begin_stream_segment(dynamic_stream);
+
+		// The segment can't be mapped, the frame is skipped
+		if(!dst) {
+			return;
+		}
+		write_dynamic_quads(dst, dynamic_quads, glfwGetTime());
+		GLintptr offset = end_stream_segment(dynamic_stream, size);
+		glDrawArrays(GL_TRIANGLES, (GLint)(offset / (dynamic_vertex_floats * sizeof(GLfloat))), count);
+		fence_stream_segment(dynamic_stream);
+	}
+	else {
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+	}
 
 	// Swap front and back buffers
 	glfwSwapBuffers();
@@ -142,32 +256,198 @@ void initialize(GLuint &vao) {
 	GLuint vbo;
 	glGenBuffers(1, &vbo);
 
-	// Allocate space for vertex positions and colors
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices_position) + sizeof(colors), NULL, GL_STATIC_DRAW);
-
-	// Transfer the vertex positions:
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices_position), vertices_position);
+	// Describe the vertices, the stride and offsets of the attributes follow from the layout
+	vertex_layout layout;
+	add_vertex_attribute(layout, "position", 2, vertices_position);
+	add_vertex_attribute(layout, "color", 3, colors);
 
-	// Transfer the vertex colors:
-	glBufferSubData(GL_ARRAY_BUFFER, sizeof(vertices_position), sizeof(colors), colors);
+	// Transfer the vertex positions and colors, or create the stream buffer the frames write to
+	if(dynamic_quads > 0) {
+		glDeleteBuffers(1, &vbo);
+		create_stream_buffer(dynamic_stream, (GLsizeiptr)dynamic_quads * 6 * dynamic_vertex_floats * sizeof(GLfloat), persistent_mapping);
+		set_vertex_offsets(layout, 0, true);
+	}
+	else {
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		upload_vertices(layout, sizeof(vertices_position) / (2 * sizeof(GLfloat)), interleaved_vertices);
+	}
 
 	GLuint shaderProgram = create_program("shaders/vert.shader", "shaders/frag.shader");
 
 	// Get the location of the attributes that enters in the vertex shader
 	GLint position_attribute = glGetAttribLocation(shaderProgram, "position");
 
-	// Specify how the data for position can be accessed
-	glVertexAttribPointer(position_attribute, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-	// Enable the attribute
-	glEnableVertexAttribArray(position_attribute);
+	// Specify how the data for position can be accessed, and enable the attribute
+	enable_vertex_attribute(layout, "position", position_attribute);
 
 	// Color attribute
 	GLint color_attribute = glGetAttribLocation(shaderProgram, "color");
-	glVertexAttribPointer(color_attribute, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid *)sizeof(vertices_position));
-	glEnableVertexAttribArray(color_attribute);
+	enable_vertex_attribute(layout, "color", color_attribute);
+
+}
+
+// Add an attribute to a layout, its data must stay valid until the vertices are uploaded
+void add_vertex_attribute(vertex_layout &layout, const char *name, GLint size, const GLfloat *data) {
+	vertex_attribute attribute = { name, size, data, 0 };
+	layout.attributes.push_back(attribute);
+}
+
+// Compute the stride and the offsets of the attributes, returns the size of a vertex
+// Interleaved, the stride is the size of a whole vertex and an attribute starts at the sum of the sizes before it,
+// planar, each attribute is a tightly packed block of vertex_count values
+size_t set_vertex_offsets(vertex_layout &layout, GLsizei vertex_count, bool interleaved) {
+	layout.vertex_count = vertex_count;
+	layout.interleaved = interleaved;
+	size_t vertex_size = 0;
+	for(size_t i = 0; i < layout.attributes.size(); ++i) {
+		layout.attributes[i].offset = interleaved ? vertex_size : vertex_size * vertex_count;
+		vertex_size += layout.attributes[i].size * sizeof(GLfloat);
+	}
+	layout.stride = interleaved ? (GLsizei)vertex_size : 0;
+	return vertex_size;
+}
+
+// Compute the stride and the offsets of the attributes, then fill the bound GL_ARRAY_BUFFER with the vertices
+void upload_vertices(vertex_layout &layout, GLsizei vertex_count, bool interleaved) {
+	size_t vertex_size = set_vertex_offsets(layout, vertex_count, interleaved);
+
+	// The vertices are written straight in the buffer, without an intermediate copy
+	GLsizeiptr size = (GLsizeiptr)(vertex_size * vertex_count);
+	glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STATIC_DRAW);
+	unsigned char *dst = (unsigned char *)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	for(size_t i = 0; i < layout.attributes.size(); ++i) {
+		const vertex_attribute &attribute = layout.attributes[i];
+		size_t attribute_size = attribute.size * sizeof(GLfloat);
+		if(interleaved) {
+			for(GLsizei v = 0; v < vertex_count; ++v) {
+				memcpy(dst + attribute.offset + v * vertex_size, attribute.data + (size_t)v * attribute.size, attribute_size);
+			}
+		}
+		else {
+			memcpy(dst + attribute.offset, attribute.data, attribute_size * vertex_count);
+		}
+	}
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+}
+
+// Point an attribute location to an attribute of the uploaded vertices and enable it
+void enable_vertex_attribute(const vertex_layout &layout, const char *name, GLint location) {
+	for(size_t i = 0; i < layout.attributes.size(); ++i) {
+		const vertex_attribute &attribute = layout.attributes[i];
+		if(strcmp(attribute.name, name) == 0) {
+			glVertexAttribPointer(location, attribute.size, GL_FLOAT, GL_FALSE, layout.stride, (GLvoid *)attribute.offset);
+			glEnableVertexAttribArray(location);
+			return;
+		}
+	}
+	std::cerr << "The vertex layout has no attribute " << name << " I'm out!" << std::endl;
+	exit(-1);
+}
+
+// Create a stream buffer, persistently mapped with ARB_buffer_storage, otherwise mapped every frame
+// The buffer holds all the segments back to back and stays bound to GL_ARRAY_BUFFER
+void create_stream_buffer(stream_buffer &stream, GLsizeiptr segment_size, bool persistent) {
+	stream.segment_size = segment_size;
+	stream.current = 0;
+	stream.persistent = persistent && GLEW_ARB_buffer_storage;
+	stream.mapping = NULL;
+	stream.frames = 0;
+	stream.waits = 0;
+	stream.bytes = 0;
+	for(int i = 0; i < stream_segments; ++i) {
+		stream.fences[i] = 0;
+	}
+
+	glGenBuffers(1, &stream.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, stream.vbo);
+	GLsizeiptr size = segment_size * stream_segments;
+	if(stream.persistent) {
+		// Mapped once for the life of the buffer, the coherent writes need no flush
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+		stream.mapping = (unsigned char *)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+
+		// The storage of the buffer is immutable, a new buffer is needed to map it every frame instead
+		if(!stream.mapping) {
+			std::cerr << "Unable to map the stream buffer persistently, mapping it every frame" << std::endl;
+			stream.persistent = false;
+			glDeleteBuffers(1, &stream.vbo);
+			glGenBuffers(1, &stream.vbo);
+			glBindBuffer(GL_ARRAY_BUFFER, stream.vbo);
+		}
+	}
+	if(!stream.persistent) {
+		glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+	}
+}
+
+// Get the current segment to write the vertices of a frame, waits only if the GPU still reads it,
+// returns NULL if the segment can't be mapped
+// The fences make the unsynchronized maps safe, the driver never has to check the buffer for us
+unsigned char *begin_stream_segment(stream_buffer &stream) {
+	GLsync &fence = stream.fences[stream.current];
+	if(fence) {
+		if(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED) {
+			// The GPU is a whole ring of frames behind
+			stream.waits++;
+			while(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull) == GL_TIMEOUT_EXPIRED) {
+			}
+		}
+		glDeleteSync(fence);
+		fence = 0;
+	}
 
+	GLintptr offset = stream.current * stream.segment_size;
+	if(stream.persistent) {
+		return stream.mapping + offset;
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, stream.vbo);
+	return (unsigned char *)glMapBufferRange(GL_ARRAY_BUFFER, offset, stream.segment_size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+}
+
+// Finish the writes of the current segment, returns the offset of the segment in the buffer
+GLintptr end_stream_segment(stream_buffer &stream, GLsizeiptr used) {
+	if(!stream.persistent) {
+		glBindBuffer(GL_ARRAY_BUFFER, stream.vbo);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	}
+	stream.bytes += used;
+	return stream.current * stream.segment_size;
+}
+
+// Fence the draws reading the current segment and move to the next one
+void fence_stream_segment(stream_buffer &stream) {
+	stream.fences[stream.current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	stream.current = (stream.current + 1) % stream_segments;
+	stream.frames++;
+}
+
+// Write the vertices of the animated quads at the given time
+// The quads are on a square grid, each one turns at its own speed and keeps its color
+void write_dynamic_quads(unsigned char *dst, int quads, double time) {
+	GLfloat *vertex = (GLfloat *)dst;
+	int columns = 1;
+	while(columns * columns < quads) {
+		columns++;
+	}
+	float cell = 2.0f / columns;
+	const float corners[6][2] = { {-1, -1}, {1, -1}, {1, 1}, {1, 1}, {-1, 1}, {-1, -1} };
+	for(int q = 0; q < quads; ++q) {
+		float cx = -1.0f + (q % columns + 0.5f) * cell;
+		float cy = -1.0f + (q / columns + 0.5f) * cell;
+		float angle = (float)time * (0.5f + (q % 7) * 0.25f);
+		float c = cosf(angle) * cell * 0.35f, s = sinf(angle) * cell * 0.35f;
+		float t = (float)q / quads;
+		for(int k = 0; k < 6; ++k) {
+			vertex[0] = cx + corners[k][0] * c - corners[k][1] * s;
+			vertex[1] = cy + corners[k][0] * s + corners[k][1] * c;
+			vertex[2] = 9*(1-t)*t*t*t;
+			vertex[3] = 15*(1-t)*(1-t)*t*t;
+			vertex[4] = 8.5*(1-t)*(1-t)*(1-t)*t;
+			vertex += dynamic_vertex_floats;
+		}
+	}
 }
 
 // Called when the window is resized
@@ -5,6 +5,9 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
 #include <ctime>
 
 // Read a shader source from a file
@@ -29,7 +32,150 @@ void display(GLuint &vao);
 // Initialize the data to be rendered
 void initialize(GLuint &vao);
 
-int main () {
+// An attribute of the vertices, its values are size floats per vertex, the offset is set by upload_vertices
+struct vertex_attribute {
+	const char *name;
+	GLint size;
+	const GLfloat *data;
+	size_t offset;
+};
+
+// Attributes of the vertices and how they are stored in the vertex buffer, either interleaved,
+// all the attributes of a vertex next to each other, or planar, all the values of an attribute together
+struct vertex_layout {
+	std::vector<vertex_attribute> attributes;
+	GLsizei vertex_count;
+	bool interleaved;
+	GLsizei stride;
+};
+
+// Add an attribute to a layout, its data must stay valid until the vertices are uploaded
+void add_vertex_attribute(vertex_layout &layout, const char *name, GLint size, const GLfloat *data);
+
+// Compute the stride and the offsets of the attributes, then fill the bound GL_ARRAY_BUFFER with the vertices
+void upload_vertices(vertex_layout &layout, GLsizei vertex_count, bool interleaved);
+
+// Point an attribute location to an attribute of the uploaded vertices and enable it
+void enable_vertex_attribute(const vertex_layout &layout, const char *name, GLint location);
+
+// Run with --planar to store all the positions then all the other attributes, instead of interleaved vertices
+bool interleaved_vertices = true;
+
+// A mesh of a batch, its indices start at first_index in the shared element buffer and
+// count from 0 for its own vertices, which start at base_vertex in the shared vertex buffer
+struct batch_mesh {
+	GLsizei count;
+	GLuint first_index;
+	GLint base_vertex;
+};
+
+// Many meshes packed in shared vertex and element buffers, drawn with one multi-draw call
+struct mesh_batch {
+	std::vector<GLfloat> positions;
+	std::vector<GLfloat> colors;
+	std::vector<GLuint> indices;
+	std::vector<batch_mesh> meshes;
+
+	// Arguments of glMultiDrawElementsBaseVertex, or the buffer of the indirect commands
+	std::vector<GLsizei> counts;
+	std::vector<const GLvoid *> index_offsets;
+	std::vector<GLint> base_vertices;
+	GLenum index_type;
+	GLuint indirect_buffer;
+	bool indirect;
+
+	// Draw calls issued, and the calls saved compared to one draw per mesh
+	unsigned long long draw_calls;
+	unsigned long long draws_saved;
+};
+
+// A command of glMultiDrawElementsIndirect, as the GL reads it from GL_DRAW_INDIRECT_BUFFER
+struct draw_elements_indirect_command {
+	GLuint count;
+	GLuint instance_count;
+	GLuint first_index;
+	GLint base_vertex;
+	GLuint base_instance;
+};
+
+// Append a mesh to a batch, its indices are relative to its own first vertex
+void add_batch_mesh(mesh_batch &batch, const GLfloat *positions, const GLfloat *colors, GLsizei vertex_count,
+	const GLuint *indices, GLsizei index_count);
+
+// Append a regular polygon, drawn as a fan of triangles around its center, to a batch
+void add_polygon_mesh(mesh_batch &batch, int sides, float x, float y, float radius, float angle);
+
+// Fill the bound GL_ELEMENT_ARRAY_BUFFER with the indices of a batch and build its draw arguments,
+// with indirect the commands are stored in a GL_DRAW_INDIRECT_BUFFER
+void upload_batch(mesh_batch &batch, bool indirect);
+
+// Draw all the meshes of a batch with a single call
+void draw_batch(mesh_batch &batch);
+
+// Print the number of draw calls issued and saved by the batch
+void report_batch(const mesh_batch &batch);
+
+// Time one draw per mesh against the multi-draw calls, then exit
+void benchmark_batch(GLuint &vao, mesh_batch &batch);
+
+// Run with --batch [meshes] to draw a grid of different polygons from shared buffers, --no-indirect
+// uses glMultiDrawElementsBaseVertex even when ARB_multi_draw_indirect is available
+int batch_meshes = 0;
+bool indirect_draws = true;
+mesh_batch scene_batch;
+
+// Run with --bench-batch to time the batched draws
+bool bench_batch = false;
+
+// A run of triangle indices drawn with one call, its indices are stored relative to base_vertex
+struct index_chunk {
+	GLsizei first;
+	GLsizei count;
+	GLint base_vertex;
+};
+
+// Indices stored with the smallest type that holds them, GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+// A mesh with more vertices than 16 bits indices can address is split in chunks drawn with a base vertex
+struct index_buffer {
+	GLenum type;
+	GLsizei count;
+	std::vector<index_chunk> chunks;
+};
+
+// Fill the bound GL_ELEMENT_ARRAY_BUFFER with triangle indices, using the smallest index type
+void upload_indices(index_buffer &buffer, const GLuint *indices, GLsizei count);
+
+// Draw count indices from first, one call per chunk they cover
+void draw_indices(const index_buffer &buffer, GLsizei first, GLsizei count);
+
+// Size in bytes of an index type
+size_t index_type_size(GLenum type);
+
+// Indices of the scene
+index_buffer scene_indices;
+
+int main (int argc, char **argv) {
+	for(int i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "--planar") == 0) {
+			interleaved_vertices = false;
+		}
+		else if(strcmp(argv[i], "--batch") == 0) {
+			batch_meshes = 500;
+			if(i + 1 < argc && atoi(argv[i + 1]) > 0) {
+				batch_meshes = atoi(argv[++i]);
+			}
+		}
+		else if(strcmp(argv[i], "--no-indirect") == 0) {
+			indirect_draws = false;
+		}
+		else if(strcmp(argv[i], "--bench-batch") == 0) {
+			bench_batch = true;
+		}
+	}
+	if(bench_batch && batch_meshes == 0) {
+		batch_meshes = 500;
+	}
+
 	// Initialize GLFW
 	if ( !glfwInit()) {
 		std::cerr << "Failed to initialize GLFW! I'm out!" << std::endl;
@@ -74,6 +220,10 @@ int main () {
 	// Initialize the data to be rendered
 	initialize(vao);
 
+	if(bench_batch) {
+		benchmark_batch(vao, scene_batch);
+	}
+
 	// Create a rendering loop
 	int running = GL_TRUE;
 
@@ -90,6 +240,10 @@ int main () {
 	// Terminate GLFW
 	glfwTerminate();
 
+	if(batch_meshes > 0) {
+		report_batch(scene_batch);
+	}
+
 	return 0;
 }
 
@@ -98,7 +252,12 @@ void display(GLuint &vao) {
 	glClear(GL_COLOR_BUFFER_BIT);
 
 	glBindVertexArray(vao);
-	glDrawElements( GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	if(batch_meshes > 0) {
+		draw_batch(scene_batch);
+	}
+	else {
+		draw_indices(scene_indices, 0, scene_indices.count);
+	}
 
 	// Swap front and back buffers
 	glfwSwapBuffers();
@@ -144,15 +303,36 @@ void initialize(GLuint &vao) {
 	GLuint vbo;
 	glGenBuffers(1, &vbo);
 
-	// Allocate space for vertex positions and colors
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices_position) + sizeof(colors), NULL, GL_STATIC_DRAW);
+	// A grid of polygons with 3 to 32 sides, each one a separate mesh
+	if(batch_meshes > 0) {
+		int columns = 1;
+		while(columns * columns < batch_meshes) {
+			columns++;
+		}
+		float cell = 2.0f / columns;
+		for(int i = 0; i < batch_meshes; ++i) {
+			add_polygon_mesh(scene_batch, 3 + i % 30, -1.0f + (i % columns + 0.5f) * cell, 1.0f - (i / columns + 0.5f) * cell,
+				cell * (0.3f + 0.15f * (i % 7) / 6.0f), i * 0.37f);
+		}
+	}
 
-	// Transfer the vertex positions:
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices_position), vertices_position);
+	// Describe the vertices, the stride and offsets of the attributes follow from the layout
+	vertex_layout layout;
+	GLsizei vertex_count;
+	if(batch_meshes > 0) {
+		add_vertex_attribute(layout, "position", 2, &scene_batch.positions[0]);
+		add_vertex_attribute(layout, "color", 3, &scene_batch.colors[0]);
+		vertex_count = (GLsizei)(scene_batch.positions.size() / 2);
+	}
+	else {
+		add_vertex_attribute(layout, "position", 2, vertices_position);
+		add_vertex_attribute(layout, "color", 3, colors);
+		vertex_count = sizeof(vertices_position) / (2 * sizeof(GLfloat));
+	}
 
-	// Transfer the vertex colors:
-	glBufferSubData(GL_ARRAY_BUFFER, sizeof(vertices_position), sizeof(colors), colors);
+	// Transfer the vertex positions and colors
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	upload_vertices(layout, vertex_count, interleaved_vertices);
 
 	// Create an Element Array Buffer that will store the indices array:
 	GLuint eab;
@@ -160,7 +340,12 @@ void initialize(GLuint &vao) {
 
 	// Transfer the data from indices to eab
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eab);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	if(batch_meshes > 0) {
+		upload_batch(scene_batch, indirect_draws);
+	}
+	else {
+		upload_indices(scene_indices, indices, sizeof(indices) / sizeof(GLuint));
+	}
 
 
 	GLuint shaderProgram = create_program("shaders/vert.shader", "shaders/frag.shader");
@@ -168,17 +353,305 @@ void initialize(GLuint &vao) {
 	// Get the location of the attributes that enters in the vertex shader
 	GLint position_attribute = glGetAttribLocation(shaderProgram, "position");
 
-	// Specify how the data for position can be accessed
-	glVertexAttribPointer(position_attribute, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-	// Enable the attribute
-	glEnableVertexAttribArray(position_attribute);
+	// Specify how the data for position can be accessed, and enable the attribute
+	enable_vertex_attribute(layout, "position", position_attribute);
 
 	// Color attribute
 	GLint color_attribute = glGetAttribLocation(shaderProgram, "color");
-	glVertexAttribPointer(color_attribute, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid *)sizeof(vertices_position));
-	glEnableVertexAttribArray(color_attribute);
+	enable_vertex_attribute(layout, "color", color_attribute);
+
+}
+
+// Add an attribute to a layout, its data must stay valid until the vertices are uploaded
+void add_vertex_attribute(vertex_layout &layout, const char *name, GLint size, const GLfloat *data) {
+	vertex_attribute attribute = { name, size, data, 0 };
+	layout.attributes.push_back(attribute);
+}
+
+// Compute the stride and the offsets of the attributes, then fill the bound GL_ARRAY_BUFFER with the vertices
+// Interleaved, the stride is the size of a whole vertex and an attribute starts at the sum of the sizes before it,
+// planar, each attribute is a tightly packed block of vertex_count values
+void upload_vertices(vertex_layout &layout, GLsizei vertex_count, bool interleaved) {
+	layout.vertex_count = vertex_count;
+	layout.interleaved = interleaved;
+	size_t vertex_size = 0;
+	for(size_t i = 0; i < layout.attributes.size(); ++i) {
+		layout.attributes[i].offset = interleaved ? vertex_size : vertex_size * vertex_count;
+		vertex_size += layout.attributes[i].size * sizeof(GLfloat);
+	}
+	layout.stride = interleaved ? (GLsizei)vertex_size : 0;
+
+	// The vertices are written straight in the buffer, without an intermediate copy
+	GLsizeiptr size = (GLsizeiptr)(vertex_size * vertex_count);
+	glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STATIC_DRAW);
+	unsigned char *dst = (unsigned char *)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	for(size_t i = 0; i < layout.attributes.size(); ++i) {
+		const vertex_attribute &attribute = layout.attributes[i];
+		size_t attribute_size = attribute.size * sizeof(GLfloat);
+		if(interleaved) {
+			for(GLsizei v = 0; v < vertex_count; ++v) {
+				memcpy(dst + attribute.offset + v * vertex_size, attribute.data + (size_t)v * attribute.size, attribute_size);
+			}
+		}
+		else {
+			memcpy(dst + attribute.offset, attribute.data, attribute_size * vertex_count);
+		}
+	}
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+}
+
+// Point an attribute location to an attribute of the uploaded vertices and enable it
+void enable_vertex_attribute(const vertex_layout &layout, const char *name, GLint location) {
+	for(size_t i = 0; i < layout.attributes.size(); ++i) {
+		const vertex_attribute &attribute = layout.attributes[i];
+		if(strcmp(attribute.name, name) == 0) {
+			glVertexAttribPointer(location, attribute.size, GL_FLOAT, GL_FALSE, layout.stride, (GLvoid *)attribute.offset);
+			glEnableVertexAttribArray(location);
+			return;
+		}
+	}
+	std::cerr << "The vertex layout has no attribute " << name << " I'm out!" << std::endl;
+	exit(-1);
+}
+
+// Append a mesh to a batch, its indices are relative to its own first vertex
+void add_batch_mesh(mesh_batch &batch, const GLfloat *positions, const GLfloat *colors, GLsizei vertex_count,
+	const GLuint *indices, GLsizei index_count) {
+	batch_mesh mesh;
+	mesh.count = index_count;
+	mesh.first_index = (GLuint)batch.indices.size();
+	mesh.base_vertex = (GLint)(batch.positions.size() / 2);
+	batch.meshes.push_back(mesh);
+
+	batch.positions.insert(batch.positions.end(), positions, positions + vertex_count * 2);
+	batch.colors.insert(batch.colors.end(), colors, colors + vertex_count * 3);
+	batch.indices.insert(batch.indices.end(), indices, indices + index_count);
+}
+
+// Append a regular polygon, drawn as a fan of triangles around its center, to a batch
+// The center is the vertex 0, the color of the polygon comes from the same polynomials as the square
+void add_polygon_mesh(mesh_batch &batch, int sides, float x, float y, float radius, float angle) {
+	std::vector<GLfloat> positions, colors;
+	std::vector<GLuint> indices;
+	float t = (float)rand()/(float)RAND_MAX;
+	for(int i = 0; i <= sides; ++i) {
+		float a = angle + 6.2831853f * (i - 1) / sides;
+		positions.push_back(i == 0 ? x : x + radius * cosf(a));
+		positions.push_back(i == 0 ? y : y + radius * sinf(a));
+		float shade = i == 0 ? 1.0f : 0.6f;
+		colors.push_back(shade * 9*(1-t)*t*t*t);
+		colors.push_back(shade * 15*(1-t)*(1-t)*t*t);
+		colors.push_back(shade * 8.5*(1-t)*(1-t)*(1-t)*t);
+	}
+	for(int i = 1; i <= sides; ++i) {
+		indices.push_back(0);
+		indices.push_back(i);
+		indices.push_back(i % sides + 1);
+	}
+	add_batch_mesh(batch, &positions[0], &colors[0], sides + 1, &indices[0], (GLsizei)indices.size());
+}
+
+// Fill the bound GL_ELEMENT_ARRAY_BUFFER with the indices of a batch and build its draw arguments,
+// with indirect the commands are stored in a GL_DRAW_INDIRECT_BUFFER
+// glMultiDrawElementsBaseVertex is core from OpenGL 3.2, the indirect draws need ARB_multi_draw_indirect
+// The indices of a mesh are relative to its base vertex, so their type only depends on the largest mesh
+void upload_batch(mesh_batch &batch, bool indirect) {
+	GLuint max_index = 0;
+	for(size_t i = 0; i < batch.indices.size(); ++i) {
+		max_index = std::max(max_index, batch.indices[i]);
+	}
+	batch.index_type = max_index <= 0xFF ? GL_UNSIGNED_BYTE : max_index <= 0xFFFF ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	size_t size = index_type_size(batch.index_type);
+	std::vector<unsigned char> indices(batch.indices.size() * size);
+	for(size_t i = 0; i < batch.indices.size(); ++i) {
+		if(batch.index_type == GL_UNSIGNED_BYTE) {
+			indices[i] = (GLubyte)batch.indices[i];
+		}
+		else if(batch.index_type == GL_UNSIGNED_SHORT) {
+			((GLushort *)&indices[0])[i] = (GLushort)batch.indices[i];
+		}
+		else {
+			((GLuint *)&indices[0])[i] = batch.indices[i];
+		}
+	}
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size(), &indices[0], GL_STATIC_DRAW);
+
+	batch.counts.clear();
+	batch.index_offsets.clear();
+	batch.base_vertices.clear();
+	std::vector<draw_elements_indirect_command> commands;
+	for(size_t i = 0; i < batch.meshes.size(); ++i) {
+		const batch_mesh &mesh = batch.meshes[i];
+		batch.counts.push_back(mesh.count);
+		batch.index_offsets.push_back((const GLvoid *)(mesh.first_index * size));
+		batch.base_vertices.push_back(mesh.base_vertex);
+		draw_elements_indirect_command command = { (GLuint)mesh.count, 1, mesh.first_index, mesh.base_vertex, 0 };
+		commands.push_back(command);
+	}
+
+	batch.indirect = indirect && (GLEW_ARB_multi_draw_indirect || GLEW_VERSION_4_3);
+	batch.indirect_buffer = 0;
+	if(batch.indirect) {
+		glGenBuffers(1, &batch.indirect_buffer);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch.indirect_buffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(draw_elements_indirect_command), &commands[0],
+			GL_STATIC_DRAW);
+	}
+	batch.draw_calls = 0;
+	batch.draws_saved = 0;
+}
+
+// Draw all the meshes of a batch with a single call
+void draw_batch(mesh_batch &batch) {
+	GLsizei count = (GLsizei)batch.meshes.size();
+	if(batch.indirect) {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, batch.indirect_buffer);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, batch.index_type, 0, count, 0);
+	}
+	else {
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, &batch.counts[0], batch.index_type, &batch.index_offsets[0], count,
+			&batch.base_vertices[0]);
+	}
+	batch.draw_calls++;
+	batch.draws_saved += count - 1;
+}
+
+// Print the number of draw calls issued and saved by the batch
+void report_batch(const mesh_batch &batch) {
+	std::cout << "Batch (" << (batch.indirect ? "glMultiDrawElementsIndirect" : "glMultiDrawElementsBaseVertex") << "): " <<
+		batch.meshes.size() << " meshes, " << batch.draw_calls << " draw calls, " << batch.draws_saved << " draws saved" <<
+		std::endl;
+}
+
+// Time one draw per mesh against the multi-draw calls, then exit
+// Each frame is a clear and the draws, glFinish makes sure the GPU time is counted
+void benchmark_batch(GLuint &vao, mesh_batch &batch) {
+	const int frames = 200;
+	glBindVertexArray(vao);
+	std::cout << "Batch benchmark, " << batch.meshes.size() << " meshes, ms per frame" << std::endl;
+
+	glFinish();
+	double start = glfwGetTime();
+	for(int f = 0; f < frames; ++f) {
+		glClear(GL_COLOR_BUFFER_BIT);
+		for(size_t i = 0; i < batch.meshes.size(); ++i) {
+			glDrawElementsBaseVertex(GL_TRIANGLES, batch.counts[i], batch.index_type, batch.index_offsets[i],
+				batch.base_vertices[i]);
+		}
+	}
+	glFinish();
+	std::cout << "  one draw per mesh: " << (glfwGetTime() - start) * 1000.0 / frames << " ms" << std::endl;
+
+	bool indirect = batch.indirect;
+	for(int mode = 0; mode < (indirect ? 2 : 1); ++mode) {
+		batch.indirect = mode == 1;
+		start = glfwGetTime();
+		for(int f = 0; f < frames; ++f) {
+			glClear(GL_COLOR_BUFFER_BIT);
+			draw_batch(batch);
+		}
+		glFinish();
+		std::cout << "  " << (batch.indirect ? "glMultiDrawElementsIndirect" : "glMultiDrawElementsBaseVertex") << ": " <<
+			(glfwGetTime() - start) * 1000.0 / frames << " ms" << std::endl;
+	}
+	batch.indirect = indirect;
+	report_batch(batch);
+
+	glfwTerminate();
+	exit(0);
+}
+
+// Fill the bound GL_ELEMENT_ARRAY_BUFFER with triangle indices, using the smallest index type
+// Up to 65536 vertices the indices are stored as they are, in bytes or shorts. Past that, the triangles are
+// split in chunks whose vertices are within 65536 of the chunk base vertex, each chunk is a draw. A triangle
+// spanning more than that can't be split, the mesh then keeps 32 bits indices
+void upload_indices(index_buffer &buffer, const GLuint *indices, GLsizei count) {
+	GLuint max_index = 0;
+	for(GLsizei i = 0; i < count; ++i) {
+		max_index = std::max(max_index, indices[i]);
+	}
+	buffer.count = count;
+	buffer.chunks.clear();
+	buffer.type = max_index <= 0xFF ? GL_UNSIGNED_BYTE : max_index <= 0xFFFF ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+	if(buffer.type == GL_UNSIGNED_INT) {
+		// A chunk starts at the lowest vertex of its first triangle and ends with the first triangle out of range
+		buffer.type = GL_UNSIGNED_SHORT;
+		index_chunk chunk = { 0, 0, 0 };
+		for(GLsizei i = 0; i + 2 < count; i += 3) {
+			GLuint low = std::min(indices[i], std::min(indices[i + 1], indices[i + 2]));
+			GLuint high = std::max(indices[i], std::max(indices[i + 1], indices[i + 2]));
+			if(high - low > 0xFFFF) {
+				buffer.type = GL_UNSIGNED_INT;
+				buffer.chunks.clear();
+				break;
+			}
+			if(chunk.count == 0 || low < (GLuint)chunk.base_vertex || high - chunk.base_vertex > 0xFFFF) {
+				if(chunk.count > 0) {
+					buffer.chunks.push_back(chunk);
+				}
+				chunk.first = i;
+				chunk.count = 0;
+				chunk.base_vertex = (GLint)low;
+			}
+			chunk.count += 3;
+		}
+		if(buffer.type == GL_UNSIGNED_SHORT && chunk.count > 0) {
+			buffer.chunks.push_back(chunk);
+		}
+	}
+	if(buffer.chunks.empty()) {
+		index_chunk chunk = { 0, count, 0 };
+		buffer.chunks.push_back(chunk);
+	}
+
+	// Write the indices relative to their chunk, straight in the buffer
+	size_t size = index_type_size(buffer.type);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * size, NULL, GL_STATIC_DRAW);
+	unsigned char *dst = (unsigned char *)glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, count * size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	for(size_t c = 0; c < buffer.chunks.size(); ++c) {
+		const index_chunk &chunk = buffer.chunks[c];
+		for(GLsizei i = chunk.first; i < chunk.first + chunk.count; ++i) {
+			GLuint index = indices[i] - chunk.base_vertex;
+			if(buffer.type == GL_UNSIGNED_BYTE) {
+				dst[i] = (GLubyte)index;
+			}
+			else if(buffer.type == GL_UNSIGNED_SHORT) {
+				((GLushort *)dst)[i] = (GLushort)index;
+			}
+			else {
+				((GLuint *)dst)[i] = index;
+			}
+		}
+	}
+	glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+}
+
+// Draw count indices from first, one call per chunk they cover
+// The base vertex draws are core from OpenGL 3.2, the chunk at the start of the mesh doesn't need one
+void draw_indices(const index_buffer &buffer, GLsizei first, GLsizei count) {
+	size_t size = index_type_size(buffer.type);
+	for(size_t c = 0; c < buffer.chunks.size(); ++c) {
+		const index_chunk &chunk = buffer.chunks[c];
+		GLsizei begin = std::max(first, chunk.first);
+		GLsizei end = std::min(first + count, chunk.first + chunk.count);
+		if(begin >= end) {
+			continue;
+		}
+		const GLvoid *offset = (const GLvoid *)(begin * size);
+		if(chunk.base_vertex == 0) {
+			glDrawElements(GL_TRIANGLES, end - begin, buffer.type, offset);
+		}
+		else {
+			glDrawElementsBaseVertex(GL_TRIANGLES, end - begin, buffer.type, offset, chunk.base_vertex);
+		}
+	}
+}
 
+// Size in bytes of an index type
+size_t index_type_size(GLenum type) {
+	return type == GL_UNSIGNED_BYTE ? 1 : type == GL_UNSIGNED_SHORT ? 2 : 4;
 }
 
 // Called when the window is resized
@@ -197,6 +670,9 @@ void GLFWCALL window_resized(int width, int height) {
 void keyboard(int key, int action) {
 	if(key == 'Q' && action == GLFW_PRESS) {
 		glfwTerminate();
+		if(batch_meshes > 0) {
+			report_batch(scene_batch);
+		}
 		exit(0);
 	}
 }
@@ -5,9 +5,36 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <chrono>
 //#include <ctime>
 #include <FreeImage.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 // Read a shader source from a file
 // store the shader source in a std::vector<char>
 void read_shader_src(const char *fname, std::vector<char> &buffer);
@@ -30,10 +57,501 @@ void display(GLuint &vao);
 // Initialize the data to be rendered
 void initialize(GLuint &vao);
 
+// An attribute of the vertices, its values are size floats per vertex, the offset is set by upload_vertices
+struct vertex_attribute {
+	const char *name;
+	GLint size;
+	const GLfloat *data;
+	size_t offset;
+};
+
+// Attributes of the vertices and how they are stored in the vertex buffer, either interleaved,
+// all the attributes of a vertex next to each other, or planar, all the values of an attribute together
+struct vertex_layout {
+	std::vector<vertex_attribute> attributes;
+	GLsizei vertex_count;
+	bool interleaved;
+	GLsizei stride;
+};
+
+// Add an attribute to a layout, its data must stay valid until the vertices are uploaded
+void add_vertex_attribute(vertex_layout &layout, const char *name, GLint size, const GLfloat *data);
+
+// Compute the stride and the offsets of the attributes, then fill the bound GL_ARRAY_BUFFER with the vertices
+void upload_vertices(vertex_layout &layout, GLsizei vertex_count, bool interleaved);
+
+// Point an attribute location to an attribute of the uploaded vertices and enable it
+void enable_vertex_attribute(const vertex_layout &layout, const char *name, GLint location);
+
+// Run with --planar to store all the positions then all the other attributes, instead of interleaved vertices
+bool interleaved_vertices = true;
+
 // Load an image from the disk with FreeImage
 void load_image(const char *fname);
 
-int main () {
+// Read an image file with FreeImage, returns NULL if the image can't be read
+FIBITMAP *decode_image(const char *fname);
+
+// Number of bits decoded at once by the Huffman lookup tables
+const int jpeg_fast_bits = 9;
+
+// A Huffman table of a JPEG file, short codes are decoded with a lookup
+struct jpeg_huffman {
+	unsigned char fast_length[1 << jpeg_fast_bits];
+	unsigned char fast_value[1 << jpeg_fast_bits];
+	int mincode[17];
+	int maxcode[17];
+	int valptr[17];
+	unsigned char values[256];
+};
+
+// A color component of a JPEG file, with its coefficients and, once decoded, its pixels
+struct jpeg_component {
+	int id;
+	int h, v;
+	int tq, td, ta;
+	int blocks_w, blocks_h;
+	std::vector<short> coefs;
+	std::vector<unsigned char> pixels;
+};
+
+// Everything read from the headers of a JPEG file
+struct jpeg_image {
+	int width, height;
+	int ncomp;
+	jpeg_component comps[3];
+	int hmax, vmax;
+	int mcus_x, mcus_y;
+	unsigned short quant[4][64];
+	jpeg_huffman dc[4];
+	jpeg_huffman ac[4];
+	// Tables defined so far by the DQT and DHT segments, a scan can only use these
+	bool quant_defined[4], dc_defined[4], ac_defined[4];
+	int restart_interval;
+	bool progressive;
+	// Adobe segment with a transform flag of 0, the components aren't YCbCr
+	bool adobe_rgb;
+	// First MCU row held in the coefficients and in the pixels of the components,
+	// which cover only a window of rows when streaming
+	int coefs_first_mcu_row;
+	int pixels_first_mcu_row;
+};
+
+// Components and spectral selection of a scan
+struct jpeg_scan {
+	int ncomp;
+	int comps[4];
+	int ss, se, ah, al;
+};
+
+// Reads the entropy coded data, removing the stuffed bytes
+struct jpeg_bit_reader {
+	const unsigned char *data;
+	const unsigned char *end;
+	unsigned long long bits;
+	int count;
+};
+
+// Entropy decoding state of a scan, kept between the calls decoding consecutive ranges of its MCUs
+struct jpeg_scan_state {
+	size_t segment;
+	jpeg_bit_reader reader;
+	int dc_pred[4];
+	int eobrun;
+	jpeg_scan_state() : segment((size_t)-1) {}
+};
+
+// Read a JPEG file with our own decoder, using several threads, 0 uses all the cores
+// Returns NULL for the files it doesn't handle (arithmetic coding, CMYK, ...)
+FIBITMAP *jpeg_decode(const char *fname, int threads);
+
+// Parse a JPEG file and decode all its scans to coefficients, returns false for the files we don't handle
+bool jpeg_decode_coefficients(const char *fname, int threads, jpeg_image &image);
+
+// Read a JPEG file and reset the image for its headers, returns false if it isn't a JPEG file
+bool jpeg_open(const char *fname, std::vector<unsigned char> &file, jpeg_image &image);
+
+// Read the markers from p up to the next scan and find its restart segments, p is left at the end of the scan
+// Returns false for the files we don't handle, scan.ncomp is 0 once the end of the image is reached
+bool jpeg_next_scan(const unsigned char *&p, const unsigned char *end, jpeg_image &image, jpeg_scan &scan,
+	std::vector<const unsigned char *> &segments);
+
+// Decode the scan just read, which ends at p, and all the following ones to the coefficients of the whole image
+bool jpeg_decode_all_scans(const unsigned char *p, const unsigned char *end, jpeg_image &image, jpeg_scan &scan,
+	std::vector<const unsigned char *> &segments, int threads);
+
+// Decode a JPEG file into the texture bound to GL_TEXTURE_2D, a band of rows at a time, straight into
+// the mapped slots of the pixel buffer ring, returns false for the files the decoder doesn't handle
+// or when a slot can't be mapped
+bool jpeg_decode_streaming(const char *fname, int threads, GLenum layout);
+
+// Number of threads used to decode the JPEG files, 0 uses all the cores
+int jpeg_decode_threads = 0;
+
+// Time the JPEG decoders on a large image and exit
+void benchmark_jpeg_decode(const char *fname);
+
+// Build the lookup tables of a Huffman table from its DHT definition, which must end before end
+int jpeg_build_huffman(jpeg_huffman &table, const unsigned char *counts, const unsigned char *end);
+
+// Decode a scan, its restart segments are split between the threads
+bool jpeg_decode_scan(jpeg_image &image, const jpeg_scan &scan, const std::vector<const unsigned char *> &segments,
+	const unsigned char *scan_end, int threads);
+
+// Start reading an entropy coded segment
+void jpeg_bits_init(jpeg_bit_reader &reader, const unsigned char *data, const unsigned char *end);
+
+// Make sure at least 57 bits are available, past the end of the segment we get zeros
+void jpeg_bits_fill(jpeg_bit_reader &reader);
+
+// Read n bits, n <= 16
+int jpeg_get_bits(jpeg_bit_reader &reader, int n);
+
+// Decode one Huffman coded symbol
+int jpeg_decode_symbol(jpeg_bit_reader &reader, const jpeg_huffman &table);
+
+// Sign extension of a JPEG coefficient of s bits
+int jpeg_extend(int value, int s);
+
+// Decode one block of the given scan
+void jpeg_decode_block(jpeg_bit_reader &reader, const jpeg_image &image, const jpeg_scan &scan, const jpeg_component &comp,
+	short *coefs, int &dc_pred, int &eobrun);
+
+// Decode the MCUs of a range of restart segments
+void jpeg_decode_segments(jpeg_image &image, const jpeg_scan &scan, const std::vector<const unsigned char *> &segments,
+	const unsigned char *scan_end, size_t first, size_t last);
+
+// Number of MCUs of a scan across and down
+void jpeg_scan_units(const jpeg_image &image, const jpeg_scan &scan, int &units_x, int &units_y);
+
+// Decode the MCUs [first, last) of a scan into the coefficients, the state carries over between calls
+void jpeg_decode_units(jpeg_image &image, const jpeg_scan &scan, const std::vector<const unsigned char *> &segments,
+	const unsigned char *scan_end, jpeg_scan_state &state, long long first, long long last);
+
+// Cosines table of the inverse DCT
+struct jpeg_idct_table {
+	float cosines[8][8];
+	jpeg_idct_table();
+};
+
+// Inverse DCT of a block, dequantized on the fly, the result is stored as pixels with the given stride
+void jpeg_idct_block(const short *coefs, const unsigned short *quant, unsigned char *out, int stride);
+
+// Inverse DCT and color conversion of a band of MCU rows, the image row y is written at row0 + y * pitch
+// as 3 bytes pixels in the FreeImage order or as 4 bytes pixels in the given layout
+void jpeg_output_rows(jpeg_image &image, int first_mcu_row, int last_mcu_row, BYTE *row0, ptrdiff_t pitch,
+	unsigned int bytes, GLenum layout);
+
+// Pixels of an image decoded by FreeImage or by our JPEG decoder, rows go from the bottom to the top
+struct decoded_image {
+	FIBITMAP *bitmap;
+	const BYTE *pixels;
+	unsigned int width;
+	unsigned int height;
+	unsigned int pitch;
+	unsigned int pixel_size;
+};
+
+// Decode the pixels of an image, returns false on failure
+bool acquire_image(const char *fname, decoded_image &image);
+
+// Free the pixels obtained with acquire_image
+void release_image(decoded_image &image);
+
+// Texels of an image as OpenGL takes them, S3TC blocks or tightly packed 4 bytes pixels in the upload layout,
+// either mapped from the texture cache or converted from the decoded pixels, rows go from the bottom to the top
+struct texture_texels {
+	void *mapping;
+	size_t mapping_size;
+	std::vector<unsigned char> storage;
+	const unsigned char *data;
+	size_t size;
+	unsigned int width;
+	unsigned int height;
+	GLenum internal_format;
+	// Layout of the pixels, 0 for S3TC blocks
+	GLenum format;
+	// A row of blocks covers 4 rows of pixels
+	unsigned int row_pitch;
+	unsigned int row_height;
+};
+
+// Get the texels of an image, S3TC blocks if compress is true, from the texture cache if possible, otherwise
+// the image is decoded, converted and stored in the cache for the next runs, returns false on failure
+bool acquire_texels(const char *fname, bool compress, texture_texels &texels);
+
+// Free the texels obtained with acquire_texels
+void release_texels(texture_texels &texels);
+
+// Convert decoded pixels to texels, S3TC blocks if compress is true, returns false for the images that aren't RGB or RGBA
+bool convert_texels(const decoded_image &image, bool compress, texture_texels &texels);
+
+// Size in bytes of a level of a texture with the given internal format, 0 for the formats we don't use
+size_t texture_level_size(GLenum internal_format, unsigned int width, unsigned int height);
+
+// Header of a texture cache file, the texels of each level are stored as OpenGL takes them
+// and start on a page boundary, so they can be given to OpenGL straight from the mapped file
+struct texture_cache_header {
+	char magic[8];
+	unsigned int version;
+	unsigned int width;
+	unsigned int height;
+	unsigned int gl_internal_format;
+	unsigned int gl_format;
+	unsigned int levels;
+	unsigned long long source_size;
+	long long source_mtime;
+	unsigned long long source_hash;
+	unsigned long long level_offset[16];
+	unsigned long long level_size[16];
+};
+
+// Folder of the texture cache and the alignment of the pixels in its files
+const char *texture_cache_dir = "texture_cache";
+const size_t texture_cache_alignment = 4096;
+
+// Try to map the cached texels of an image, checking that the source file didn't change
+// and that they have the kind asked for, S3TC blocks or pixels in the upload layout
+bool open_cached_texels(const char *fname, unsigned long long source_size, long long source_mtime,
+	unsigned long long source_hash, bool compress, texture_texels &texels);
+
+// Store the texels of an image in the texture cache
+void store_cached_texels(const char *fname, unsigned long long source_size, long long source_mtime,
+	unsigned long long source_hash, const texture_texels &texels);
+
+// Name of the cache file of an image
+std::string texture_cache_file(const char *fname);
+
+// 64 bits FNV-1a hash, used to key the texture cache
+unsigned long long fnv1a_hash(const unsigned char *data, size_t length, unsigned long long hash = 14695981039346656037ULL);
+
+// Texture cache statistics, printed at exit
+std::atomic<int> texture_cache_hits(0);
+std::atomic<int> texture_cache_misses(0);
+
+// S3TC blocks of an image, BC1 for RGB images and BC3 for RGBA images
+// Block rows go from the bottom to the top of the image, like the pixels
+struct compressed_image {
+	std::vector<unsigned char> blocks;
+	unsigned int width;
+	unsigned int height;
+	unsigned int block_size;
+	GLenum format;
+};
+
+// Compress the pixels of an image with the given number of threads, 0 uses all the cores
+bool compress_image(const decoded_image &image, compressed_image &compressed, int threads);
+
+// Compress a band of block rows
+void compress_block_rows(const decoded_image &image, compressed_image &compressed, unsigned int first, unsigned int last);
+
+// Convert a color to RGB 5:6:5, with rounding
+unsigned int bc_pack_565(const int *color);
+
+// Expand a RGB 5:6:5 color to 8 bits per channel, in BGR order
+void bc_unpack_565(unsigned int packed, int *color);
+
+// Encode the colors of a 4x4 block of BGRA pixels as a BC1 block
+void encode_bc1_block(const unsigned char *pixels, unsigned char *out);
+
+// Encode the alpha of a 4x4 block of BGRA pixels as the first half of a BC3 block
+void encode_bc3_alpha_block(const unsigned char *pixels, unsigned char *out);
+
+// Decode a BC1 or BC3 block to 4x4 BGRA pixels, used to measure the quality of the encoder
+void decode_bc_block(const unsigned char *block, GLenum format, unsigned char *pixels);
+
+// Time the block encoder and measure its PSNR, then exit
+void benchmark_compression(const char *fname);
+
+// Run with --no-compress to upload the textures uncompressed even if S3TC is available
+bool compress_textures = true;
+
+// Layout of the uncompressed uploads, tightly packed 4 bytes pixels, run with --rgba to use GL_RGBA
+GLenum upload_layout = GL_BGRA;
+
+// Repack rows of BGR or BGRA pixels to tightly packed BGRA or RGBA pixels, in one pass
+void swizzle_rows(const BYTE *src, unsigned int src_pitch, unsigned int src_bytes, BYTE *dst, unsigned int dst_pitch,
+	unsigned int width, unsigned int rows, GLenum layout);
+
+// Repack a row of pixels, the scalar version and the vectorized versions compiled in
+typedef void (*swizzle_row_function)(const BYTE *src, unsigned int src_bytes, BYTE *dst, unsigned int width, GLenum layout);
+void swizzle_row_scalar(const BYTE *src, unsigned int src_bytes, BYTE *dst, unsigned int width, GLenum layout);
+#ifdef __SSSE3__
+void swizzle_row_ssse3(const BYTE *src, unsigned int src_bytes, BYTE *dst, unsigned int width, GLenum layout);
+#endif
+#ifdef __AVX2__
+void swizzle_row_avx2(const BYTE *src, unsigned int src_bytes, BYTE *dst, unsigned int width, GLenum layout);
+#endif
+
+// Time the repacking of an image to both layouts with each version, then exit
+void benchmark_swizzle(const char *fname);
+
+// Header of a baked texture, a KTX-like container written offline with --bake: the texels of each
+// mip level are stored as OpenGL takes them, swizzled or block compressed, and start on a page boundary
+struct baked_texture_header {
+	char magic[8];
+	unsigned int version;
+	unsigned int endianness;
+	unsigned int gl_internal_format;
+	unsigned int gl_format;
+	unsigned int gl_type;
+	unsigned int width;
+	unsigned int height;
+	unsigned int levels;
+	unsigned long long level_offset[16];
+	unsigned long long level_size[16];
+};
+
+// Written by the baker, a loader on a machine with the other byte order reads it as 0x01020304
+const unsigned int baked_texture_endianness = 0x04030201;
+
+// Decode an image, build its mip chain and write it to a baked texture, compressed unless --no-compress
+// is given and repacked to the --rgba or default layout otherwise, returns false on failure
+bool bake_texture(const char *fname, const char *baked_file);
+
+// Halve an image with a box filter in linear light, the alpha is averaged as it is
+// The pixels of the result are tightly packed, with the same size as the source pixels
+void downsample_image(const decoded_image &src, std::vector<BYTE> &pixels, decoded_image &dst);
+
+// Map a baked texture and give each level to OpenGL straight from the mapping, returns false on failure
+bool load_baked_texture(const char *fname);
+
+// Run with --baked <file> to load the scene texture from a baked texture instead of squirrel.jpg
+const char *baked_texture_file = NULL;
+
+// A texture loaded in the background: the image is decoded on a worker thread,
+// then copied in slices through the pixel buffer ring, a few slices per frame
+struct texture_upload {
+	GLuint texture;
+	std::string fname;
+	std::thread decoder;
+	std::atomic<bool> decoded;
+	bool loaded;
+	bool compress;
+	texture_texels texels;
+	unsigned int next_row;
+	GLsync fence;
+	bool ready;
+};
+
+// Start loading an image in the texture, without waiting for the decoding or the upload
+texture_upload *load_image_async(const char *fname, GLuint texture);
+
+// Called once per frame, moves the pending uploads forward without ever waiting for the GPU
+void update_texture_uploads();
+
+// Textures being loaded in the background
+std::vector<texture_upload *> texture_uploads;
+
+// A slot of the pixel buffer ring, the fence tells when the GPU is done reading it
+struct pixel_buffer_slot {
+	GLuint pbo;
+	GLsync fence;
+};
+
+// Pixel unpack buffers reused for all the uploads, created once
+const int pixel_buffer_ring_size = 3;
+const GLsizeiptr pixel_buffer_slot_size = 4 * 1024 * 1024;
+pixel_buffer_slot pixel_buffer_ring[pixel_buffer_ring_size];
+int pixel_buffer_next = 0;
+
+// Create the pixel buffer ring
+void create_pixel_buffer_ring();
+
+// True if the GPU has passed the fence, never blocks
+bool fence_signaled(GLsync fence);
+
+// The scene texture, drawn once its upload is complete
+texture_upload *scene_texture = NULL;
+
+// Run with --sync to load the texture with load_image on the render thread, to compare the frame times
+bool synchronous_load = false;
+
+// Run with --stream to decode the texture on the render thread straight into the pixel buffers,
+// without ever holding the whole decoded image, to compare the peak memory with --sync
+bool streaming_load = false;
+
+// Peak resident memory of the process so far, in KB
+long peak_rss_kb();
+
+// Longest frame while the texture was loading, in seconds
+double longest_loading_frame = 0;
+
+// A run of triangle indices drawn with one call, its indices are stored relative to base_vertex
+struct index_chunk {
+	GLsizei first;
+	GLsizei count;
+	GLint base_vertex;
+};
+
+// Indices stored with the smallest type that holds them, GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+// A mesh with more vertices than 16 bits indices can address is split in chunks drawn with a base vertex
+struct index_buffer {
+	GLenum type;
+	GLsizei count;
+	std::vector<index_chunk> chunks;
+};
+
+// Fill the bound GL_ELEMENT_ARRAY_BUFFER with triangle indices, using the smallest index type
+void upload_indices(index_buffer &buffer, const GLuint *indices, GLsizei count);
+
+// Draw count indices from first, one call per chunk they cover
+void draw_indices(const index_buffer &buffer, GLsizei first, GLsizei count);
+
+// Size in bytes of an index type
+size_t index_type_size(GLenum type);
+
+// Indices of the scene
+index_buffer scene_indices;
+
+int main (int argc, char **argv) {
+	const char *bake_source = NULL, *bake_target = NULL;
+	for(int i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "--sync") == 0) {
+			synchronous_load = true;
+		}
+		else if(strcmp(argv[i], "--stream") == 0) {
+			streaming_load = true;
+		}
+		else if(strcmp(argv[i], "--planar") == 0) {
+			interleaved_vertices = false;
+		}
+		else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			jpeg_decode_threads = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--bench-decode") == 0) {
+			// Optionally followed by the JPEG file to use
+			benchmark_jpeg_decode(i + 1 < argc ? argv[i + 1] : NULL);
+		}
+		else if(strcmp(argv[i], "--no-compress") == 0) {
+			compress_textures = false;
+		}
+		else if(strcmp(argv[i], "--rgba") == 0) {
+			upload_layout = GL_RGBA;
+		}
+		else if(strcmp(argv[i], "--bench-swizzle") == 0) {
+			// Optionally followed by the image file to use
+			benchmark_swizzle(i + 1 < argc ? argv[i + 1] : "squirrel.jpg");
+		}
+		else if(strcmp(argv[i], "--bench-compress") == 0) {
+			// Optionally followed by the image file to use
+			benchmark_compression(i + 1 < argc ? argv[i + 1] : "squirrel.jpg");
+		}
+		else if(strcmp(argv[i], "--baked") == 0 && i + 1 < argc) {
+			baked_texture_file = argv[++i];
+		}
+		else if(strcmp(argv[i], "--bake") == 0 && i + 2 < argc) {
+			bake_source = argv[i + 1];
+			bake_target = argv[i + 2];
+			i += 2;
+		}
+	}
+
+	// --bake <image> <baked file> only writes the baked texture, without opening a window
+	if(bake_source) {
+		exit(bake_texture(bake_source, bake_target) ? 0 : -1);
+	}
+
 	// Initialize GLFW
 	if ( !glfwInit()) {
 		std::cerr << "Failed to initialize GLFW! I'm out!" << std::endl;
@@ -72,6 +590,11 @@ int main () {
 		exit(-1);
 	}
 
+	// Without S3TC support the textures are uploaded uncompressed
+	if(!GLEW_EXT_texture_compression_s3tc) {
+		compress_textures = false;
+	}
+
 	// Create a vertex array object
 	GLuint vao;
 
@@ -80,11 +603,22 @@ int main () {
 
 	// Create a rendering loop
 	int running = GL_TRUE;
+	double frame_start = glfwGetTime();
 
 	while(running) {
+		// Continue the texture uploads, if any
+		update_texture_uploads();
+
 		// Display scene
 		display(vao);
 
+		// Keep track of the hitches while the texture loads
+		double frame_end = glfwGetTime();
+		if(scene_texture && !scene_texture->ready && frame_end - frame_start > longest_loading_frame) {
+			longest_loading_frame = frame_end - frame_start;
+		}
+		frame_start = frame_end;
+
 		// Pool for events
 		glfwPollEvents();
 		// Check if the window was closed
@@ -94,6 +628,9 @@ int main () {
 	// Terminate GLFW
 	glfwTerminate();
 
+	std::cout << "Texture cache: " << texture_cache_hits.load() << " hits, " << texture_cache_misses.load() << " misses" << std::endl;
+	std::cout << "Peak RSS: " << peak_rss_kb() / 1024.0 << " MB" << std::endl;
+
 	return 0;
 }
 
@@ -101,8 +638,11 @@ int main () {
 void display(GLuint &vao) {
 	glClear(GL_COLOR_BUFFER_BIT);
 
-	glBindVertexArray(vao);
-	glDrawElements( GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	// The quad is drawn only once its texture is complete
+	if(!scene_texture || scene_texture->ready) {
+		glBindVertexArray(vao);
+		draw_indices(scene_indices, 0, scene_indices.count);
+	}
 
 	// Swap front and back buffers
 	glfwSwapBuffers();
@@ -137,15 +677,14 @@ void initialize(GLuint &vao) {
 	GLuint vbo;
 	glGenBuffers(1, &vbo);
 
-	// Allocate space for vertex positions and texture coordinates
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices_position) + sizeof(texture_coord), NULL, GL_STATIC_DRAW);
-
-	// Transfer the vertex positions:
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices_position), vertices_position);
+	// Describe the vertices, the stride and offsets of the attributes follow from the layout
+	vertex_layout layout;
+	add_vertex_attribute(layout, "position", 2, vertices_position);
+	add_vertex_attribute(layout, "texture_coord", 2, texture_coord);
 
-	// Transfer the texture coordinates:
-	glBufferSubData(GL_ARRAY_BUFFER, sizeof(vertices_position), sizeof(texture_coord), texture_coord);
+	// Transfer the vertex positions and texture coordinates
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	upload_vertices(layout, sizeof(vertices_position) / (2 * sizeof(GLfloat)), interleaved_vertices);
 
 	// Create an Element Array Buffer that will store the indices array:
 	GLuint eab;
@@ -153,7 +692,7 @@ void initialize(GLuint &vao) {
 
 	// Transfer the data from indices to eab
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eab);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	upload_indices(scene_indices, indices, sizeof(indices) / sizeof(GLuint));
 
 	// Create a texture
 	GLuint texture;
@@ -162,23 +701,46 @@ void initialize(GLuint &vao) {
 	// Specify that we work with a 2D texture
 	glBindTexture(GL_TEXTURE_2D, texture);
 
-	load_image("squirrel.jpg");
+	if(baked_texture_file) {
+		// Nothing to decode or convert, the levels go from the mapped file to OpenGL
+		double start = glfwGetTime();
+		if(!load_baked_texture(baked_texture_file)) {
+			std::cerr << "Unable to load the baked texture " << baked_texture_file << " I'm out!" << std::endl;
+			exit(-1);
+		}
+		std::cout << "Baked texture loaded in " << (glfwGetTime() - start) * 1000.0 << " ms" << std::endl;
+	}
+	else if(streaming_load) {
+		// Only the coefficients and a slot of pixels are in memory at once, other files go through load_image
+		double start = glfwGetTime();
+		create_pixel_buffer_ring();
+		if(!jpeg_decode_streaming("squirrel.jpg", jpeg_decode_threads, upload_layout)) {
+			load_image("squirrel.jpg");
+		}
+		std::cout << "Streaming load: " << (glfwGetTime() - start) * 1000.0 << " ms, peak RSS " << peak_rss_kb() / 1024.0 << " MB" << std::endl;
+	}
+	else if(synchronous_load) {
+		// The render thread is blocked for the whole load, this is the hitch the async path avoids
+		double start = glfwGetTime();
+		load_image("squirrel.jpg");
+		std::cout << "Synchronous load_image: " << (glfwGetTime() - start) * 1000.0 << " ms, peak RSS " << peak_rss_kb() / 1024.0 << " MB" << std::endl;
+	}
+	else {
+		create_pixel_buffer_ring();
+		scene_texture = load_image_async("squirrel.jpg", texture);
+	}
 
 	GLuint shaderProgram = create_program("shaders/vert.shader", "shaders/frag.shader");
 
 	// Get the location of the attributes that enters in the vertex shader
 	GLint position_attribute = glGetAttribLocation(shaderProgram, "position");
 
-	// Specify how the data for position can be accessed
-	glVertexAttribPointer(position_attribute, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-	// Enable the attribute
-	glEnableVertexAttribArray(position_attribute);
+	// Specify how the data for position can be accessed, and enable the attribute
+	enable_vertex_attribute(layout, "position", position_attribute);
 
 	// Texture coord attribute
 	GLint texture_coord_attribute = glGetAttribLocation(shaderProgram, "texture_coord");
-	glVertexAttribPointer(texture_coord_attribute, 2, GL_FLOAT, GL_FALSE, 0, (GLvoid *)sizeof(vertices_position));
-	glEnableVertexAttribArray(texture_coord_attribute);
+	enable_vertex_attribute(layout, "texture_coord", texture_coord_attribute);
 
 }
 
@@ -189,42 +751,21 @@ void load_image(const char *fname) {
 		FreeImage_Initialise();
 	#endif
 
-	FIBITMAP *bitmap;
-	// Get the format of the image file
-	FREE_IMAGE_FORMAT fif =FreeImage_GetFileType(fname, 0);
-
-	// If the format can't be determined, try to guess the format from the file name
-	if(fif == FIF_UNKNOWN) {
-		fif = FreeImage_GetFIFFromFilename(fname);
-	}
-
-	// Load the data in bitmap if possible
-	if(fif != FIF_UNKNOWN && FreeImage_FIFSupportsReading(fif)) {
-		bitmap = FreeImage_Load(fif, fname);
-	}
-	else {
-		bitmap = NULL;
-	}
-
-	// PROCESS IMAGE if bitmap was successfully initialized
-	if(bitmap) {
-		unsigned int w = FreeImage_GetWidth(bitmap);
-		unsigned int h = FreeImage_GetHeight(bitmap);
-		unsigned pixel_size = FreeImage_GetBPP(bitmap);
+	texture_texels texels;
 
-		// Get a pointer to the pixel data
-		BYTE *data = (BYTE*)FreeImage_GetBits(bitmap);
+	// PROCESS IMAGE if the texels were successfully obtained
+	if(acquire_texels(fname, compress_textures, texels)) {
+		unsigned int w = texels.width;
+		unsigned int h = texels.height;
 
-		// Process only RGB and RGBA images
-		if(pixel_size == 24) {
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_BGR, GL_UNSIGNED_BYTE, (GLvoid*)data);
-		}
-		else if (pixel_size == 32) {
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_BGRA, GL_UNSIGNED_BYTE, (GLvoid*)data);
+		// The texels are given to OpenGL as they are, straight from the mapping on a cache hit
+		if(texels.format == 0) {
+			glCompressedTexImage2D(GL_TEXTURE_2D, 0, texels.internal_format, w, h, 0, (GLsizei)texels.size, texels.data);
 		}
 		else {
-			std::cerr << "pixel size = " << pixel_size << " don't know how to process this case. I'm out!" << std::endl;
-			exit(-1);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+			glTexImage2D(GL_TEXTURE_2D, 0, texels.internal_format, w, h, 0, texels.format, GL_UNSIGNED_BYTE, texels.data);
 		}
 		
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -235,8 +776,8 @@ void load_image(const char *fname) {
 		exit(-1);
 	}
 
-	// Clean bitmap;
-	FreeImage_Unload(bitmap);
+	// Clean texels;
+	release_texels(texels);
 
 	// active only for static linking
 	#ifdef FREEIMAGE_LIB
@@ -245,6 +786,151 @@ void load_image(const char *fname) {
 }
 
 
+// Add an attribute to a layout, its data must stay valid until the vertices are uploaded
+void add_vertex_attribute(vertex_layout &layout, const char *name, GLint size, const GLfloat *data) {
+	vertex_attribute attribute = { name, size, data, 0 };
+	layout.attributes.push_back(attribute);
+}
+
+// Compute the stride and the offsets of the attributes, then fill the bound GL_ARRAY_BUFFER with the vertices
+// Interleaved, the stride is the size of a whole vertex and an attribute starts at the sum of the sizes before it,
+// planar, each attribute is a tightly packed block of vertex_count values
+void upload_vertices(vertex_layout &layout, GLsizei vertex_count, bool interleaved) {
+	layout.vertex_count = vertex_count;
+	layout.interleaved = interleaved;
+	size_t vertex_size = 0;
+	for(size_t i = 0; i < layout.attributes.size(); ++i) {
+		layout.attributes[i].offset = interleaved ? vertex_size : vertex_size * vertex_count;
+		vertex_size += layout.attributes[i].size * sizeof(GLfloat);
+	}
+	layout.stride = interleaved ? (GLsizei)vertex_size : 0;
+
+	// The vertices are written straight in the buffer, without an intermediate copy
+	GLsizeiptr size = (GLsizeiptr)(vertex_size * vertex_count);
+	glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STATIC_DRAW);
+	unsigned char *dst = (unsigned char *)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	for(size_t i = 0; i < layout.attributes.size(); ++i) {
+		const vertex_attribute &attribute = layout.attributes[i];
+		size_t attribute_size = attribute.size * sizeof(GLfloat);
+		if(interleaved) {
+			for(GLsizei v = 0; v < vertex_count; ++v) {
+				memcpy(dst + attribute.offset + v * vertex_size, attribute.data + (size_t)v * attribute.size, attribute_size);
+			}
+		}
+		else {
+			memcpy(dst + attribute.offset, attribute.data, attribute_size * vertex_count);
+		}
+	}
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+}
+
+// Point an attribute location to an attribute of the uploaded vertices and enable it
+void enable_vertex_attribute(const vertex_layout &layout, const char *name, GLint location) {
+	for(size_t i = 0; i < layout.attributes.size(); ++i) {
+		const vertex_attribute &attribute = layout.attributes[i];
+		if(strcmp(attribute.name, name) == 0) {
+			glVertexAttribPointer(location, attribute.size, GL_FLOAT, GL_FALSE, layout.stride, (GLvoid *)attribute.offset);
+			glEnableVertexAttribArray(location);
+			return;
+		}
+	}
+	std::cerr << "The vertex layout has no attribute " << name << " I'm out!" << std::endl;
+	exit(-1);
+}
+
+// Fill the bound GL_ELEMENT_ARRAY_BUFFER with triangle indices, using the smallest index type
+// Up to 65536 vertices the indices are stored as they are, in bytes or shorts. Past that, the triangles are
+// split in chunks whose vertices are within 65536 of the chunk base vertex, each chunk is a draw. A triangle
+// spanning more than that can't be split, the mesh then keeps 32 bits indices
+void upload_indices(index_buffer &buffer, const GLuint *indices, GLsizei count) {
+	GLuint max_index = 0;
+	for(GLsizei i = 0; i < count; ++i) {
+		max_index = std::max(max_index, indices[i]);
+	}
+	buffer.count = count;
+	buffer.chunks.clear();
+	buffer.type = max_index <= 0xFF ? GL_UNSIGNED_BYTE : max_index <= 0xFFFF ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+	if(buffer.type == GL_UNSIGNED_INT) {
+		// A chunk starts at the lowest vertex of its first triangle and ends with the first triangle out of range
+		buffer.type = GL_UNSIGNED_SHORT;
+		index_chunk chunk = { 0, 0, 0 };
+		for(GLsizei i = 0; i + 2 < count; i += 3) {
+			GLuint low = std::min(indices[i], std::min(indices[i + 1], indices[i + 2]));
+			GLuint high = std::max(indices[i], std::max(indices[i + 1], indices[i + 2]));
+			if(high - low > 0xFFFF) {
+				buffer.type = GL_UNSIGNED_INT;
+				buffer.chunks.clear();
+				break;
+			}
+			if(chunk.count == 0 || low < (GLuint)chunk.base_vertex || high - chunk.base_vertex > 0xFFFF) {
+				if(chunk.count > 0) {
+					buffer.chunks.push_back(chunk);
+				}
+				chunk.first = i;
+				chunk.count = 0;
+				chunk.base_vertex = (GLint)low;
+			}
+			chunk.count += 3;
+		}
+		if(buffer.type == GL_UNSIGNED_SHORT && chunk.count > 0) {
+			buffer.chunks.push_back(chunk);
+		}
+	}
+	if(buffer.chunks.empty()) {
+		index_chunk chunk = { 0, count, 0 };
+		buffer.chunks.push_back(chunk);
+	}
+
+	// Write the indices relative to their chunk, straight in the buffer
+	size_t size = index_type_size(buffer.type);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * size, NULL, GL_STATIC_DRAW);
+	unsigned char *dst = (unsigned char *)glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, count * size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	for(size_t c = 0; c < buffer.chunks.size(); ++c) {
+		const index_chunk &chunk = buffer.chunks[c];
+		for(GLsizei i = chunk.first; i < chunk.first + chunk.count; ++i) {
+			GLuint index = indices[i] - chunk.base_vertex;
+			if(buffer.type == GL_UNSIGNED_BYTE) {
+				dst[i] = (GLubyte)index;
+			}
+			else if(buffer.type == GL_UNSIGNED_SHORT) {
+				((GLushort *)dst)[i] = (GLushort)index;
+			}
+			else {
+				((GLuint *)dst)[i] = index;
+			}
+		}
+	}
+	glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+}
+
+// Draw count indices from first, one call per chunk they cover
+// The base vertex draws are core from OpenGL 3.2, the chunk at the start of the mesh doesn't need one
+void draw_indices(const index_buffer &buffer, GLsizei first, GLsizei count) {
+	size_t size = index_type_size(buffer.type);
+	for(size_t c = 0; c < buffer.chunks.size(); ++c) {
+		const index_chunk &chunk = buffer.chunks[c];
+		GLsizei begin = std::max(first, chunk.first);
+		GLsizei end = std::min(first + count, chunk.first + chunk.count);
+		if(begin >= end) {
+			continue;
+		}
+		const GLvoid *offset = (const GLvoid *)(begin * size);
+		if(chunk.base_vertex == 0) {
+			glDrawElements(GL_TRIANGLES, end - begin, buffer.type, offset);
+		}
+		else {
+			glDrawElementsBaseVertex(GL_TRIANGLES, end - begin, buffer.type, offset, chunk.base_vertex);
+		}
+	}
+}
+
+// Size in bytes of an index type
+size_t index_type_size(GLenum type) {
+	return type == GL_UNSIGNED_BYTE ? 1 : type == GL_UNSIGNED_SHORT ? 2 : 4;
+}
+
 // Called when the window is resized
 void GLFWCALL window_resized(int width, int height) {
 	// Use red to clear the screen
@@ -339,3 +1025,2120 @@ GLuint create_program(const char *path_vert_shader, const char *path_frag_shader
 	return shaderProgram;
 }
 
+
+// Read an image file with FreeImage, returns NULL if the image can't be read
+FIBITMAP *decode_image(const char *fname) {
+	// Get the format of the image file
+	FREE_IMAGE_FORMAT fif =FreeImage_GetFileType(fname, 0);
+
+	// If the format can't be determined, try to guess the format from the file name
+	if(fif == FIF_UNKNOWN) {
+		fif = FreeImage_GetFIFFromFilename(fname);
+	}
+
+	// JPEG files are decoded on all the cores, FreeImage is kept for the cases our decoder doesn't handle
+	if(fif == FIF_JPEG) {
+		FIBITMAP *bitmap = jpeg_decode(fname, jpeg_decode_threads);
+		if(bitmap) {
+			return bitmap;
+		}
+	}
+
+	// Load the data in bitmap if possible
+	if(fif != FIF_UNKNOWN && FreeImage_FIFSupportsReading(fif)) {
+		return FreeImage_Load(fif, fname);
+	}
+	return NULL;
+}
+
+// Zigzag order of the coefficients of a block, to their position in the 8x8 block
+const unsigned char jpeg_zigzag[64] = {
+	0, 1, 8, 16, 9, 2, 3, 10,
+	17, 24, 32, 25, 18, 11, 4, 5,
+	12, 19, 26, 33, 40, 48, 41, 34,
+	27, 20, 13, 6, 7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36,
+	29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46,
+	53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// Read a JPEG file with our own decoder, using several threads
+// Returns NULL for the files it doesn't handle (arithmetic coding, CMYK, ...)
+FIBITMAP *jpeg_decode(const char *fname, int threads) {
+	if(threads <= 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	jpeg_image image;
+	if(!jpeg_decode_coefficients(fname, threads, image)) {
+		return NULL;
+	}
+
+	// Convert the coefficients to pixels, by bands of MCU rows
+	FIBITMAP *bitmap = FreeImage_Allocate(image.width, image.height, 24);
+	if(!bitmap) {
+		return NULL;
+	}
+	for(int c = 0; c < image.ncomp; ++c) {
+		jpeg_component &comp = image.comps[c];
+		comp.pixels.resize((size_t)comp.blocks_w * comp.blocks_h * 64);
+	}
+	image.pixels_first_mcu_row = 0;
+
+	// FreeImage stores the bottom row first
+	BYTE *row0 = FreeImage_GetScanLine(bitmap, image.height - 1);
+	ptrdiff_t pitch = -(ptrdiff_t)FreeImage_GetPitch(bitmap);
+	int bands = std::min(threads, image.mcus_y);
+	std::vector<std::thread> workers;
+	for(int b = 0; b < bands; ++b) {
+		int first = image.mcus_y * b / bands;
+		int last = image.mcus_y * (b + 1) / bands;
+		workers.push_back(std::thread(jpeg_output_rows, std::ref(image), first, last, row0, pitch, 3u, (GLenum)GL_BGR));
+	}
+	for(size_t i = 0; i < workers.size(); ++i) {
+		workers[i].join();
+	}
+	return bitmap;
+}
+
+// Parse a JPEG file and decode all its scans to coefficients, returns false for the files we don't handle
+// The scans are decoded as they come, the restart segments of each scan split between the threads
+bool jpeg_decode_coefficients(const char *fname, int threads, jpeg_image &image) {
+	std::vector<unsigned char> file;
+	if(!jpeg_open(fname, file, image)) {
+		return false;
+	}
+	const unsigned char *p = &file[2];
+	const unsigned char *end = &file[0] + file.size();
+	jpeg_scan scan;
+	std::vector<const unsigned char *> segments;
+	if(!jpeg_next_scan(p, end, image, scan, segments) || scan.ncomp == 0) {
+		return false;
+	}
+	return jpeg_decode_all_scans(p, end, image, scan, segments, threads);
+}
+
+// Read a JPEG file and reset the image for its headers, returns false if it isn't a JPEG file
+bool jpeg_open(const char *fname, std::vector<unsigned char> &file, jpeg_image &image) {
+	std::ifstream in(fname, std::ios::binary);
+	if(!in.is_open()) {
+		return false;
+	}
+	file.assign((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	if(file.size() < 4 || file[0] != 0xFF || file[1] != 0xD8) {
+		return false;
+	}
+
+	image.width = 0;
+	image.height = 0;
+	image.restart_interval = 0;
+	image.progressive = false;
+	image.adobe_rgb = false;
+	image.ncomp = 0;
+	image.coefs_first_mcu_row = 0;
+	image.pixels_first_mcu_row = 0;
+	memset(image.quant_defined, 0, sizeof(image.quant_defined));
+	memset(image.dc_defined, 0, sizeof(image.dc_defined));
+	memset(image.ac_defined, 0, sizeof(image.ac_defined));
+	return true;
+}
+
+// Decode the scan just read, which ends at p, and all the following ones to the coefficients of the whole image
+bool jpeg_decode_all_scans(const unsigned char *p, const unsigned char *end, jpeg_image &image, jpeg_scan &scan,
+	std::vector<const unsigned char *> &segments, int threads) {
+	// Every scan adds to the coefficients of all the blocks it covers
+	for(int c = 0; c < image.ncomp; ++c) {
+		jpeg_component &comp = image.comps[c];
+		comp.coefs.assign((size_t)comp.blocks_w * comp.blocks_h * 64, 0);
+	}
+	image.coefs_first_mcu_row = 0;
+	while(scan.ncomp != 0) {
+		if(!jpeg_decode_scan(image, scan, segments, p, threads) || !jpeg_next_scan(p, end, image, scan, segments)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Read the markers from p up to the next scan and find its restart segments, p is left at the end of the scan
+// Returns false for the files we don't handle, scan.ncomp is 0 once the end of the image is reached
+bool jpeg_next_scan(const unsigned char *&p, const unsigned char *end, jpeg_image &image, jpeg_scan &scan,
+	std::vector<const unsigned char *> &segments) {
+	while(p + 4 <= end) {
+		if(p[0] != 0xFF) {
+			return false;
+		}
+		unsigned char marker = p[1];
+		if(marker == 0xFF) {
+			p++;
+			continue;
+		}
+		if(marker == 0xD9) {
+			break;
+		}
+		unsigned int length = (p[2] << 8) | p[3];
+		const unsigned char *segment = p + 4;
+		if(length < 2 || segment + length - 2 > end) {
+			return false;
+		}
+		p += 2 + length;
+		const unsigned char *segment_end = segment + length - 2;
+
+		if(marker == 0xDB) {
+			// Quantization tables, 8 or 16 bits
+			const unsigned char *q = segment;
+			while(q < segment_end) {
+				int precision = q[0] >> 4, id = q[0] & 15;
+				if(precision > 1 || id > 3 || segment_end - q < (precision ? 129 : 65)) {
+					return false;
+				}
+				image.quant_defined[id] = true;
+				q++;
+				for(int k = 0; k < 64; ++k) {
+					image.quant[id][jpeg_zigzag[k]] = precision ? (q[2 * k] << 8) | q[2 * k + 1] : q[k];
+				}
+				q += precision ? 128 : 64;
+			}
+		}
+		else if(marker == 0xC4) {
+			// Huffman tables
+			const unsigned char *q = segment;
+			while(q < segment_end) {
+				int table_class = q[0] >> 4, id = q[0] & 15;
+				if(table_class > 1 || id > 3) {
+					return false;
+				}
+				jpeg_huffman &table = table_class ? image.ac[id] : image.dc[id];
+				int count = jpeg_build_huffman(table, q + 1, segment_end);
+				if(count < 0) {
+					return false;
+				}
+				// The DC symbols are the bit sizes of the differences, at most 11 bits for 8 bits samples
+				for(int k = 0; k < count && !table_class; ++k) {
+					if(table.values[k] > 11) {
+						return false;
+					}
+				}
+				(table_class ? image.ac_defined : image.dc_defined)[id] = true;
+				q += 17 + count;
+			}
+		}
+		else if(marker == 0xDD) {
+			if(length < 4) {
+				return false;
+			}
+			image.restart_interval = (segment[0] << 8) | segment[1];
+		}
+		else if(marker == 0xC0 || marker == 0xC1 || marker == 0xC2) {
+			// Start of frame, only the Huffman coded baseline, extended and progressive frames, a single one
+			if(image.ncomp != 0 || length < 8 || segment[0] != 8) {
+				return false;
+			}
+			image.progressive = marker == 0xC2;
+			image.height = (segment[1] << 8) | segment[2];
+			image.width = (segment[3] << 8) | segment[4];
+			image.ncomp = segment[5];
+			if(image.width == 0 || image.height == 0 || (image.ncomp != 1 && image.ncomp != 3) || length < 8 + 3 * (unsigned int)image.ncomp) {
+				return false;
+			}
+			image.hmax = 1;
+			image.vmax = 1;
+			for(int c = 0; c < image.ncomp; ++c) {
+				jpeg_component &comp = image.comps[c];
+				comp.id = segment[6 + 3 * c];
+				comp.h = segment[7 + 3 * c] >> 4;
+				comp.v = segment[7 + 3 * c] & 15;
+				comp.tq = segment[8 + 3 * c] & 3;
+				if(comp.h < 1 || comp.h > 4 || comp.v < 1 || comp.v > 4) {
+					return false;
+				}
+				image.hmax = std::max(image.hmax, comp.h);
+				image.vmax = std::max(image.vmax, comp.v);
+			}
+			image.mcus_x = (image.width + 8 * image.hmax - 1) / (8 * image.hmax);
+			image.mcus_y = (image.height + 8 * image.vmax - 1) / (8 * image.vmax);
+			for(int c = 0; c < image.ncomp; ++c) {
+				jpeg_component &comp = image.comps[c];
+				comp.blocks_w = image.mcus_x * comp.h;
+				comp.blocks_h = image.mcus_y * comp.v;
+			}
+		}
+		else if((marker >= 0xC3 && marker <= 0xCF) && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+			// Lossless, hierarchical or arithmetic coded frames are left to FreeImage
+			return false;
+		}
+		else if(marker == 0xEE) {
+			// Adobe segment, a transform flag of 0 means the components aren't YCbCr
+			if(length >= 14 && memcmp(segment, "Adobe", 5) == 0) {
+				image.adobe_rgb = segment[11] == 0;
+			}
+		}
+		else if(marker == 0xDA) {
+			if(image.ncomp == 0) {
+				return false;
+			}
+			// Only matters with 3 components, a grayscale image is the same either way
+			if(image.adobe_rgb && image.ncomp == 3) {
+				return false;
+			}
+			scan.ncomp = length >= 3 ? segment[0] : 0;
+			if(scan.ncomp < 1 || scan.ncomp > image.ncomp || length < 6 + 2 * (unsigned int)scan.ncomp) {
+				return false;
+			}
+			for(int i = 0; i < scan.ncomp; ++i) {
+				int id = segment[1 + 2 * i];
+				scan.comps[i] = -1;
+				for(int c = 0; c < image.ncomp; ++c) {
+					if(image.comps[c].id == id) {
+						scan.comps[i] = c;
+					}
+				}
+				if(scan.comps[i] < 0) {
+					return false;
+				}
+				image.comps[scan.comps[i]].td = segment[2 + 2 * i] >> 4;
+				image.comps[scan.comps[i]].ta = segment[2 + 2 * i] & 15;
+			}
+			const unsigned char *params = segment + 1 + 2 * scan.ncomp;
+			scan.ss = params[0];
+			scan.se = params[1];
+			scan.ah = params[2] >> 4;
+			scan.al = params[2] & 15;
+			if(!image.progressive) {
+				scan.ss = 0;
+				scan.se = 63;
+				scan.ah = 0;
+				scan.al = 0;
+			}
+			else if(scan.se > 63 || scan.ss > scan.se || (scan.ss == 0) != (scan.se == 0) || (scan.ss > 0 && scan.ncomp != 1) || scan.al > 13) {
+				return false;
+			}
+
+			// The scan can only use tables defined before it, the DC table for the first pass of
+			// the DC coefficients and the AC table for the AC coefficients
+			for(int i = 0; i < scan.ncomp; ++i) {
+				const jpeg_component &comp = image.comps[scan.comps[i]];
+				bool needs_dc = scan.ss == 0 && scan.ah == 0, needs_ac = scan.se > 0;
+				if(comp.td > 3 || comp.ta > 3 || !image.quant_defined[comp.tq] ||
+					(needs_dc && !image.dc_defined[comp.td]) || (needs_ac && !image.ac_defined[comp.ta])) {
+					return false;
+				}
+			}
+
+			// The entropy coded data ends at the first marker that isn't a restart marker,
+			// the restart markers split it in segments that can be decoded independently
+			segments.assign(1, p);
+			const unsigned char *q = p;
+			while(q + 1 < end) {
+				if(q[0] == 0xFF && q[1] != 0) {
+					if(q[1] >= 0xD0 && q[1] <= 0xD7) {
+						q += 2;
+						segments.push_back(q);
+						continue;
+					}
+					if(q[1] != 0xFF) {
+						break;
+					}
+				}
+				q++;
+			}
+			p = q;
+			return true;
+		}
+	}
+	scan.ncomp = 0;
+	return true;
+}
+
+// Build the lookup tables of a Huffman table from its DHT definition, which must end before end
+// returns the number of symbols, or -1 for a malformed table
+int jpeg_build_huffman(jpeg_huffman &table, const unsigned char *counts, const unsigned char *end) {
+	if(end - counts < 16) {
+		return -1;
+	}
+	const unsigned char *symbols = counts + 16;
+	int total = 0;
+	for(int i = 0; i < 16; ++i) {
+		total += counts[i];
+	}
+	if(total > 256 || end - symbols < total) {
+		return -1;
+	}
+	memcpy(table.values, symbols, total);
+	memset(table.fast_length, 0, sizeof(table.fast_length));
+
+	// Canonical codes, increasing with the code length
+	int code = 0, k = 0;
+	for(int length = 1; length <= 16; ++length) {
+		table.valptr[length] = k;
+		table.mincode[length] = code;
+		// More codes than this length can hold would overflow the lookup table
+		if(code + counts[length - 1] > (1 << length)) {
+			return -1;
+		}
+		for(int i = 0; i < counts[length - 1]; ++i, ++k, ++code) {
+			if(length <= jpeg_fast_bits) {
+				// Every lookup index starting with this code decodes to it
+				int shift = jpeg_fast_bits - length;
+				for(int j = 0; j < (1 << shift); ++j) {
+					table.fast_length[(code << shift) | j] = (unsigned char)length;
+					table.fast_value[(code << shift) | j] = symbols[k];
+				}
+			}
+		}
+		table.maxcode[length] = counts[length - 1] ? code - 1 : -1;
+		code <<= 1;
+	}
+	return total;
+}
+
+// Start reading an entropy coded segment
+void jpeg_bits_init(jpeg_bit_reader &reader, const unsigned char *data, const unsigned char *end) {
+	reader.data = data;
+	reader.end = end;
+	reader.bits = 0;
+	reader.count = 0;
+}
+
+// Make sure at least 57 bits are available, past the end of the segment we get zeros
+void jpeg_bits_fill(jpeg_bit_reader &reader) {
+	while(reader.count <= 56) {
+		unsigned int byte = 0;
+		if(reader.data < reader.end) {
+			byte = *reader.data++;
+			// A 0xFF data byte is followed by a stuffed 0x00
+			if(byte == 0xFF && reader.data < reader.end && *reader.data == 0) {
+				reader.data++;
+			}
+		}
+		reader.bits |= (unsigned long long)byte << (56 - reader.count);
+		reader.count += 8;
+	}
+}
+
+// Read n bits, n <= 16
+int jpeg_get_bits(jpeg_bit_reader &reader, int n) {
+	if(n == 0) {
+		return 0;
+	}
+	if(reader.count < n) {
+		jpeg_bits_fill(reader);
+	}
+	int value = (int)(reader.bits >> (64 - n));
+	reader.bits <<= n;
+	reader.count -= n;
+	return value;
+}
+
+// Decode one Huffman coded symbol
+int jpeg_decode_symbol(jpeg_bit_reader &reader, const jpeg_huffman &table) {
+	if(reader.count < 16) {
+		jpeg_bits_fill(reader);
+	}
+	int index = (int)(reader.bits >> (64 - jpeg_fast_bits));
+	int length = table.fast_length[index];
+	if(length) {
+		reader.bits <<= length;
+		reader.count -= length;
+		return table.fast_value[index];
+	}
+
+	// Codes longer than the lookup table
+	for(length = jpeg_fast_bits + 1; length <= 16; ++length) {
+		int code = (int)(reader.bits >> (64 - length));
+		if(code <= table.maxcode[length]) {
+			reader.bits <<= length;
+			reader.count -= length;
+			return table.values[table.valptr[length] + code - table.mincode[length]];
+		}
+	}
+	// Corrupt data, skip a bit and hope for the best
+	reader.bits <<= 1;
+	reader.count -= 1;
+	return 0;
+}
+
+// Sign extension of a JPEG coefficient of s bits
+int jpeg_extend(int value, int s) {
+	return value < (1 << (s - 1)) ? value - (1 << s) + 1 : value;
+}
+
+// Decode the data of one block for the given scan
+void jpeg_decode_block(jpeg_bit_reader &reader, const jpeg_image &image, const jpeg_scan &scan, const jpeg_component &comp,
+	short *coefs, int &dc_pred, int &eobrun) {
+	const jpeg_huffman &dc = image.dc[comp.td];
+	const jpeg_huffman &ac = image.ac[comp.ta];
+
+	if(!image.progressive) {
+		// Baseline block: the DC difference followed by run lengths of AC coefficients
+		int s = jpeg_decode_symbol(reader, dc);
+		dc_pred += s ? jpeg_extend(jpeg_get_bits(reader, s), s) : 0;
+		coefs[0] = (short)dc_pred;
+		for(int k = 1; k < 64; ) {
+			int rs = jpeg_decode_symbol(reader, ac);
+			int r = rs >> 4;
+			s = rs & 15;
+			if(s == 0) {
+				if(r != 15) {
+					break;
+				}
+				k += 16;
+				continue;
+			}
+			k += r;
+			if(k > 63) {
+				break;
+			}
+			coefs[jpeg_zigzag[k++]] = (short)jpeg_extend(jpeg_get_bits(reader, s), s);
+		}
+		return;
+	}
+
+	if(scan.ss == 0) {
+		// Progressive DC scan, first pass or refinement of one bit
+		if(scan.ah == 0) {
+			int s = jpeg_decode_symbol(reader, dc);
+			dc_pred += s ? jpeg_extend(jpeg_get_bits(reader, s), s) : 0;
+			coefs[0] = (short)(dc_pred * (1 << scan.al));
+		}
+		else if(jpeg_get_bits(reader, 1)) {
+			coefs[0] |= (short)(1 << scan.al);
+		}
+		return;
+	}
+
+	if(scan.ah == 0) {
+		// Progressive AC scan, first pass
+		if(eobrun > 0) {
+			eobrun--;
+			return;
+		}
+		for(int k = scan.ss; k <= scan.se; ) {
+			int rs = jpeg_decode_symbol(reader, ac);
+			int r = rs >> 4, s = rs & 15;
+			if(s == 0) {
+				if(r < 15) {
+					eobrun = (1 << r) - 1;
+					if(r) {
+						eobrun += jpeg_get_bits(reader, r);
+					}
+					break;
+				}
+				k += 16;
+				continue;
+			}
+			k += r;
+			if(k > 63) {
+				break;
+			}
+			coefs[jpeg_zigzag[k++]] = (short)(jpeg_extend(jpeg_get_bits(reader, s), s) * (1 << scan.al));
+		}
+		return;
+	}
+
+	// Progressive AC scan, refinement: one more bit for the known coefficients
+	// and the coefficients that become non zero at this bit
+	int bit = 1 << scan.al;
+	int k = scan.ss;
+	if(eobrun <= 0) {
+		while(k <= scan.se) {
+			int rs = jpeg_decode_symbol(reader, ac);
+			int r = rs >> 4, s = rs & 15;
+			if(s == 0) {
+				if(r < 15) {
+					eobrun = 1 << r;
+					if(r) {
+						eobrun += jpeg_get_bits(reader, r);
+					}
+					break;
+				}
+			}
+			else {
+				s = jpeg_get_bits(reader, 1) ? bit : -bit;
+			}
+
+			// Skip r zero coefficients, refining the non zero ones on the way
+			while(k <= scan.se) {
+				short *coef = &coefs[jpeg_zigzag[k++]];
+				if(*coef != 0) {
+					if(jpeg_get_bits(reader, 1) && (*coef & bit) == 0) {
+						*coef += (short)(*coef > 0 ? bit : -bit);
+					}
+				}
+				else {
+					if(r == 0) {
+						*coef = (short)s;
+						break;
+					}
+					r--;
+				}
+			}
+		}
+	}
+	if(eobrun > 0) {
+		// Inside an end of band run, only the refinement bits of the rest of the band
+		for(; k <= scan.se; ++k) {
+			short *coef = &coefs[jpeg_zigzag[k]];
+			if(*coef != 0 && jpeg_get_bits(reader, 1) && (*coef & bit) == 0) {
+				*coef += (short)(*coef > 0 ? bit : -bit);
+			}
+		}
+		eobrun--;
+	}
+}
+
+// Decode the MCUs of a range of restart segments
+void jpeg_decode_segments(jpeg_image &image, const jpeg_scan &scan, const std::vector<const unsigned char *> &segments,
+	const unsigned char *scan_end, size_t first, size_t last) {
+	int units_x, units_y;
+	jpeg_scan_units(image, scan, units_x, units_y);
+	long long total = (long long)units_x * units_y;
+	long long interval = image.restart_interval ? image.restart_interval : total;
+	jpeg_scan_state state;
+	jpeg_decode_units(image, scan, segments, scan_end, state, (long long)first * interval, std::min(total, (long long)last * interval));
+}
+
+// Number of MCUs of a scan across and down
+// A scan of one component has one block per MCU, and covers only the blocks inside the image
+void jpeg_scan_units(const jpeg_image &image, const jpeg_scan &scan, int &units_x, int &units_y) {
+	units_x = image.mcus_x;
+	units_y = image.mcus_y;
+	if(scan.ncomp == 1) {
+		const jpeg_component &comp = image.comps[scan.comps[0]];
+		units_x = ((image.width * comp.h + image.hmax - 1) / image.hmax + 7) / 8;
+		units_y = ((image.height * comp.v + image.vmax - 1) / image.vmax + 7) / 8;
+	}
+}
+
+// Decode the MCUs [first, last) of a scan into the coefficients, the state carries over between calls
+// The coefficients hold the blocks from the MCU row coefs_first_mcu_row of the image on
+void jpeg_decode_units(jpeg_image &image, const jpeg_scan &scan, const std::vector<const unsigned char *> &segments,
+	const unsigned char *scan_end, jpeg_scan_state &state, long long first, long long last) {
+	int units_x, units_y;
+	jpeg_scan_units(image, scan, units_x, units_y);
+	long long interval = image.restart_interval ? image.restart_interval : (long long)units_x * units_y;
+
+	// With one component, an MCU row of the image is as many rows of blocks as the component has
+	int first_unit_row = image.coefs_first_mcu_row * (scan.ncomp == 1 ? image.comps[scan.comps[0]].v : 1);
+	for(long long unit = first; unit < last; ++unit) {
+		// Each restart segment starts with its own bits and predictors
+		size_t segment = (size_t)(unit / interval);
+		if(segment != state.segment) {
+			if(segment >= segments.size()) {
+				return;
+			}
+			const unsigned char *segment_end = segment + 1 < segments.size() ? segments[segment + 1] - 2 : scan_end;
+			jpeg_bits_init(state.reader, segments[segment], segment_end);
+			memset(state.dc_pred, 0, sizeof(state.dc_pred));
+			state.eobrun = 0;
+			state.segment = segment;
+		}
+
+		int ux = (int)(unit % units_x), uy = (int)(unit / units_x) - first_unit_row;
+		for(int i = 0; i < scan.ncomp; ++i) {
+			jpeg_component &comp = image.comps[scan.comps[i]];
+			int bw = scan.ncomp == 1 ? 1 : comp.h;
+			int bh = scan.ncomp == 1 ? 1 : comp.v;
+			for(int by = 0; by < bh; ++by) {
+				for(int bx = 0; bx < bw; ++bx) {
+					size_t block = (size_t)(uy * bh + by) * comp.blocks_w + ux * bw + bx;
+					jpeg_decode_block(state.reader, image, scan, comp, &comp.coefs[block * 64], state.dc_pred[i], state.eobrun);
+				}
+			}
+		}
+	}
+}
+
+// Decode a scan, its restart segments are split between the threads
+bool jpeg_decode_scan(jpeg_image &image, const jpeg_scan &scan, const std::vector<const unsigned char *> &segments,
+	const unsigned char *scan_end, int threads) {
+	// Without restart markers, the whole scan is one segment decoded on this thread
+	if(image.restart_interval == 0 || segments.size() == 1) {
+		jpeg_decode_segments(image, scan, segments, scan_end, 0, 1);
+		return true;
+	}
+
+	int workers_count = (int)std::min<size_t>(threads, segments.size());
+	std::vector<std::thread> workers;
+	for(int w = 0; w < workers_count; ++w) {
+		size_t first = segments.size() * w / workers_count;
+		size_t last = segments.size() * (w + 1) / workers_count;
+		workers.push_back(std::thread(jpeg_decode_segments, std::ref(image), std::cref(scan), std::cref(segments), scan_end, first, last));
+	}
+	for(size_t i = 0; i < workers.size(); ++i) {
+		workers[i].join();
+	}
+	return true;
+}
+
+// cos((2x + 1) u pi / 16) scaled by C(u) / 2, the basis of the inverse DCT
+jpeg_idct_table::jpeg_idct_table() {
+	for(int x = 0; x < 8; ++x) {
+		for(int u = 0; u < 8; ++u) {
+			cosines[x][u] = (float)((u == 0 ? 0.5 / sqrt(2.0) : 0.5) * cos((2 * x + 1) * u * 3.14159265358979323846 / 16));
+		}
+	}
+}
+
+// Inverse DCT of a block, dequantized on the fly, the result is stored as pixels with the given stride
+void jpeg_idct_block(const short *coefs, const unsigned short *quant, unsigned char *out, int stride) {
+	// Built once, on first use, the initialization of a static is thread safe
+	static const jpeg_idct_table idct;
+	const float (*table)[8] = idct.cosines;
+
+	// Separable transform, first the columns then the rows
+	float tmp[64];
+	for(int u = 0; u < 8; ++u) {
+		float column[8];
+		bool ac_zero = true;
+		for(int v = 0; v < 8; ++v) {
+			column[v] = (float)coefs[v * 8 + u] * quant[v * 8 + u];
+			if(v > 0 && coefs[v * 8 + u] != 0) {
+				ac_zero = false;
+			}
+		}
+		// Most columns of a typical block only have their DC term
+		if(ac_zero) {
+			for(int y = 0; y < 8; ++y) {
+				tmp[y * 8 + u] = table[0][0] * column[0];
+			}
+			continue;
+		}
+		for(int y = 0; y < 8; ++y) {
+			float sum = 0;
+			for(int v = 0; v < 8; ++v) {
+				sum += table[y][v] * column[v];
+			}
+			tmp[y * 8 + u] = sum;
+		}
+	}
+	for(int y = 0; y < 8; ++y) {
+		for(int x = 0; x < 8; ++x) {
+			float sum = 128.5f;
+			for(int u = 0; u < 8; ++u) {
+				sum += table[x][u] * tmp[y * 8 + u];
+			}
+			out[y * stride + x] = (unsigned char)(sum < 0 ? 0 : (sum > 255 ? 255 : sum));
+		}
+	}
+}
+
+// Inverse DCT and color conversion of a band of MCU rows, the image row y is written at row0 + y * pitch
+// as 3 bytes pixels in the FreeImage order or as 4 bytes pixels in the given layout
+// The coefficients and the planes of the components start at the MCU rows coefs_first_mcu_row
+// and pixels_first_mcu_row of the image
+void jpeg_output_rows(jpeg_image &image, int first_mcu_row, int last_mcu_row, BYTE *row0, ptrdiff_t pitch,
+	unsigned int bytes, GLenum layout) {
+	for(int c = 0; c < image.ncomp; ++c) {
+		jpeg_component &comp = image.comps[c];
+		int stride = comp.blocks_w * 8;
+		int first_block_row = image.pixels_first_mcu_row * comp.v;
+		int first_coef_row = image.coefs_first_mcu_row * comp.v;
+		for(int by = first_mcu_row * comp.v; by < last_mcu_row * comp.v; ++by) {
+			for(int bx = 0; bx < comp.blocks_w; ++bx) {
+				size_t block = (size_t)(by - first_coef_row) * comp.blocks_w + bx;
+				jpeg_idct_block(&comp.coefs[block * 64], image.quant[comp.tq],
+					&comp.pixels[(size_t)(by - first_block_row) * 8 * stride + bx * 8], stride);
+			}
+		}
+	}
+
+	// Offsets of the channels in a pixel
+	int red = FI_RGBA_RED, green = FI_RGBA_GREEN, blue = FI_RGBA_BLUE;
+	if(bytes == 4) {
+		red = layout == GL_RGBA ? 0 : 2;
+		blue = 2 - red;
+		green = 1;
+	}
+
+	// Chroma planes with a lower resolution are upsampled by replicating their pixels
+	int first_row = first_mcu_row * image.vmax * 8;
+	int last_row = std::min(last_mcu_row * image.vmax * 8, image.height);
+	int plane_first_row = image.pixels_first_mcu_row * image.vmax * 8;
+	for(int y = first_row; y < last_row; ++y) {
+		BYTE *row = row0 + (ptrdiff_t)y * pitch;
+		int plane_y = y - plane_first_row;
+		if(bytes == 4) {
+			for(int x = 0; x < image.width; ++x) {
+				row[4 * x + 3] = 255;
+			}
+		}
+		if(image.ncomp == 1) {
+			const jpeg_component &gray = image.comps[0];
+			const unsigned char *src = &gray.pixels[(size_t)plane_y * gray.blocks_w * 8];
+			for(int x = 0; x < image.width; ++x) {
+				row[bytes * x + red] = row[bytes * x + green] = row[bytes * x + blue] = src[x];
+			}
+			continue;
+		}
+
+		const unsigned char *planes[3];
+		int hs[3];
+		for(int c = 0; c < 3; ++c) {
+			const jpeg_component &comp = image.comps[c];
+			planes[c] = &comp.pixels[(size_t)(plane_y * comp.v / image.vmax) * comp.blocks_w * 8];
+			hs[c] = comp.h;
+		}
+		for(int x = 0; x < image.width; ++x) {
+			float luma = planes[0][x * hs[0] / image.hmax];
+			float cb = planes[1][x * hs[1] / image.hmax] - 128.0f;
+			float cr = planes[2][x * hs[2] / image.hmax] - 128.0f;
+			float r = luma + 1.402f * cr;
+			float g = luma - 0.344136f * cb - 0.714136f * cr;
+			float b = luma + 1.772f * cb;
+			row[bytes * x + red] = (BYTE)(r < 0 ? 0 : (r > 255 ? 255 : r + 0.5f));
+			row[bytes * x + green] = (BYTE)(g < 0 ? 0 : (g > 255 ? 255 : g + 0.5f));
+			row[bytes * x + blue] = (BYTE)(b < 0 ? 0 : (b > 255 ? 255 : b + 0.5f));
+		}
+	}
+}
+
+// Decode a JPEG file into the texture bound to GL_TEXTURE_2D, a band of rows at a time, straight into
+// the mapped slots of the pixel buffer ring, returns false for the files the decoder doesn't handle
+// or when a slot can't be mapped
+// A sequential file whose single scan holds all the components is entropy decoded one band at a time,
+// the coefficients and the planes of the components only hold the MCU rows of that band, so besides
+// the file itself the memory used doesn't depend on the image size. Progressive files, and sequential
+// ones with a scan per component, only give a complete block after their last scan, their coefficients
+// are decoded for the whole image first. The ring must exist, a busy slot is waited for
+bool jpeg_decode_streaming(const char *fname, int threads, GLenum layout) {
+	if(threads <= 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	std::vector<unsigned char> file;
+	jpeg_image image;
+	if(!jpeg_open(fname, file, image)) {
+		return false;
+	}
+	const unsigned char *scan_end = &file[2];
+	const unsigned char *end = &file[0] + file.size();
+	jpeg_scan scan;
+	std::vector<const unsigned char *> segments;
+	if(!jpeg_next_scan(scan_end, end, image, scan, segments) || scan.ncomp == 0) {
+		return false;
+	}
+	bool banded = !image.progressive && scan.ncomp == image.ncomp;
+	if(!banded && !jpeg_decode_all_scans(scan_end, end, image, scan, segments, threads)) {
+		return false;
+	}
+
+	// As many MCU rows per band as fit in a slot
+	size_t pitch = (size_t)image.width * 4;
+	int mcu_height = image.vmax * 8;
+	int band_mcu_rows = (int)std::min((size_t)image.mcus_y, (size_t)pixel_buffer_slot_size / (pitch * mcu_height));
+	if(band_mcu_rows == 0) {
+		return false;
+	}
+	for(int c = 0; c < image.ncomp; ++c) {
+		jpeg_component &comp = image.comps[c];
+		comp.pixels.resize((size_t)comp.blocks_w * 64 * comp.v * band_mcu_rows);
+		if(banded) {
+			comp.coefs.resize((size_t)comp.blocks_w * 64 * comp.v * band_mcu_rows);
+		}
+	}
+
+	// The entropy decoding of the banded scan goes on from one band to the next
+	jpeg_scan_state state;
+	int units_x = 0, units_y = 0, unit_rows = 1;
+	if(banded) {
+		jpeg_scan_units(image, scan, units_x, units_y);
+		if(scan.ncomp == 1) {
+			unit_rows = image.comps[scan.comps[0]].v;
+		}
+	}
+
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, image.width, image.height, 0, layout, GL_UNSIGNED_BYTE, NULL);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	for(int first = 0; first < image.mcus_y; first += band_mcu_rows) {
+		int last = std::min(first + band_mcu_rows, image.mcus_y);
+		int first_row = first * mcu_height;
+		int last_row = std::min(last * mcu_height, image.height);
+
+		// The restart segments are read in order, so the entropy decoding of a band stays on this thread
+		if(banded) {
+			for(int c = 0; c < image.ncomp; ++c) {
+				std::fill(image.comps[c].coefs.begin(), image.comps[c].coefs.end(), 0);
+			}
+			image.coefs_first_mcu_row = first;
+			jpeg_decode_units(image, scan, segments, scan_end, state, (long long)first * unit_rows * units_x,
+				(long long)std::min(last * unit_rows, units_y) * units_x);
+		}
+
+		pixel_buffer_slot &slot = pixel_buffer_ring[pixel_buffer_next];
+		if(slot.fence) {
+			while(glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull) == GL_TIMEOUT_EXPIRED) {
+			}
+			glDeleteSync(slot.fence);
+			slot.fence = 0;
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+		BYTE *dst = (BYTE *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)((last_row - first_row) * pitch),
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if(!dst) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			return false;
+		}
+
+		// OpenGL wants the bottom row first, the last image row of the band goes at the start of the slot
+		image.pixels_first_mcu_row = first;
+		BYTE *row0 = dst + (ptrdiff_t)(last_row - 1) * pitch;
+		int bands = std::min(threads, last - first);
+		std::vector<std::thread> workers;
+		for(int b = 0; b < bands; ++b) {
+			int band_first = first + (last - first) * b / bands;
+			int band_last = first + (last - first) * (b + 1) / bands;
+			workers.push_back(std::thread(jpeg_output_rows, std::ref(image), band_first, band_last, row0, -(ptrdiff_t)pitch, 4u, layout));
+		}
+		for(size_t i = 0; i < workers.size(); ++i) {
+			workers[i].join();
+		}
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, image.height - last_row, image.width, last_row - first_row, layout, GL_UNSIGNED_BYTE, 0);
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		pixel_buffer_next = (pixel_buffer_next + 1) % pixel_buffer_ring_size;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	return true;
+}
+
+// Peak resident memory of the process so far, in KB
+long peak_rss_kb() {
+	#ifdef _WIN32
+		return 0;
+	#else
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		return usage.ru_maxrss;
+	#endif
+}
+
+// Time the JPEG decoders on a large image and exit
+// Without a file, squirrel.jpg is upscaled to 8K and saved as a baseline JPEG first
+void benchmark_jpeg_decode(const char *fname) {
+	#ifdef FREEIMAGE_LIB
+		FreeImage_Initialise();
+	#endif
+
+	std::string path = fname ? fname : "squirrel_8k.jpg";
+	if(!fname) {
+		FIBITMAP *bitmap = FreeImage_Load(FIF_JPEG, "squirrel.jpg");
+		FIBITMAP *large = bitmap ? FreeImage_Rescale(bitmap, 7680, 4320, FILTER_BILINEAR) : NULL;
+		if(!large || !FreeImage_Save(FIF_JPEG, large, path.c_str(), JPEG_QUALITYSUPERB)) {
+			std::cerr << "Unable to create " << path << " I'm out!" << std::endl;
+			exit(-1);
+		}
+		FreeImage_Unload(large);
+		FreeImage_Unload(bitmap);
+	}
+
+	// FreeImage writes the file without restart markers, a scan is then a single segment
+	// and only the inverse DCT and the color conversion are split between the threads
+	{
+		jpeg_image image;
+		if(!jpeg_decode_coefficients(path.c_str(), 1, image)) {
+			std::cerr << path << " isn't a JPEG file our decoder handles. I'm out!" << std::endl;
+			exit(-1);
+		}
+		if(image.restart_interval) {
+			std::cout << path << ": restart interval of " << image.restart_interval << " MCUs" << std::endl;
+		}
+		else {
+			std::cout << path << ": no restart markers, the entropy decoding runs on one thread" << std::endl;
+		}
+	}
+
+	// Best of a few runs, the first one also warms up the file cache
+	const int runs = 3;
+	double best = 1e30;
+	for(int run = 0; run < runs; ++run) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		FIBITMAP *bitmap = FreeImage_Load(FIF_JPEG, path.c_str());
+		best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		if(!bitmap) {
+			std::cerr << "Unable to load " << path << " I'm out!" << std::endl;
+			exit(-1);
+		}
+		FreeImage_Unload(bitmap);
+	}
+	std::cout << "FreeImage_Load: " << best << " ms" << std::endl;
+
+	int max_threads = std::max(1u, std::thread::hardware_concurrency());
+	double single = 0;
+	for(int threads = 1; ; threads = std::min(threads * 2, max_threads)) {
+		best = 1e30;
+		for(int run = 0; run < runs; ++run) {
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			FIBITMAP *bitmap = jpeg_decode(path.c_str(), threads);
+			best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+			if(!bitmap) {
+				std::cerr << path << " isn't a JPEG file our decoder handles. I'm out!" << std::endl;
+				exit(-1);
+			}
+			FreeImage_Unload(bitmap);
+		}
+		if(threads == 1) {
+			single = best;
+		}
+		std::cout << "jpeg_decode, " << threads << " threads: " << best << " ms, speedup " << single / best << std::endl;
+		if(threads == max_threads) {
+			break;
+		}
+	}
+	exit(0);
+}
+
+// Start loading an image in the texture, without waiting for the decoding or the upload
+texture_upload *load_image_async(const char *fname, GLuint texture) {
+	// active only for static linking, FreeImage must be initialized before the worker uses it
+	#ifdef FREEIMAGE_LIB
+		FreeImage_Initialise();
+	#endif
+
+	texture_upload *upload = new texture_upload;
+	upload->texture = texture;
+	upload->fname = fname;
+	upload->decoded = false;
+	upload->loaded = false;
+	upload->compress = compress_textures;
+	upload->texels.mapping = NULL;
+	upload->next_row = 0;
+	upload->fence = 0;
+	upload->ready = false;
+
+	// Decode on a worker thread, the render thread checks the flag every frame
+	upload->decoder = std::thread([upload]() {
+		upload->loaded = acquire_texels(upload->fname.c_str(), upload->compress, upload->texels);
+		upload->decoded.store(true, std::memory_order_release);
+	});
+
+	texture_uploads.push_back(upload);
+	return upload;
+}
+
+// Create the pixel buffer ring
+void create_pixel_buffer_ring() {
+	for(int i = 0; i < pixel_buffer_ring_size; ++i) {
+		glGenBuffers(1, &pixel_buffer_ring[i].pbo);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer_ring[i].pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, pixel_buffer_slot_size, NULL, GL_STREAM_DRAW);
+		pixel_buffer_ring[i].fence = 0;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+// True if the GPU has passed the fence, never blocks
+bool fence_signaled(GLsync fence) {
+	GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	return result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED;
+}
+
+// Called once per frame, moves the pending uploads forward without ever waiting for the GPU
+void update_texture_uploads() {
+	for(size_t i = 0; i < texture_uploads.size(); ++i) {
+		texture_upload *upload = texture_uploads[i];
+		if(upload->ready || !upload->decoded.load(std::memory_order_acquire)) {
+			continue;
+		}
+
+		// The image was just decoded, allocate the texture storage
+		if(upload->decoder.joinable()) {
+			upload->decoder.join();
+			if(!upload->loaded) {
+				std::cerr << "Unable to load the image file " << upload->fname  << " I'm out!" << std::endl;
+				exit(-1);
+			}
+			const texture_texels &texels = upload->texels;
+
+			// A NULL pointer only allocates the storage if no pixel buffer is bound
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			glBindTexture(GL_TEXTURE_2D, upload->texture);
+			if(texels.format == 0) {
+				glCompressedTexImage2D(GL_TEXTURE_2D, 0, texels.internal_format, texels.width, texels.height, 0, (GLsizei)texels.size, NULL);
+			}
+			else {
+				glTexImage2D(GL_TEXTURE_2D, 0, texels.internal_format, texels.width, texels.height, 0, texels.format, GL_UNSIGNED_BYTE, NULL);
+			}
+
+			// The slices are tightly packed 4 bytes pixels, or rows of blocks
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		}
+
+		// All the rows are queued, waiting for the last fence
+		const texture_texels &texels = upload->texels;
+		if(upload->next_row == texels.height) {
+			continue;
+		}
+
+		// Copy the next rows in the free slots of the ring, a busy slot means the GPU is
+		// still reading it, in which case we simply try again on the next frame
+		// The texels are already as OpenGL takes them, compressed images are copied by rows of blocks
+		unsigned int slot_rows = (unsigned int)(pixel_buffer_slot_size / texels.row_pitch) * texels.row_height;
+		if(slot_rows == 0) {
+			std::cerr << "The image " << upload->fname << " has rows larger than a pixel buffer slot. I'm out!" << std::endl;
+			exit(-1);
+		}
+		glBindTexture(GL_TEXTURE_2D, upload->texture);
+		while(upload->next_row < texels.height) {
+			pixel_buffer_slot &slot = pixel_buffer_ring[pixel_buffer_next];
+			if(slot.fence) {
+				if(!fence_signaled(slot.fence)) {
+					break;
+				}
+				glDeleteSync(slot.fence);
+				slot.fence = 0;
+			}
+
+			unsigned int rows = std::min(slot_rows, texels.height - upload->next_row);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+			size_t size = (size_t)(rows + texels.row_height - 1) / texels.row_height * texels.row_pitch;
+			void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)size,
+				GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+
+			// The slot can't be mapped, the rows left are given to OpenGL straight from the texels, as load_image does
+			if(!dst) {
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				rows = texels.height - upload->next_row;
+				size = texels.size - (size_t)upload->next_row / texels.row_height * texels.row_pitch;
+				const unsigned char *src = texels.data + (size_t)upload->next_row / texels.row_height * texels.row_pitch;
+				if(texels.format == 0) {
+					glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, 0, upload->next_row, texels.width, rows, texels.internal_format,
+						(GLsizei)size, src);
+				}
+				else {
+					glTexSubImage2D(GL_TEXTURE_2D, 0, 0, upload->next_row, texels.width, rows, texels.format, GL_UNSIGNED_BYTE, src);
+				}
+				upload->next_row = texels.height;
+				upload->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+				release_texels(upload->texels);
+				break;
+			}
+			memcpy(dst, texels.data + (size_t)upload->next_row / texels.row_height * texels.row_pitch, size);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+			if(texels.format == 0) {
+				glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, 0, upload->next_row, texels.width, rows, texels.internal_format,
+					(GLsizei)size, 0);
+			}
+			else {
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, upload->next_row, texels.width, rows, texels.format, GL_UNSIGNED_BYTE, 0);
+			}
+			slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			upload->next_row += rows;
+			pixel_buffer_next = (pixel_buffer_next + 1) % pixel_buffer_ring_size;
+
+			// The last slice is queued, its fence tells when the texture is usable
+			if(upload->next_row == texels.height) {
+				upload->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+				release_texels(upload->texels);
+			}
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	// Uploads whose last slice was read by the GPU can be used
+	for(size_t i = 0; i < texture_uploads.size(); ++i) {
+		texture_upload *upload = texture_uploads[i];
+		if(!upload->ready && upload->fence && fence_signaled(upload->fence)) {
+			glDeleteSync(upload->fence);
+			upload->fence = 0;
+			upload->ready = true;
+			if(upload == scene_texture) {
+				std::cout << "Texture ready, longest frame while loading: " << longest_loading_frame * 1000.0 << " ms" << std::endl;
+			}
+		}
+	}
+}
+
+// Decode the pixels of an image, returns false on failure
+bool acquire_image(const char *fname, decoded_image &image) {
+	image.bitmap = decode_image(fname);
+	if(!image.bitmap) {
+		image.pixels = NULL;
+		return false;
+	}
+	image.width = FreeImage_GetWidth(image.bitmap);
+	image.height = FreeImage_GetHeight(image.bitmap);
+	image.pitch = FreeImage_GetPitch(image.bitmap);
+	image.pixel_size = FreeImage_GetBPP(image.bitmap);
+	image.pixels = FreeImage_GetBits(image.bitmap);
+	return true;
+}
+
+// Free the pixels obtained with acquire_image
+void release_image(decoded_image &image) {
+	if(image.bitmap) {
+		FreeImage_Unload(image.bitmap);
+	}
+	image.bitmap = NULL;
+	image.pixels = NULL;
+}
+
+// Get the texels of an image, S3TC blocks if compress is true, from the texture cache if possible, otherwise
+// the image is decoded, converted and stored in the cache for the next runs, returns false on failure
+bool acquire_texels(const char *fname, bool compress, texture_texels &texels) {
+	texels.mapping = NULL;
+	texels.mapping_size = 0;
+	texels.data = NULL;
+
+	#ifndef _WIN32
+		// The cache entry is valid for the same file size, modification time and content
+		unsigned long long source_size = 0, source_hash = 0;
+		long long source_mtime = 0;
+		bool use_cache = false;
+		int fd = open(fname, O_RDONLY);
+		if(fd >= 0) {
+			struct stat info;
+			if(fstat(fd, &info) == 0 && info.st_size > 0) {
+				source_size = (unsigned long long)info.st_size;
+				source_mtime = (long long)info.st_mtime;
+				void *source = mmap(NULL, (size_t)source_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if(source != MAP_FAILED) {
+					source_hash = fnv1a_hash((const unsigned char *)source, (size_t)source_size);
+					munmap(source, (size_t)source_size);
+					use_cache = true;
+				}
+			}
+			close(fd);
+		}
+
+		if(use_cache && open_cached_texels(fname, source_size, source_mtime, source_hash, compress, texels)) {
+			texture_cache_hits++;
+			return true;
+		}
+		texture_cache_misses++;
+	#endif
+
+	decoded_image image;
+	if(!acquire_image(fname, image)) {
+		return false;
+	}
+	bool converted = convert_texels(image, compress, texels);
+	release_image(image);
+	if(!converted) {
+		return false;
+	}
+
+	#ifndef _WIN32
+		if(use_cache) {
+			store_cached_texels(fname, source_size, source_mtime, source_hash, texels);
+		}
+	#endif
+	return true;
+}
+
+// Free the texels obtained with acquire_texels
+void release_texels(texture_texels &texels) {
+	#ifndef _WIN32
+		if(texels.mapping) {
+			munmap(texels.mapping, texels.mapping_size);
+		}
+	#endif
+	std::vector<unsigned char>().swap(texels.storage);
+	texels.mapping = NULL;
+	texels.data = NULL;
+}
+
+// Convert decoded pixels to texels, S3TC blocks if compress is true, returns false for the images that aren't RGB or RGBA
+// The pixels are compressed, or repacked to 4 bytes pixels in the upload layout
+bool convert_texels(const decoded_image &image, bool compress, texture_texels &texels) {
+	if(image.pixel_size != 24 && image.pixel_size != 32) {
+		std::cerr << "pixel size = " << image.pixel_size << " don't know how to process this case." << std::endl;
+		return false;
+	}
+	texels.width = image.width;
+	texels.height = image.height;
+
+	compressed_image compressed;
+	if(compress && compress_image(image, compressed, jpeg_decode_threads)) {
+		texels.storage.swap(compressed.blocks);
+		texels.internal_format = compressed.format;
+		texels.format = 0;
+		texels.row_pitch = (image.width + 3) / 4 * compressed.block_size;
+		texels.row_height = 4;
+	}
+	else {
+		texels.storage.resize((size_t)image.width * image.height * 4);
+		swizzle_rows(image.pixels, image.pitch, image.pixel_size / 8, &texels.storage[0], image.width * 4, image.width, image.height, upload_layout);
+		texels.internal_format = GL_RGBA8;
+		texels.format = upload_layout;
+		texels.row_pitch = image.width * 4;
+		texels.row_height = 1;
+	}
+	texels.data = &texels.storage[0];
+	texels.size = texels.storage.size();
+	return true;
+}
+
+// Size in bytes of a level of a texture with the given internal format, 0 for the formats we don't use
+// The 4 bytes pixels are tightly packed, the S3TC blocks cover 4x4 pixels, partial ones included
+size_t texture_level_size(GLenum internal_format, unsigned int width, unsigned int height) {
+	size_t blocks = (size_t)((width + 3) / 4) * ((height + 3) / 4);
+	if(internal_format == GL_RGBA8) {
+		return (size_t)width * height * 4;
+	}
+	if(internal_format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) {
+		return blocks * 8;
+	}
+	if(internal_format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) {
+		return blocks * 16;
+	}
+	return 0;
+}
+
+// Name of the cache file of an image
+std::string texture_cache_file(const char *fname) {
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.tex", fnv1a_hash((const unsigned char *)fname, strlen(fname)));
+	return std::string(texture_cache_dir) + "/" + name;
+}
+
+// Try to map the cached texels of an image, checking that the source file didn't change
+// and that they have the kind asked for, S3TC blocks or pixels in the upload layout
+// Another kind is a miss, the entry is then replaced by the new texels
+bool open_cached_texels(const char *fname, unsigned long long source_size, long long source_mtime,
+	unsigned long long source_hash, bool compress, texture_texels &texels) {
+	#ifdef _WIN32
+		return false;
+	#else
+		std::string cache_file = texture_cache_file(fname);
+		int fd = open(cache_file.c_str(), O_RDONLY);
+		if(fd < 0) {
+			return false;
+		}
+		struct stat info;
+		if(fstat(fd, &info) != 0 || (size_t)info.st_size < texture_cache_alignment) {
+			close(fd);
+			return false;
+		}
+		size_t size = (size_t)info.st_size;
+		void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(mapping == MAP_FAILED) {
+			return false;
+		}
+
+		const texture_cache_header *header = (const texture_cache_header *)mapping;
+		bool compressed = header->gl_internal_format != GL_RGBA8;
+		size_t level_size = texture_level_size(header->gl_internal_format, header->width, header->height);
+		if(memcmp(header->magic, "TEXCACHE", 8) != 0 || header->version != 2 || header->levels < 1 ||
+			header->source_size != source_size || header->source_mtime != source_mtime || header->source_hash != source_hash ||
+			compressed != compress || header->gl_format != (compressed ? 0 : upload_layout) ||
+			level_size == 0 || header->level_size[0] != level_size || header->level_offset[0] + level_size > size) {
+			munmap(mapping, size);
+			return false;
+		}
+
+		texels.mapping = mapping;
+		texels.mapping_size = size;
+		texels.data = (const unsigned char *)mapping + header->level_offset[0];
+		texels.size = level_size;
+		texels.width = header->width;
+		texels.height = header->height;
+		texels.internal_format = header->gl_internal_format;
+		texels.format = header->gl_format;
+		texels.row_pitch = compressed ? (unsigned int)(level_size / ((header->height + 3) / 4)) : header->width * 4;
+		texels.row_height = compressed ? 4 : 1;
+		return true;
+	#endif
+}
+
+// Store the texels of an image in the texture cache
+// The file is written under a temporary name then renamed, so a reader never sees half of it
+void store_cached_texels(const char *fname, unsigned long long source_size, long long source_mtime,
+	unsigned long long source_hash, const texture_texels &texels) {
+	#ifndef _WIN32
+		mkdir(texture_cache_dir, 0755);
+
+		std::vector<char> header_page(texture_cache_alignment, 0);
+		texture_cache_header *header = (texture_cache_header *)&header_page[0];
+		memcpy(header->magic, "TEXCACHE", 8);
+		header->version = 2;
+		header->width = texels.width;
+		header->height = texels.height;
+		header->gl_internal_format = texels.internal_format;
+		header->gl_format = texels.format;
+		header->levels = 1;
+		header->source_size = source_size;
+		header->source_mtime = source_mtime;
+		header->source_hash = source_hash;
+		header->level_offset[0] = texture_cache_alignment;
+		header->level_size[0] = texels.size;
+
+		std::string cache_file = texture_cache_file(fname);
+		std::string temp_file = cache_file + ".tmp";
+		std::ofstream out(temp_file.c_str(), std::ios::binary);
+		if(!out.is_open()) {
+			std::cerr << "Unable to write the texture cache file " << cache_file << std::endl;
+			return;
+		}
+		out.write(&header_page[0], header_page.size());
+		out.write((const char *)texels.data, (std::streamsize)texels.size);
+		out.close();
+		if(!out || rename(temp_file.c_str(), cache_file.c_str()) != 0) {
+			std::cerr << "Unable to write the texture cache file " << cache_file << std::endl;
+			remove(temp_file.c_str());
+		}
+	#endif
+}
+
+// 64 bits FNV-1a hash, used to key the texture cache
+unsigned long long fnv1a_hash(const unsigned char *data, size_t length, unsigned long long hash) {
+	for(size_t i = 0; i < length; ++i) {
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Decode an image, build its mip chain and write it to a baked texture, compressed unless --no-compress
+// is given and repacked to the --rgba or default layout otherwise, returns false on failure
+// The levels are built from the decoded pixels, so RGB images stay BC1 down to the last level
+bool bake_texture(const char *fname, const char *baked_file) {
+	#ifdef FREEIMAGE_LIB
+		FreeImage_Initialise();
+	#endif
+
+	decoded_image image;
+	if(!acquire_image(fname, image)) {
+		std::cerr << "Unable to load the image file " << fname << std::endl;
+		return false;
+	}
+	if(image.pixel_size != 24 && image.pixel_size != 32) {
+		std::cerr << "pixel size = " << image.pixel_size << " can't bake this image" << std::endl;
+		release_image(image);
+		return false;
+	}
+
+	std::vector<char> header_page(texture_cache_alignment, 0);
+	baked_texture_header *header = (baked_texture_header *)&header_page[0];
+	memcpy(header->magic, "TEXBAKED", 8);
+	header->version = 1;
+	header->endianness = baked_texture_endianness;
+	header->width = image.width;
+	header->height = image.height;
+	header->levels = 1;
+	while((std::max(image.width, image.height) >> header->levels) > 0 && header->levels < 16) {
+		header->levels++;
+	}
+
+	std::string temp_file = std::string(baked_file) + ".tmp";
+	std::ofstream out(temp_file.c_str(), std::ios::binary);
+	if(!out.is_open()) {
+		std::cerr << "Unable to write the baked texture " << baked_file << std::endl;
+		release_image(image);
+		return false;
+	}
+	out.write(&header_page[0], header_page.size());
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	unsigned long long offset = texture_cache_alignment;
+	decoded_image level = image;
+	std::vector<BYTE> level_pixels, next_pixels;
+	std::vector<BYTE> packed;
+	for(unsigned int i = 0; i < header->levels; ++i) {
+		const char *data;
+		compressed_image compressed;
+		if(compress_textures) {
+			if(!compress_image(level, compressed, jpeg_decode_threads)) {
+				std::cerr << "Unable to compress the level " << i << " of " << fname << std::endl;
+				out.close();
+				remove(temp_file.c_str());
+				release_image(image);
+				return false;
+			}
+			header->gl_internal_format = compressed.format;
+			header->gl_format = 0;
+			header->gl_type = 0;
+			header->level_size[i] = compressed.blocks.size();
+			data = (const char *)&compressed.blocks[0];
+		}
+		else {
+			packed.resize((size_t)level.width * level.height * 4);
+			swizzle_rows(level.pixels, level.pitch, level.pixel_size / 8, &packed[0], level.width * 4, level.width, level.height, upload_layout);
+			header->gl_internal_format = GL_RGBA8;
+			header->gl_format = upload_layout;
+			header->gl_type = GL_UNSIGNED_BYTE;
+			header->level_size[i] = packed.size();
+			data = (const char *)&packed[0];
+		}
+		header->level_offset[i] = offset;
+		out.write(data, (std::streamsize)header->level_size[i]);
+
+		// The next level starts on the next page boundary
+		offset += header->level_size[i];
+		unsigned long long padding = (texture_cache_alignment - offset % texture_cache_alignment) % texture_cache_alignment;
+		static const char zeros[texture_cache_alignment] = { 0 };
+		out.write(zeros, (std::streamsize)padding);
+		offset += padding;
+
+		if(i + 1 < header->levels) {
+			decoded_image next;
+			downsample_image(level, next_pixels, next);
+			level_pixels.swap(next_pixels);
+			level = next;
+			level.pixels = &level_pixels[0];
+		}
+	}
+	release_image(image);
+
+	out.seekp(0);
+	out.write(&header_page[0], sizeof(baked_texture_header));
+	out.close();
+	if(!out || rename(temp_file.c_str(), baked_file) != 0) {
+		std::cerr << "Unable to write the baked texture " << baked_file << std::endl;
+		remove(temp_file.c_str());
+		return false;
+	}
+	std::cout << "Baked " << fname << " to " << baked_file << ": " << header->width << "x" << header->height << ", " <<
+		header->levels << " levels, " << (compress_textures ? "compressed" : upload_layout == GL_RGBA ? "RGBA" : "BGRA") << ", " <<
+		offset / 1024 << " KB in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+
+	#ifdef FREEIMAGE_LIB
+		FreeImage_DeInitialise();
+	#endif
+	return true;
+}
+
+// Halve an image with a box filter in linear light, the alpha is averaged as it is
+// The pixels of the result are tightly packed, with the same size as the source pixels
+// An odd last row or column is folded into the previous pixel, so every source pixel counts
+void downsample_image(const decoded_image &src, std::vector<BYTE> &pixels, decoded_image &dst) {
+	// sRGB to linear for the 256 values, linear to sRGB with 4096 steps
+	static const struct srgb_tables {
+		float to_linear[256];
+		BYTE to_srgb[4097];
+		srgb_tables() {
+			for(int i = 0; i < 256; ++i) {
+				float c = i / 255.0f;
+				to_linear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+			}
+			for(int i = 0; i <= 4096; ++i) {
+				float c = i / 4096.0f;
+				c = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+				to_srgb[i] = (BYTE)(c * 255.0f + 0.5f);
+			}
+		}
+	} tables;
+
+	unsigned int bytes = src.pixel_size / 8;
+	dst.bitmap = NULL;
+	dst.width = std::max(1u, src.width / 2);
+	dst.height = std::max(1u, src.height / 2);
+	dst.pitch = dst.width * bytes;
+	dst.pixel_size = src.pixel_size;
+	pixels.resize((size_t)dst.pitch * dst.height);
+	dst.pixels = &pixels[0];
+
+	for(unsigned int y = 0; y < dst.height; ++y) {
+		unsigned int y0 = std::min(y * 2, src.height - 1);
+		unsigned int y1 = (y + 1 == dst.height) ? src.height - 1 : y * 2 + 1;
+		for(unsigned int x = 0; x < dst.width; ++x) {
+			unsigned int x0 = std::min(x * 2, src.width - 1);
+			unsigned int x1 = (x + 1 == dst.width) ? src.width - 1 : x * 2 + 1;
+			float sum[4] = { 0, 0, 0, 0 };
+			int count = 0;
+			for(unsigned int sy = y0; sy <= y1; ++sy) {
+				const BYTE *row = src.pixels + (size_t)sy * src.pitch;
+				for(unsigned int sx = x0; sx <= x1; ++sx) {
+					const BYTE *pixel = row + (size_t)sx * bytes;
+					for(unsigned int c = 0; c < 3; ++c) {
+						sum[c] += tables.to_linear[pixel[c]];
+					}
+					if(bytes == 4) {
+						sum[3] += pixel[3];
+					}
+					count++;
+				}
+			}
+			BYTE *out = &pixels[(size_t)y * dst.pitch + (size_t)x * bytes];
+			for(unsigned int c = 0; c < 3; ++c) {
+				out[c] = tables.to_srgb[(int)(sum[c] / count * 4096.0f + 0.5f)];
+			}
+			if(bytes == 4) {
+				out[3] = (BYTE)(sum[3] / count + 0.5f);
+			}
+		}
+	}
+}
+
+// Map a baked texture and give each level to OpenGL straight from the mapping, returns false on failure
+// The texture bound to GL_TEXTURE_2D gets all the levels and a trilinear filter
+bool load_baked_texture(const char *fname) {
+	#ifdef _WIN32
+		return false;
+	#else
+		int fd = open(fname, O_RDONLY);
+		if(fd < 0) {
+			return false;
+		}
+		struct stat info;
+		if(fstat(fd, &info) != 0 || (size_t)info.st_size < texture_cache_alignment) {
+			close(fd);
+			return false;
+		}
+		size_t size = (size_t)info.st_size;
+		void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(mapping == MAP_FAILED) {
+			return false;
+		}
+
+		// Only the formats written by the baker are accepted, each level must have the size its dimensions need
+		const baked_texture_header *header = (const baked_texture_header *)mapping;
+		bool compressed = header->gl_format == 0;
+		bool valid = memcmp(header->magic, "TEXBAKED", 8) == 0 && header->version == 1 &&
+			header->endianness == baked_texture_endianness && header->width > 0 && header->height > 0 &&
+			header->levels >= 1 && header->levels <= 16 && (std::max(header->width, header->height) >> (header->levels - 1)) > 0;
+		if(compressed) {
+			valid = valid && header->gl_type == 0 && (header->gl_internal_format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ||
+				header->gl_internal_format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT);
+		}
+		else {
+			valid = valid && header->gl_internal_format == GL_RGBA8 && header->gl_type == GL_UNSIGNED_BYTE &&
+				(header->gl_format == GL_BGRA || header->gl_format == GL_RGBA);
+		}
+		for(unsigned int i = 0; valid && i < header->levels; ++i) {
+			unsigned int w = std::max(1u, header->width >> i), h = std::max(1u, header->height >> i);
+			valid = header->level_size[i] == texture_level_size(header->gl_internal_format, w, h) &&
+				header->level_offset[i] <= size && header->level_size[i] <= size - header->level_offset[i];
+		}
+		if(!valid || (compressed && !GLEW_EXT_texture_compression_s3tc)) {
+			munmap(mapping, size);
+			return false;
+		}
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		for(unsigned int i = 0; i < header->levels; ++i) {
+			GLsizei w = std::max(1u, header->width >> i), h = std::max(1u, header->height >> i);
+			const GLvoid *data = (const BYTE *)mapping + header->level_offset[i];
+			if(compressed) {
+				glCompressedTexImage2D(GL_TEXTURE_2D, i, header->gl_internal_format, w, h, 0, (GLsizei)header->level_size[i], data);
+			}
+			else {
+				glTexImage2D(GL_TEXTURE_2D, i, header->gl_internal_format, w, h, 0, header->gl_format, header->gl_type, data);
+			}
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header->levels - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, header->levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		munmap(mapping, size);
+		return true;
+	#endif
+}
+
+// Compress the pixels of an image with the given number of threads, 0 uses all the cores
+// RGB images become BC1 blocks and RGBA images BC3 blocks, returns false for other images
+bool compress_image(const decoded_image &image, compressed_image &compressed, int threads) {
+	if(image.pixel_size == 24) {
+		compressed.format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		compressed.block_size = 8;
+	}
+	else if(image.pixel_size == 32) {
+		compressed.format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		compressed.block_size = 16;
+	}
+	else {
+		return false;
+	}
+	compressed.width = image.width;
+	compressed.height = image.height;
+	unsigned int blocks_x = (image.width + 3) / 4;
+	unsigned int blocks_y = (image.height + 3) / 4;
+	compressed.blocks.resize((size_t)blocks_x * blocks_y * compressed.block_size);
+
+	if(threads <= 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	unsigned int bands = std::min((unsigned int)threads, blocks_y);
+	std::vector<std::thread> workers;
+	for(unsigned int b = 0; b < bands; ++b) {
+		unsigned int first = blocks_y * b / bands;
+		unsigned int last = blocks_y * (b + 1) / bands;
+		workers.push_back(std::thread(compress_block_rows, std::cref(image), std::ref(compressed), first, last));
+	}
+	for(size_t i = 0; i < workers.size(); ++i) {
+		workers[i].join();
+	}
+	return true;
+}
+
+// Compress a band of block rows
+// The pixels of the blocks crossing the right or top edge are repeated from the last column or row
+void compress_block_rows(const decoded_image &image, compressed_image &compressed, unsigned int first, unsigned int last) {
+	unsigned int blocks_x = (image.width + 3) / 4;
+	unsigned int bytes = image.pixel_size / 8;
+	unsigned char pixels[64];
+	for(unsigned int by = first; by < last; ++by) {
+		unsigned char *out = &compressed.blocks[(size_t)by * blocks_x * compressed.block_size];
+		for(unsigned int bx = 0; bx < blocks_x; ++bx) {
+			// Gather the block as BGRA pixels
+			for(unsigned int y = 0; y < 4; ++y) {
+				const BYTE *row = image.pixels + (size_t)std::min(by * 4 + y, image.height - 1) * image.pitch;
+				for(unsigned int x = 0; x < 4; ++x) {
+					const BYTE *src = row + (size_t)std::min(bx * 4 + x, image.width - 1) * bytes;
+					unsigned char *dst = pixels + (y * 4 + x) * 4;
+					dst[0] = src[FI_RGBA_BLUE];
+					dst[1] = src[FI_RGBA_GREEN];
+					dst[2] = src[FI_RGBA_RED];
+					dst[3] = bytes == 4 ? src[FI_RGBA_ALPHA] : 255;
+				}
+			}
+			if(compressed.block_size == 16) {
+				encode_bc3_alpha_block(pixels, out);
+				out += 8;
+			}
+			encode_bc1_block(pixels, out);
+			out += 8;
+		}
+	}
+}
+
+// Convert a color to RGB 5:6:5, with rounding
+unsigned int bc_pack_565(const int *color) {
+	return (unsigned int)((color[2] * 31 + 127) / 255) << 11 | (unsigned int)((color[1] * 63 + 127) / 255) << 5 |
+		(unsigned int)((color[0] * 31 + 127) / 255);
+}
+
+// Expand a RGB 5:6:5 color to 8 bits per channel, in BGR order
+void bc_unpack_565(unsigned int packed, int *color) {
+	int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+	color[0] = (b << 3) | (b >> 2);
+	color[1] = (g << 2) | (g >> 4);
+	color[2] = (r << 3) | (r >> 2);
+}
+
+// Encode the colors of a 4x4 block of BGRA pixels as a BC1 block
+// The endpoints are the corners of the bounding box of the colors, inset a little and flipped
+// along the diagonal that follows the colors, the indices come from a projection on the endpoints axis
+void encode_bc1_block(const unsigned char *pixels, unsigned char *out) {
+	int lo[3], hi[3];
+	#ifdef __SSE2__
+		__m128i p0 = _mm_loadu_si128((const __m128i *)pixels);
+		__m128i p1 = _mm_loadu_si128((const __m128i *)(pixels + 16));
+		__m128i p2 = _mm_loadu_si128((const __m128i *)(pixels + 32));
+		__m128i p3 = _mm_loadu_si128((const __m128i *)(pixels + 48));
+		__m128i vmin = _mm_min_epu8(_mm_min_epu8(p0, p1), _mm_min_epu8(p2, p3));
+		__m128i vmax = _mm_max_epu8(_mm_max_epu8(p0, p1), _mm_max_epu8(p2, p3));
+		vmin = _mm_min_epu8(vmin, _mm_shuffle_epi32(vmin, _MM_SHUFFLE(1, 0, 3, 2)));
+		vmin = _mm_min_epu8(vmin, _mm_shuffle_epi32(vmin, _MM_SHUFFLE(2, 3, 0, 1)));
+		vmax = _mm_max_epu8(vmax, _mm_shuffle_epi32(vmax, _MM_SHUFFLE(1, 0, 3, 2)));
+		vmax = _mm_max_epu8(vmax, _mm_shuffle_epi32(vmax, _MM_SHUFFLE(2, 3, 0, 1)));
+		unsigned int packed_min = (unsigned int)_mm_cvtsi128_si32(vmin);
+		unsigned int packed_max = (unsigned int)_mm_cvtsi128_si32(vmax);
+		for(int c = 0; c < 3; ++c) {
+			lo[c] = (packed_min >> (8 * c)) & 255;
+			hi[c] = (packed_max >> (8 * c)) & 255;
+		}
+	#else
+		for(int c = 0; c < 3; ++c) {
+			lo[c] = 255;
+			hi[c] = 0;
+		}
+		for(int i = 0; i < 16; ++i) {
+			for(int c = 0; c < 3; ++c) {
+				lo[c] = std::min(lo[c], (int)pixels[i * 4 + c]);
+				hi[c] = std::max(hi[c], (int)pixels[i * 4 + c]);
+			}
+		}
+	#endif
+
+	// Pick the diagonal of the box: blue and red are flipped if they go against green
+	int mean[3], cov_bg = 0, cov_rg = 0;
+	for(int c = 0; c < 3; ++c) {
+		mean[c] = (lo[c] + hi[c]) / 2;
+	}
+	for(int i = 0; i < 16; ++i) {
+		int g = pixels[i * 4 + 1] - mean[1];
+		cov_bg += (pixels[i * 4] - mean[0]) * g;
+		cov_rg += (pixels[i * 4 + 2] - mean[2]) * g;
+	}
+	if(cov_bg < 0) {
+		std::swap(lo[0], hi[0]);
+	}
+	if(cov_rg < 0) {
+		std::swap(lo[2], hi[2]);
+	}
+
+	// Move the endpoints inward by 1/16 of the range, the extremes are then reached by the interpolated colors
+	for(int c = 0; c < 3; ++c) {
+		int inset = (hi[c] - lo[c]) / 16;
+		hi[c] -= inset;
+		lo[c] += inset;
+	}
+
+	// The 4 colors mode needs the first endpoint greater than the second
+	unsigned int c0 = bc_pack_565(hi), c1 = bc_pack_565(lo);
+	if(c0 < c1) {
+		std::swap(c0, c1);
+	}
+	out[0] = c0 & 255;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 255;
+	out[3] = c1 >> 8;
+	if(c0 == c1) {
+		out[4] = out[5] = out[6] = out[7] = 0;
+		return;
+	}
+
+	// Project the pixels on the axis going from the second endpoint to the first one
+	int e0[3], e1[3], dir[3];
+	bc_unpack_565(c0, e0);
+	bc_unpack_565(c1, e1);
+	for(int c = 0; c < 3; ++c) {
+		dir[c] = e0[c] - e1[c];
+	}
+	int start = e1[0] * dir[0] + e1[1] * dir[1] + e1[2] * dir[2];
+	int range = e0[0] * dir[0] + e0[1] * dir[1] + e0[2] * dir[2] - start;
+
+	// Position of each pixel on the axis, in steps of 1/3, rounded
+	int levels[16];
+	#ifdef __SSE2__
+		__m128i zero = _mm_setzero_si128();
+		__m128i axis = _mm_setr_epi16((short)dir[0], (short)dir[1], (short)dir[2], 0, (short)dir[0], (short)dir[1], (short)dir[2], 0);
+		__m128i vstart = _mm_set1_epi32(start);
+		__m128i r1 = _mm_set1_epi32(range), r3 = _mm_set1_epi32(range * 3), r5 = _mm_set1_epi32(range * 5);
+		__m128i rows[4] = {p0, p1, p2, p3};
+		for(int i = 0; i < 4; ++i) {
+			// Dot products of 2 pixels per register, then the 4 sums are gathered
+			__m128i lo_dot = _mm_madd_epi16(_mm_unpacklo_epi8(rows[i], zero), axis);
+			__m128i hi_dot = _mm_madd_epi16(_mm_unpackhi_epi8(rows[i], zero), axis);
+			lo_dot = _mm_add_epi32(lo_dot, _mm_srli_epi64(lo_dot, 32));
+			hi_dot = _mm_add_epi32(hi_dot, _mm_srli_epi64(hi_dot, 32));
+			__m128i dot = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lo_dot), _mm_castsi128_ps(hi_dot), _MM_SHUFFLE(2, 0, 2, 0)));
+
+			// 6 * (dot - start) compared to range, 3 * range and 5 * range, each true comparison adds -1
+			__m128i t = _mm_sub_epi32(dot, vstart);
+			t = _mm_add_epi32(_mm_slli_epi32(t, 2), _mm_slli_epi32(t, 1));
+			__m128i level = _mm_add_epi32(_mm_add_epi32(_mm_cmpgt_epi32(t, r1), _mm_cmpgt_epi32(t, r3)), _mm_cmpgt_epi32(t, r5));
+			_mm_storeu_si128((__m128i *)(levels + i * 4), _mm_sub_epi32(zero, level));
+		}
+	#else
+		for(int i = 0; i < 16; ++i) {
+			int t = 6 * (pixels[i * 4] * dir[0] + pixels[i * 4 + 1] * dir[1] + pixels[i * 4 + 2] * dir[2] - start);
+			levels[i] = (t > range) + (t > 3 * range) + (t > 5 * range);
+		}
+	#endif
+
+	// Level 0 is the second endpoint, 3 the first one, 1 and 2 the interpolated colors
+	static const unsigned int level_index[4] = {1, 3, 2, 0};
+	unsigned int indices = 0;
+	for(int i = 0; i < 16; ++i) {
+		indices |= level_index[levels[i]] << (2 * i);
+	}
+	out[4] = indices & 255;
+	out[5] = (indices >> 8) & 255;
+	out[6] = (indices >> 16) & 255;
+	out[7] = indices >> 24;
+}
+
+// Encode the alpha of a 4x4 block of BGRA pixels as the first half of a BC3 block
+// The endpoints are the extreme alphas, with the 8 alphas mode
+void encode_bc3_alpha_block(const unsigned char *pixels, unsigned char *out) {
+	int lo = 255, hi = 0;
+	for(int i = 0; i < 16; ++i) {
+		lo = std::min(lo, (int)pixels[i * 4 + 3]);
+		hi = std::max(hi, (int)pixels[i * 4 + 3]);
+	}
+	out[0] = (unsigned char)hi;
+	out[1] = (unsigned char)lo;
+	unsigned long long indices = 0;
+	if(hi > lo) {
+		// Level 0 is the second endpoint, 7 the first one, the others are interpolated
+		int range = hi - lo;
+		for(int i = 0; i < 16; ++i) {
+			int level = ((pixels[i * 4 + 3] - lo) * 14 + range) / (2 * range);
+			unsigned long long index = level == 7 ? 0 : level == 0 ? 1 : 8 - level;
+			indices |= index << (3 * i);
+		}
+	}
+	for(int i = 0; i < 6; ++i) {
+		out[2 + i] = (unsigned char)(indices >> (8 * i));
+	}
+}
+
+// Decode a BC1 or BC3 block to 4x4 BGRA pixels, used to measure the quality of the encoder
+void decode_bc_block(const unsigned char *block, GLenum format, unsigned char *pixels) {
+	int alphas[8];
+	unsigned long long alpha_indices = 0;
+	if(format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) {
+		alphas[0] = block[0];
+		alphas[1] = block[1];
+		for(int i = 2; i < 8; ++i) {
+			alphas[i] = alphas[0] > alphas[1] ? ((8 - i) * alphas[0] + (i - 1) * alphas[1]) / 7 :
+				i < 6 ? ((6 - i) * alphas[0] + (i - 1) * alphas[1]) / 5 : (i == 6 ? 0 : 255);
+		}
+		for(int i = 0; i < 6; ++i) {
+			alpha_indices |= (unsigned long long)block[2 + i] << (8 * i);
+		}
+		block += 8;
+	}
+
+	unsigned int c0 = block[0] | block[1] << 8, c1 = block[2] | block[3] << 8;
+	int colors[4][4];
+	bc_unpack_565(c0, colors[0]);
+	bc_unpack_565(c1, colors[1]);
+	bool four_colors = c0 > c1 || format != GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	for(int c = 0; c < 3; ++c) {
+		if(four_colors) {
+			colors[2][c] = (2 * colors[0][c] + colors[1][c]) / 3;
+			colors[3][c] = (colors[0][c] + 2 * colors[1][c]) / 3;
+		}
+		else {
+			colors[2][c] = (colors[0][c] + colors[1][c]) / 2;
+			colors[3][c] = 0;
+		}
+	}
+	unsigned int indices = block[4] | block[5] << 8 | block[6] << 16 | (unsigned int)block[7] << 24;
+	for(int i = 0; i < 16; ++i) {
+		const int *color = colors[(indices >> (2 * i)) & 3];
+		pixels[i * 4] = (unsigned char)color[0];
+		pixels[i * 4 + 1] = (unsigned char)color[1];
+		pixels[i * 4 + 2] = (unsigned char)color[2];
+		pixels[i * 4 + 3] = format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ? (unsigned char)alphas[(alpha_indices >> (3 * i)) & 7] : 255;
+	}
+}
+
+// Time the block encoder and measure its PSNR, then exit
+// The image is encoded as BC1, then with a gradient in its alpha channel as BC3
+void benchmark_compression(const char *fname) {
+	#ifdef FREEIMAGE_LIB
+		FreeImage_Initialise();
+	#endif
+
+	FIBITMAP *bitmap = decode_image(fname);
+	if(!bitmap || FreeImage_GetBPP(bitmap) != 24) {
+		std::cerr << "Unable to load the RGB image " << fname << " I'm out!" << std::endl;
+		exit(-1);
+	}
+	unsigned int width = FreeImage_GetWidth(bitmap);
+	unsigned int height = FreeImage_GetHeight(bitmap);
+	FIBITMAP *rgba = FreeImage_Allocate(width, height, 32);
+	for(unsigned int y = 0; y < height; ++y) {
+		const BYTE *src = FreeImage_GetScanLine(bitmap, y);
+		BYTE *dst = FreeImage_GetScanLine(rgba, y);
+		for(unsigned int x = 0; x < width; ++x) {
+			dst[x * 4 + FI_RGBA_BLUE] = src[x * 3 + FI_RGBA_BLUE];
+			dst[x * 4 + FI_RGBA_GREEN] = src[x * 3 + FI_RGBA_GREEN];
+			dst[x * 4 + FI_RGBA_RED] = src[x * 3 + FI_RGBA_RED];
+			dst[x * 4 + FI_RGBA_ALPHA] = (BYTE)(x * 255 / std::max(1u, width - 1));
+		}
+	}
+
+	FIBITMAP *sources[2] = {bitmap, rgba};
+	const char *names[2] = {"BC1", "BC3"};
+	for(int s = 0; s < 2; ++s) {
+		decoded_image image;
+		image.bitmap = sources[s];
+		image.width = width;
+		image.height = height;
+		image.pitch = FreeImage_GetPitch(sources[s]);
+		image.pixel_size = FreeImage_GetBPP(sources[s]);
+		image.pixels = FreeImage_GetBits(sources[s]);
+
+		// Best of a few runs, on one thread to measure the encoder itself
+		const int runs = 5;
+		double best = 1e30;
+		compressed_image compressed;
+		for(int run = 0; run < runs; ++run) {
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			compress_image(image, compressed, 1);
+			best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+		}
+
+		// Compare the decoded blocks with the source pixels
+		unsigned int bytes = image.pixel_size / 8;
+		double squared_error = 0;
+		unsigned int blocks_x = (width + 3) / 4;
+		unsigned char pixels[64];
+		for(unsigned int y = 0; y < height; y += 4) {
+			for(unsigned int x = 0; x < width; x += 4) {
+				decode_bc_block(&compressed.blocks[((size_t)(y / 4) * blocks_x + x / 4) * compressed.block_size], compressed.format, pixels);
+				for(unsigned int j = 0; j < 4 && y + j < height; ++j) {
+					const BYTE *row = image.pixels + (size_t)(y + j) * image.pitch;
+					for(unsigned int i = 0; i < 4 && x + i < width; ++i) {
+						const BYTE *src = row + (size_t)(x + i) * bytes;
+						const unsigned char *dst = pixels + (j * 4 + i) * 4;
+						for(unsigned int c = 0; c < bytes; ++c) {
+							double d = (double)src[c] - dst[c];
+							squared_error += d * d;
+						}
+					}
+				}
+			}
+		}
+		double mse = squared_error / ((double)width * height * bytes);
+		double psnr = mse > 0 ? 10.0 * log10(255.0 * 255.0 / mse) : 99.0;
+
+		double megabytes = (double)width * height * bytes / (1024.0 * 1024.0);
+		std::cout << names[s] << ": " << width << "x" << height << ", " << megabytes / best << " MB/s, PSNR " << psnr << " dB, " <<
+			(double)width * height * bytes / compressed.blocks.size() << ":1" << std::endl;
+	}
+
+	FreeImage_Unload(rgba);
+	FreeImage_Unload(bitmap);
+	exit(0);
+}
+
+// Repack rows of BGR or BGRA pixels to tightly packed BGRA or RGBA pixels, in one pass
+// The source rows can be padded, e.g. FreeImage's are 4 bytes aligned, the widest version compiled in is used
+void swizzle_rows(const BYTE *src, unsigned int src_pitch, unsigned int src_bytes, BYTE *dst, unsigned int dst_pitch,
+	unsigned int width, unsigned int rows, GLenum layout) {
+	#if defined(__AVX2__)
+		swizzle_row_function swizzle_row = swizzle_row_avx2;
+	#elif defined(__SSSE3__)
+		swizzle_row_function swizzle_row = swizzle_row_ssse3;
+	#else
+		swizzle_row_function swizzle_row = swizzle_row_scalar;
+	#endif
+	for(unsigned int y = 0; y < rows; ++y) {
+		swizzle_row(src + (size_t)y * src_pitch, src_bytes, dst + (size_t)y * dst_pitch, width, layout);
+	}
+}
+
+// Repack a row of pixels, one pixel at a time
+void swizzle_row_scalar(const BYTE *src, unsigned int src_bytes, BYTE *dst, unsigned int width, GLenum layout) {
+	if(src_bytes == 4 && layout == GL_BGRA) {
+		memcpy(dst, src, (size_t)width * 4);
+		return;
+	}
+	// Position of the blue and red bytes in the destination pixels
+	int blue = layout == GL_BGRA ? 0 : 2;
+	int red = 2 - blue;
+	for(unsigned int x = 0; x < width; ++x) {
+		const BYTE *p = src + (size_t)x * src_bytes;
+		BYTE *q = dst + (size_t)x * 4;
+		q[blue] = p[FI_RGBA_BLUE];
+		q[1] = p[FI_RGBA_GREEN];
+		q[red] = p[FI_RGBA_RED];
+		q[3] = src_bytes == 4 ? p[FI_RGBA_ALPHA] : 255;
+	}
+}
+
+#ifdef __SSSE3__
+// Repack a row of pixels, 4 pixels at a time with a byte shuffle
+// A BGR load reads 16 bytes for 12 used, the last pixels are left to the scalar version
+void swizzle_row_ssse3(const BYTE *src, unsigned int src_bytes, BYTE *dst, unsigned int width, GLenum layout) {
+	if(src_bytes == 4 && layout == GL_BGRA) {
+		memcpy(dst, src, (size_t)width * 4);
+		return;
+	}
+	// -1 gives a zero byte, filled by the alpha mask
+	__m128i shuffle, alpha;
+	if(src_bytes == 3) {
+		shuffle = layout == GL_BGRA ? _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1) :
+			_mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+		alpha = _mm_set1_epi32((int)0xFF000000);
+	}
+	else {
+		shuffle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+		alpha = _mm_setzero_si128();
+	}
+	unsigned int x = 0;
+	unsigned int last = src_bytes == 3 ? 6 : 4;
+	for(; x + last <= width; x += 4) {
+		__m128i pixels = _mm_loadu_si128((const __m128i *)(src + (size_t)x * src_bytes));
+		_mm_storeu_si128((__m128i *)(dst + (size_t)x * 4), _mm_or_si128(_mm_shuffle_epi8(pixels, shuffle), alpha));
+	}
+	swizzle_row_scalar(src + (size_t)x * src_bytes, src_bytes, dst + (size_t)x * 4, width - x, layout);
+}
+#endif
+
+#ifdef __AVX2__
+// Repack a row of pixels, 8 pixels at a time, the byte shuffle works on each 128 bits lane
+// so a BGR load puts 4 pixels in each lane
+void swizzle_row_avx2(const BYTE *src, unsigned int src_bytes, BYTE *dst, unsigned int width, GLenum layout) {
+	if(src_bytes == 4 && layout == GL_BGRA) {
+		memcpy(dst, src, (size_t)width * 4);
+		return;
+	}
+	__m256i shuffle, alpha;
+	if(src_bytes == 3) {
+		shuffle = layout == GL_BGRA ?
+			_mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1) :
+			_mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1, 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+		alpha = _mm256_set1_epi32((int)0xFF000000);
+	}
+	else {
+		shuffle = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+			2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+		alpha = _mm256_setzero_si256();
+	}
+	unsigned int x = 0;
+	unsigned int last = src_bytes == 3 ? 10 : 8;
+	for(; x + last <= width; x += 8) {
+		const BYTE *p = src + (size_t)x * src_bytes;
+		__m256i pixels = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)p)),
+			_mm_loadu_si128((const __m128i *)(p + 4 * src_bytes)), 1);
+		_mm256_storeu_si256((__m256i *)(dst + (size_t)x * 4), _mm256_or_si256(_mm256_shuffle_epi8(pixels, shuffle), alpha));
+	}
+	swizzle_row_scalar(src + (size_t)x * src_bytes, src_bytes, dst + (size_t)x * 4, width - x, layout);
+}
+#endif
+
+// Time the repacking of an image to both layouts with each version, then exit
+// The throughput counts the bytes read and written
+void benchmark_swizzle(const char *fname) {
+	#ifdef FREEIMAGE_LIB
+		FreeImage_Initialise();
+	#endif
+
+	FIBITMAP *bitmap = decode_image(fname);
+	if(!bitmap || FreeImage_GetBPP(bitmap) != 24) {
+		std::cerr << "Unable to load the RGB image " << fname << " I'm out!" << std::endl;
+		exit(-1);
+	}
+	unsigned int width = FreeImage_GetWidth(bitmap);
+	unsigned int height = FreeImage_GetHeight(bitmap);
+	unsigned int pitch = FreeImage_GetPitch(bitmap);
+	const BYTE *pixels = FreeImage_GetBits(bitmap);
+	std::vector<BYTE> packed((size_t)width * height * 4);
+	std::vector<BYTE> reference((size_t)width * height * 4);
+
+	std::vector<swizzle_row_function> versions;
+	std::vector<const char *> names;
+	versions.push_back(swizzle_row_scalar);
+	names.push_back("scalar");
+	#ifdef __SSSE3__
+		versions.push_back(swizzle_row_ssse3);
+		names.push_back("SSSE3");
+	#endif
+	#ifdef __AVX2__
+		versions.push_back(swizzle_row_avx2);
+		names.push_back("AVX2");
+	#endif
+
+	GLenum layouts[2] = {GL_BGRA, GL_RGBA};
+	const char *layout_names[2] = {"BGR to BGRA", "BGR to RGBA"};
+	for(int l = 0; l < 2; ++l) {
+		for(size_t v = 0; v < versions.size(); ++v) {
+			// Best of a few runs
+			const int runs = 20;
+			double best = 1e30;
+			for(int run = 0; run < runs; ++run) {
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				for(unsigned int y = 0; y < height; ++y) {
+					versions[v](pixels + (size_t)y * pitch, 3, &packed[(size_t)y * width * 4], width, layouts[l]);
+				}
+				best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+			}
+			if(v == 0) {
+				reference = packed;
+			}
+			double bytes = (double)width * height * (3 + 4);
+			std::cout << layout_names[l] << ", " << names[v] << ": " << bytes / best / 1e9 << " GB/s" <<
+				(packed == reference ? "" : " MISMATCH") << std::endl;
+		}
+	}
+
+	FreeImage_Unload(bitmap);
+	exit(0);
+}
@@ -5,9 +5,25 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <string>
+#include <map>
+#include <set>
+#include <list>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <sys/types.h>
+#include <sys/stat.h>
 //#include <ctime>
 #include <FreeImage.h>
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 // Read a shader source from a file
 // store the shader source in a std::vector<char>
 void read_shader_src(const char *fname, std::vector<char> &buffer);
@@ -18,6 +34,62 @@ GLuint load_and_compile_shader(const char *fname, GLenum shaderType);
 // Create a program from two shaders
 GLuint create_program(const char *path_vert_shader, const char *path_frag_shader);
 
+// Feature switches of the base shaders, combined in a bit mask to select a variant
+enum shader_feature {
+	FEATURE_GRAYSCALE = 1 << 0,
+	FEATURE_VERTEX_COLOR = 1 << 1,
+	FEATURE_POINT_SIZE = 1 << 2,
+	FEATURE_VIRTUAL_TEXTURE = 1 << 3,
+	FEATURE_VT_FEEDBACK = 1 << 4
+};
+
+// Names of the above features, defined in the shader sources of a variant
+const char *shader_feature_names[] = { "GRAYSCALE", "VERTEX_COLOR", "POINT_SIZE", "VIRTUAL_TEXTURE", "VT_FEEDBACK" };
+
+// Get the program for a set of features, only the variants actually used are compiled
+GLuint get_program_variant(unsigned int features);
+
+// Expand the #include directives of a shader and add the defines of the requested features
+std::string preprocess_shader(const char *fname, unsigned int features);
+
+// Recursively paste a shader file and the files it includes
+void expand_includes(const std::string &fname, std::string &out, std::set<std::string> &included);
+
+// Compile a shader from a source already loaded in memory
+GLuint compile_shader_src(const char *src, GLenum shaderType);
+
+// Base shaders of all the variants
+const char *vert_shader_path = "shaders/vert.shader";
+const char *frag_shader_path = "shaders/frag.shader";
+
+// Programs compiled so far, indexed by their features bit mask
+std::map<unsigned int, GLuint> program_variants;
+
+// Locations of the virtual texture uniforms of a variant, -1 for those it doesn't use
+struct vt_uniform_locations {
+	GLint view_rect;
+	GLint levels;
+	GLint virtual_size;
+	GLint image_scale;
+	GLint level_bias;
+};
+
+// Virtual texture uniforms of each variant, looked up once when the variant is linked
+std::map<GLuint, vt_uniform_locations> vt_program_uniforms;
+
+// Content of the shader files, each file is read once for all the variants
+std::map<std::string, std::string> shader_files;
+
+// Features used for the next frame, G toggles the grayscale conversion
+unsigned int current_features = FEATURE_GRAYSCALE;
+
+// Fixed attribute locations, shared by all the variants so the vertex array object works with any of them
+enum attribute_location {
+	POSITION_LOCATION = 0,
+	TEXTURE_COORD_LOCATION = 1,
+	COLOR_LOCATION = 2
+};
+
 // Called when the window is resized
 void GLFWCALL window_resized(int width, int height);
 
@@ -30,10 +102,258 @@ void display(GLuint &vao);
 // Initialize the data to be rendered
 void initialize(GLuint &vao);
 
+// An attribute of the vertices, its values are size floats per vertex, the offset is set by upload_vertices
+struct vertex_attribute {
+	const char *name;
+	GLint size;
+	const GLfloat *data;
+	size_t offset;
+};
+
+// Attributes of the vertices and how they are stored in the vertex buffer, either interleaved,
+// all the attributes of a vertex next to each other, or planar, all the values of an attribute together
+struct vertex_layout {
+	std::vector<vertex_attribute> attributes;
+	GLsizei vertex_count;
+	bool interleaved;
+	GLsizei stride;
+};
+
+// Add an attribute to a layout, its data must stay valid until the vertices are uploaded
+void add_vertex_attribute(vertex_layout &layout, const char *name, GLint size, const GLfloat *data);
+
+// Compute the stride and the offsets of the attributes, then fill the bound GL_ARRAY_BUFFER with the vertices
+void upload_vertices(vertex_layout &layout, GLsizei vertex_count, bool interleaved);
+
+// Point an attribute location to an attribute of the uploaded vertices and enable it
+void enable_vertex_attribute(const vertex_layout &layout, const char *name, GLint location);
+
+// Run with --planar to store all the positions then all the other attributes, instead of interleaved vertices
+bool interleaved_vertices = true;
+
 // Load an image from the disk with FreeImage
 void load_image(const char *fname);
 
-int main () {
+// Load an image from the disk with FreeImage, returns NULL if the image can't be read
+FIBITMAP *load_bitmap(const char *fname);
+
+// Size of the pages of a virtual texture, with a border repeated from the neighbour pages
+// for the bilinear filtering, the same values are used by the shaders
+const unsigned int vt_page_size = 128;
+const unsigned int vt_page_border = 4;
+const unsigned int vt_page_payload = vt_page_size - 2 * vt_page_border;
+
+// Largest number of pages on a side of the level 0, x and y have 12 bits in vt_page_key,
+// the feedback and the page table store them in 16 bits
+const int vt_max_pages_per_side = 4096;
+
+// Header of the page file of a virtual texture, followed by the BGRA pages of each level row by row,
+// from the level 0 to the single page of the last level
+// The level 0 is a power of two number of pages on each side, the image fills its bottom left corner
+// and only the pages overlapping the image are stored
+struct vt_file_header {
+	char magic[8];
+	unsigned int version;
+	unsigned int width;
+	unsigned int height;
+	unsigned int scale;
+	unsigned int levels;
+	unsigned int page_size;
+	unsigned int page_border;
+	unsigned long long source_size;
+	long long source_mtime;
+};
+
+// Offset of the first page in a page file
+const unsigned long long vt_header_size = 4096;
+
+// An image too large for a texture, paged in from the disk as needed
+struct virtual_texture {
+	std::ifstream pages;
+	unsigned int width;
+	unsigned int height;
+	int levels;
+	unsigned int virtual_size;
+	std::vector<unsigned long long> level_first_page;
+	std::vector<int> level_pages_x;
+	std::vector<int> level_pages_y;
+
+	// Physical pages, the slot 0 always holds the last level so every lookup finds something
+	GLuint cache_texture;
+	int cache_pages_per_side;
+	std::vector<unsigned int> slot_page;
+	std::list<int> lru;
+	std::vector<std::list<int>::iterator> lru_position;
+	std::map<unsigned int, int> resident;
+
+	// Page table, one RGBA16UI texel per page: slot x, slot y, level of the resident page, valid
+	GLuint page_table_texture;
+	std::vector<std::vector<GLushort> > page_table;
+
+	// Keys of the pages loaded or evicted since the last update of the page table
+	std::set<unsigned int> page_table_changes;
+
+	// Feedback pass, rendered at a lower resolution and read back asynchronously
+	GLuint feedback_framebuffer;
+	GLuint feedback_renderbuffer;
+	GLuint feedback_pbo;
+	GLsync feedback_fence;
+	int feedback_width;
+	int feedback_height;
+
+	int pages_loaded;
+	int pages_evicted;
+};
+
+// Bake an image, scaled up by an integer factor, to a page file, returns false on failure
+bool build_page_file(const char *fname, unsigned int scale, const std::string &page_file);
+
+// Open the page file of an image, baking it first if needed, and create the cache, page table and feedback pass
+void open_virtual_texture(virtual_texture &vt, const char *fname, unsigned int scale);
+
+// Number of pages overlapping the image on a side of a level
+int vt_level_pages(unsigned int size, int level);
+
+// Key of a page, used to find it in the cache
+unsigned int vt_page_key(int level, int x, int y);
+
+// Read a page from the disk to a slot of the cache, the least recently used page is evicted when the cache is full
+void vt_load_page(virtual_texture &vt, unsigned int key);
+
+// Mark a resident page as used
+void vt_touch_page(virtual_texture &vt, int slot);
+
+// Point each page of the page table to itself if resident, otherwise to its closest resident ancestor,
+// only the entries under the pages loaded or evicted since the last update are rewritten
+void vt_update_page_table(virtual_texture &vt);
+
+// Render the pages needed by the current view to the feedback framebuffer and start reading them back
+void vt_render_feedback(virtual_texture &vt, GLuint &vao);
+
+// Load the pages found by the last feedback pass, if it is available, never waits for the GPU
+void vt_process_feedback(virtual_texture &vt);
+
+// Set the uniforms of a virtual texture program, their locations come from get_program_variant
+void vt_set_uniforms(virtual_texture &vt, GLuint shaderProgram, float level_bias);
+
+// The virtual texture of the scene, used when started with --virtual, V switches between it and the texture
+virtual_texture scene_vt;
+bool virtual_texture_enabled = false;
+bool show_virtual_texture = false;
+
+// Visible part of the image, the arrows pan and Z / X zoom in and out
+float view_rect[4] = { 0.0f, 0.0f, 1.0f, 1.0f };
+
+// Size of the window, the feedback pass is a fraction of it
+int window_width = 800;
+int window_height = 600;
+const int vt_feedback_divisor = 8;
+
+// Pages read from the disk per frame at most, and pages kept in the cache
+const int vt_pages_per_frame = 8;
+const int vt_cache_pages_per_side = 16;
+
+// A run of triangle indices drawn with one call, its indices are stored relative to base_vertex
+struct index_chunk {
+	GLsizei first;
+	GLsizei count;
+	GLint base_vertex;
+};
+
+// Indices stored with the smallest type that holds them, GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+// A mesh with more vertices than 16 bits indices can address is split in chunks drawn with a base vertex
+struct index_buffer {
+	GLenum type;
+	GLsizei count;
+	std::vector<index_chunk> chunks;
+};
+
+// Fill the bound GL_ELEMENT_ARRAY_BUFFER with triangle indices, using the smallest index type
+void upload_indices(index_buffer &buffer, const GLuint *indices, GLsizei count);
+
+// Draw count indices from first, one call per chunk they cover
+void draw_indices(const index_buffer &buffer, GLsizei first, GLsizei count);
+
+// Size in bytes of an index type
+size_t index_type_size(GLenum type);
+
+// Indices of the scene
+index_buffer scene_indices;
+
+// Pixels of an image ready to be given to OpenGL, either decoded by FreeImage
+// or mapped from the texture cache, rows go from the bottom to the top
+struct decoded_image {
+	FIBITMAP *bitmap;
+	void *mapping;
+	size_t mapping_size;
+	const BYTE *pixels;
+	unsigned int width;
+	unsigned int height;
+	unsigned int pitch;
+	unsigned int pixel_size;
+};
+
+// Get the pixels of an image, from the texture cache if possible, otherwise the image
+// is decoded and stored in the cache for the next runs, returns false on failure
+bool acquire_image(const char *fname, decoded_image &image);
+
+// Free the pixels obtained with acquire_image
+void release_image(decoded_image &image);
+
+// Header of a texture cache file, the pixels of each level start on a page boundary
+// so they can be given to OpenGL straight from the mapped file
+struct texture_cache_header {
+	char magic[8];
+	unsigned int version;
+	unsigned int width;
+	unsigned int height;
+	unsigned int pitch;
+	unsigned int pixel_size;
+	unsigned int levels;
+	unsigned long long source_size;
+	long long source_mtime;
+	unsigned long long source_hash;
+	unsigned long long level_offset[16];
+	unsigned long long level_size[16];
+};
+
+// Folder of the texture cache and the alignment of the pixels in its files
+const char *texture_cache_dir = "texture_cache";
+const size_t texture_cache_alignment = 4096;
+
+// Try to map the cached pixels of an image, checking that the source file didn't change
+bool open_cached_image(const char *fname, unsigned long long source_size, long long source_mtime,
+	unsigned long long source_hash, decoded_image &image);
+
+// Store the decoded pixels of an image in the texture cache
+void store_cached_image(const char *fname, unsigned long long source_size, long long source_mtime,
+	unsigned long long source_hash, const decoded_image &image);
+
+// Name of the cache file of an image
+std::string texture_cache_file(const char *fname);
+
+// 64 bits FNV-1a hash, used to key the texture cache
+unsigned long long fnv1a_hash(const unsigned char *data, size_t length, unsigned long long hash = 14695981039346656037ULL);
+
+// Texture cache statistics, printed at exit
+int texture_cache_hits = 0;
+int texture_cache_misses = 0;
+
+int main (int argc, char **argv) {
+	// --virtual [scale] shows squirrel.jpg scaled up as a virtual texture, 8 times by default
+	unsigned int vt_scale = 0;
+	for(int i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "--virtual") == 0) {
+			vt_scale = 8;
+			if(i + 1 < argc && atoi(argv[i + 1]) > 0) {
+				vt_scale = atoi(argv[++i]);
+			}
+		}
+		else if(strcmp(argv[i], "--planar") == 0) {
+			interleaved_vertices = false;
+		}
+	}
+
 	// Initialize GLFW
 	if ( !glfwInit()) {
 		std::cerr << "Failed to initialize GLFW! I'm out!" << std::endl;
@@ -78,6 +398,11 @@ int main () {
 	// Initialize the data to be rendered
 	initialize(vao);
 
+	if(vt_scale > 0) {
+		open_virtual_texture(scene_vt, "squirrel.jpg", vt_scale);
+		virtual_texture_enabled = show_virtual_texture = true;
+	}
+
 	// Create a rendering loop
 	int running = GL_TRUE;
 
@@ -94,6 +419,12 @@ int main () {
 	// Terminate GLFW
 	glfwTerminate();
 
+	if(virtual_texture_enabled) {
+		std::cout << "Virtual texture: " << scene_vt.pages_loaded << " pages loaded, " << scene_vt.pages_evicted << " evicted" << std::endl;
+	}
+
+	std::cout << "Texture cache: " << texture_cache_hits << " hits, " << texture_cache_misses << " misses" << std::endl;
+
 	return 0;
 }
 
@@ -101,8 +432,22 @@ int main () {
 void display(GLuint &vao) {
 	glClear(GL_COLOR_BUFFER_BIT);
 
+	// Stream in the pages the previous frames asked for, then find the ones this view needs
+	if(show_virtual_texture) {
+		vt_process_feedback(scene_vt);
+		vt_render_feedback(scene_vt, vao);
+	}
+
+	// Switching to an already compiled variant is only a glUseProgram
+	unsigned int features = current_features | (show_virtual_texture ? FEATURE_VIRTUAL_TEXTURE : 0);
+	GLuint shaderProgram = get_program_variant(features);
+	glUseProgram(shaderProgram);
+	if(show_virtual_texture) {
+		vt_set_uniforms(scene_vt, shaderProgram, 0.0f);
+	}
+
 	glBindVertexArray(vao);
-	glDrawElements( GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	draw_indices(scene_indices, 0, scene_indices.count);
 
 	// Swap front and back buffers
 	glfwSwapBuffers();
@@ -137,15 +482,14 @@ void initialize(GLuint &vao) {
 	GLuint vbo;
 	glGenBuffers(1, &vbo);
 
-	// Allocate space for vertex positions and texture coordinates
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices_position) + sizeof(texture_coord), NULL, GL_STATIC_DRAW);
-
-	// Transfer the vertex positions:
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices_position), vertices_position);
+	// Describe the vertices, the stride and offsets of the attributes follow from the layout
+	vertex_layout layout;
+	add_vertex_attribute(layout, "position", 2, vertices_position);
+	add_vertex_attribute(layout, "texture_coord", 2, texture_coord);
 
-	// Transfer the texture coordinates:
-	glBufferSubData(GL_ARRAY_BUFFER, sizeof(vertices_position), sizeof(texture_coord), texture_coord);
+	// Transfer the vertex positions and texture coordinates
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	upload_vertices(layout, sizeof(vertices_position) / (2 * sizeof(GLfloat)), interleaved_vertices);
 
 	// Create an Element Array Buffer that will store the indices array:
 	GLuint eab;
@@ -153,7 +497,7 @@ void initialize(GLuint &vao) {
 
 	// Transfer the data from indices to eab
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eab);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	upload_indices(scene_indices, indices, sizeof(indices) / sizeof(GLuint));
 
 	// Create a texture
 	GLuint texture;
@@ -164,21 +508,17 @@ void initialize(GLuint &vao) {
 
 	load_image("squirrel.jpg");
 
-	GLuint shaderProgram = create_program("shaders/vert.shader", "shaders/frag.shader");
-
-	// Get the location of the attributes that enters in the vertex shader
-	GLint position_attribute = glGetAttribLocation(shaderProgram, "position");
+	get_program_variant(current_features);
 
-	// Specify how the data for position can be accessed
-	glVertexAttribPointer(position_attribute, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	// All the variants use the same locations for the attributes that enters in the vertex shader
+	GLint position_attribute = POSITION_LOCATION;
 
-	// Enable the attribute
-	glEnableVertexAttribArray(position_attribute);
+	// Specify how the data for position can be accessed, and enable the attribute
+	enable_vertex_attribute(layout, "position", position_attribute);
 
 	// Texture coord attribute
-	GLint texture_coord_attribute = glGetAttribLocation(shaderProgram, "texture_coord");
-	glVertexAttribPointer(texture_coord_attribute, 2, GL_FLOAT, GL_FALSE, 0, (GLvoid *)sizeof(vertices_position));
-	glEnableVertexAttribArray(texture_coord_attribute);
+	GLint texture_coord_attribute = TEXTURE_COORD_LOCATION;
+	enable_vertex_attribute(layout, "texture_coord", texture_coord_attribute);
 
 }
 
@@ -189,31 +529,16 @@ void load_image(const char *fname) {
 		FreeImage_Initialise();
 	#endif
 
-	FIBITMAP *bitmap;
-	// Get the format of the image file
-	FREE_IMAGE_FORMAT fif =FreeImage_GetFileType(fname, 0);
-
-	// If the format can't be determined, try to guess the format from the file name
-	if(fif == FIF_UNKNOWN) {
-		fif = FreeImage_GetFIFFromFilename(fname);
-	}
-
-	// Load the data in bitmap if possible
-	if(fif != FIF_UNKNOWN && FreeImage_FIFSupportsReading(fif)) {
-		bitmap = FreeImage_Load(fif, fname);
-	}
-	else {
-		bitmap = NULL;
-	}
+	decoded_image image;
 
-	// PROCESS IMAGE if bitmap was successfully initialized
-	if(bitmap) {
-		unsigned int w = FreeImage_GetWidth(bitmap);
-		unsigned int h = FreeImage_GetHeight(bitmap);
-		unsigned pixel_size = FreeImage_GetBPP(bitmap);
+	// PROCESS IMAGE if the pixels were successfully obtained
+	if(acquire_image(fname, image)) {
+		unsigned int w = image.width;
+		unsigned int h = image.height;
+		unsigned pixel_size = image.pixel_size;
 
-		// Get a pointer to the pixel data
-		BYTE *data = (BYTE*)FreeImage_GetBits(bitmap);
+		// Get a pointer to the pixel data, decoded or mapped from the cache
+		const BYTE *data = image.pixels;
 
 		// Process only RGB and RGBA images
 		if(pixel_size == 24) {
@@ -236,7 +561,7 @@ void load_image(const char *fname) {
 	}
 
 	// Clean bitmap;
-	FreeImage_Unload(bitmap);
+	release_image(image);
 
 	// active only for static linking
 	#ifdef FREEIMAGE_LIB
@@ -245,6 +570,318 @@ void load_image(const char *fname) {
 }
 
 
+// Add an attribute to a layout, its data must stay valid until the vertices are uploaded
+void add_vertex_attribute(vertex_layout &layout, const char *name, GLint size, const GLfloat *data) {
+	vertex_attribute attribute = { name, size, data, 0 };
+	layout.attributes.push_back(attribute);
+}
+
+// Compute the stride and the offsets of the attributes, then fill the bound GL_ARRAY_BUFFER with the vertices
+// Interleaved, the stride is the size of a whole vertex and an attribute starts at the sum of the sizes before it,
+// planar, each attribute is a tightly packed block of vertex_count values
+void upload_vertices(vertex_layout &layout, GLsizei vertex_count, bool interleaved) {
+	layout.vertex_count = vertex_count;
+	layout.interleaved = interleaved;
+	size_t vertex_size = 0;
+	for(size_t i = 0; i < layout.attributes.size(); ++i) {
+		layout.attributes[i].offset = interleaved ? vertex_size : vertex_size * vertex_count;
+		vertex_size += layout.attributes[i].size * sizeof(GLfloat);
+	}
+	layout.stride = interleaved ? (GLsizei)vertex_size : 0;
+
+	// The vertices are written straight in the buffer, without an intermediate copy
+	GLsizeiptr size = (GLsizeiptr)(vertex_size * vertex_count);
+	glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STATIC_DRAW);
+	unsigned char *dst = (unsigned char *)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	for(size_t i = 0; i < layout.attributes.size(); ++i) {
+		const vertex_attribute &attribute = layout.attributes[i];
+		size_t attribute_size = attribute.size * sizeof(GLfloat);
+		if(interleaved) {
+			for(GLsizei v = 0; v < vertex_count; ++v) {
+				memcpy(dst + attribute.offset + v * vertex_size, attribute.data + (size_t)v * attribute.size, attribute_size);
+			}
+		}
+		else {
+			memcpy(dst + attribute.offset, attribute.data, attribute_size * vertex_count);
+		}
+	}
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+}
+
+// Point an attribute location to an attribute of the uploaded vertices and enable it
+void enable_vertex_attribute(const vertex_layout &layout, const char *name, GLint location) {
+	for(size_t i = 0; i < layout.attributes.size(); ++i) {
+		const vertex_attribute &attribute = layout.attributes[i];
+		if(strcmp(attribute.name, name) == 0) {
+			glVertexAttribPointer(location, attribute.size, GL_FLOAT, GL_FALSE, layout.stride, (GLvoid *)attribute.offset);
+			glEnableVertexAttribArray(location);
+			return;
+		}
+	}
+	std::cerr << "The vertex layout has no attribute " << name << " I'm out!" << std::endl;
+	exit(-1);
+}
+
+// Fill the bound GL_ELEMENT_ARRAY_BUFFER with triangle indices, using the smallest index type
+// Up to 65536 vertices the indices are stored as they are, in bytes or shorts. Past that, the triangles are
+// split in chunks whose vertices are within 65536 of the chunk base vertex, each chunk is a draw. A triangle
+// spanning more than that can't be split, the mesh then keeps 32 bits indices
+void upload_indices(index_buffer &buffer, const GLuint *indices, GLsizei count) {
+	GLuint max_index = 0;
+	for(GLsizei i = 0; i < count; ++i) {
+		max_index = std::max(max_index, indices[i]);
+	}
+	buffer.count = count;
+	buffer.chunks.clear();
+	buffer.type = max_index <= 0xFF ? GL_UNSIGNED_BYTE : max_index <= 0xFFFF ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+	if(buffer.type == GL_UNSIGNED_INT) {
+		// A chunk starts at the lowest vertex of its first triangle and ends with the first triangle out of range
+		buffer.type = GL_UNSIGNED_SHORT;
+		index_chunk chunk = { 0, 0, 0 };
+		for(GLsizei i = 0; i + 2 < count; i += 3) {
+			GLuint low = std::min(indices[i], std::min(indices[i + 1], indices[i + 2]));
+			GLuint high = std::max(indices[i], std::max(indices[i + 1], indices[i + 2]));
+			if(high - low > 0xFFFF) {
+				buffer.type = GL_UNSIGNED_INT;
+				buffer.chunks.clear();
+				break;
+			}
+			if(chunk.count == 0 || low < (GLuint)chunk.base_vertex || high - chunk.base_vertex > 0xFFFF) {
+				if(chunk.count > 0) {
+					buffer.chunks.push_back(chunk);
+				}
+				chunk.first = i;
+				chunk.count = 0;
+				chunk.base_vertex = (GLint)low;
+			}
+			chunk.count += 3;
+		}
+		if(buffer.type == GL_UNSIGNED_SHORT && chunk.count > 0) {
+			buffer.chunks.push_back(chunk);
+		}
+	}
+	if(buffer.chunks.empty()) {
+		index_chunk chunk = { 0, count, 0 };
+		buffer.chunks.push_back(chunk);
+	}
+
+	// Write the indices relative to their chunk, straight in the buffer
+	size_t size = index_type_size(buffer.type);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * size, NULL, GL_STATIC_DRAW);
+	unsigned char *dst = (unsigned char *)glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, count * size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	for(size_t c = 0; c < buffer.chunks.size(); ++c) {
+		const index_chunk &chunk = buffer.chunks[c];
+		for(GLsizei i = chunk.first; i < chunk.first + chunk.count; ++i) {
+			GLuint index = indices[i] - chunk.base_vertex;
+			if(buffer.type == GL_UNSIGNED_BYTE) {
+				dst[i] = (GLubyte)index;
+			}
+			else if(buffer.type == GL_UNSIGNED_SHORT) {
+				((GLushort *)dst)[i] = (GLushort)index;
+			}
+			else {
+				((GLuint *)dst)[i] = index;
+			}
+		}
+	}
+	glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+}
+
+// Draw count indices from first, one call per chunk they cover
+// The base vertex draws are core from OpenGL 3.2, the chunk at the start of the mesh doesn't need one
+void draw_indices(const index_buffer &buffer, GLsizei first, GLsizei count) {
+	size_t size = index_type_size(buffer.type);
+	for(size_t c = 0; c < buffer.chunks.size(); ++c) {
+		const index_chunk &chunk = buffer.chunks[c];
+		GLsizei begin = std::max(first, chunk.first);
+		GLsizei end = std::min(first + count, chunk.first + chunk.count);
+		if(begin >= end) {
+			continue;
+		}
+		const GLvoid *offset = (const GLvoid *)(begin * size);
+		if(chunk.base_vertex == 0) {
+			glDrawElements(GL_TRIANGLES, end - begin, buffer.type, offset);
+		}
+		else {
+			glDrawElementsBaseVertex(GL_TRIANGLES, end - begin, buffer.type, offset, chunk.base_vertex);
+		}
+	}
+}
+
+// Size in bytes of an index type
+size_t index_type_size(GLenum type) {
+	return type == GL_UNSIGNED_BYTE ? 1 : type == GL_UNSIGNED_SHORT ? 2 : 4;
+}
+
+// Get the pixels of an image, from the texture cache if possible, otherwise the image
+// is decoded and stored in the cache for the next runs, returns false on failure
+bool acquire_image(const char *fname, decoded_image &image) {
+	image.bitmap = NULL;
+	image.mapping = NULL;
+	image.mapping_size = 0;
+	image.pixels = NULL;
+
+	#ifndef _WIN32
+		// The cache entry is valid for the same file size, modification time and content
+		unsigned long long source_size = 0, source_hash = 0;
+		long long source_mtime = 0;
+		bool use_cache = false;
+		int fd = open(fname, O_RDONLY);
+		if(fd >= 0) {
+			struct stat info;
+			if(fstat(fd, &info) == 0 && info.st_size > 0) {
+				source_size = (unsigned long long)info.st_size;
+				source_mtime = (long long)info.st_mtime;
+				void *source = mmap(NULL, (size_t)source_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if(source != MAP_FAILED) {
+					source_hash = fnv1a_hash((const unsigned char *)source, (size_t)source_size);
+					munmap(source, (size_t)source_size);
+					use_cache = true;
+				}
+			}
+			close(fd);
+		}
+
+		if(use_cache && open_cached_image(fname, source_size, source_mtime, source_hash, image)) {
+			texture_cache_hits++;
+			return true;
+		}
+		texture_cache_misses++;
+	#endif
+
+	image.bitmap = load_bitmap(fname);
+	if(!image.bitmap) {
+		return false;
+	}
+	image.width = FreeImage_GetWidth(image.bitmap);
+	image.height = FreeImage_GetHeight(image.bitmap);
+	image.pitch = FreeImage_GetPitch(image.bitmap);
+	image.pixel_size = FreeImage_GetBPP(image.bitmap);
+	image.pixels = FreeImage_GetBits(image.bitmap);
+
+	#ifndef _WIN32
+		if(use_cache) {
+			store_cached_image(fname, source_size, source_mtime, source_hash, image);
+		}
+	#endif
+	return true;
+}
+
+// Free the pixels obtained with acquire_image
+void release_image(decoded_image &image) {
+	if(image.bitmap) {
+		FreeImage_Unload(image.bitmap);
+	}
+	#ifndef _WIN32
+		if(image.mapping) {
+			munmap(image.mapping, image.mapping_size);
+		}
+	#endif
+	image.bitmap = NULL;
+	image.mapping = NULL;
+	image.pixels = NULL;
+}
+
+// Name of the cache file of an image
+std::string texture_cache_file(const char *fname) {
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.tex", fnv1a_hash((const unsigned char *)fname, strlen(fname)));
+	return std::string(texture_cache_dir) + "/" + name;
+}
+
+// Try to map the cached pixels of an image, checking that the source file didn't change
+bool open_cached_image(const char *fname, unsigned long long source_size, long long source_mtime,
+	unsigned long long source_hash, decoded_image &image) {
+	#ifdef _WIN32
+		return false;
+	#else
+		std::string cache_file = texture_cache_file(fname);
+		int fd = open(cache_file.c_str(), O_RDONLY);
+		if(fd < 0) {
+			return false;
+		}
+		struct stat info;
+		if(fstat(fd, &info) != 0 || (size_t)info.st_size < texture_cache_alignment) {
+			close(fd);
+			return false;
+		}
+		size_t size = (size_t)info.st_size;
+		void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(mapping == MAP_FAILED) {
+			return false;
+		}
+
+		const texture_cache_header *header = (const texture_cache_header *)mapping;
+		if(memcmp(header->magic, "TEXCACHE", 8) != 0 || header->version != 1 || header->levels < 1 ||
+			header->source_size != source_size || header->source_mtime != source_mtime || header->source_hash != source_hash ||
+			header->level_offset[0] + header->level_size[0] > size ||
+			header->level_size[0] != (unsigned long long)header->pitch * header->height) {
+			munmap(mapping, size);
+			return false;
+		}
+
+		image.mapping = mapping;
+		image.mapping_size = size;
+		image.width = header->width;
+		image.height = header->height;
+		image.pitch = header->pitch;
+		image.pixel_size = header->pixel_size;
+		image.pixels = (const BYTE *)mapping + header->level_offset[0];
+		return true;
+	#endif
+}
+
+// Store the decoded pixels of an image in the texture cache
+// The file is written under a temporary name then renamed, so a reader never sees half of it
+void store_cached_image(const char *fname, unsigned long long source_size, long long source_mtime,
+	unsigned long long source_hash, const decoded_image &image) {
+	#ifndef _WIN32
+		mkdir(texture_cache_dir, 0755);
+
+		std::vector<char> header_page(texture_cache_alignment, 0);
+		texture_cache_header *header = (texture_cache_header *)&header_page[0];
+		memcpy(header->magic, "TEXCACHE", 8);
+		header->version = 1;
+		header->width = image.width;
+		header->height = image.height;
+		header->pitch = image.pitch;
+		header->pixel_size = image.pixel_size;
+		header->levels = 1;
+		header->source_size = source_size;
+		header->source_mtime = source_mtime;
+		header->source_hash = source_hash;
+		header->level_offset[0] = texture_cache_alignment;
+		header->level_size[0] = (unsigned long long)image.pitch * image.height;
+
+		std::string cache_file = texture_cache_file(fname);
+		std::string temp_file = cache_file + ".tmp";
+		std::ofstream out(temp_file.c_str(), std::ios::binary);
+		if(!out.is_open()) {
+			std::cerr << "Unable to write the texture cache file " << cache_file << std::endl;
+			return;
+		}
+		out.write(&header_page[0], header_page.size());
+		out.write((const char *)image.pixels, (std::streamsize)header->level_size[0]);
+		out.close();
+		if(!out || rename(temp_file.c_str(), cache_file.c_str()) != 0) {
+			std::cerr << "Unable to write the texture cache file " << cache_file << std::endl;
+			remove(temp_file.c_str());
+		}
+	#endif
+}
+
+// 64 bits FNV-1a hash, used to key the texture cache
+unsigned long long fnv1a_hash(const unsigned char *data, size_t length, unsigned long long hash) {
+	for(size_t i = 0; i < length; ++i) {
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
 // Called when the window is resized
 void GLFWCALL window_resized(int width, int height) {
 	// Use red to clear the screen
@@ -252,6 +889,8 @@ void GLFWCALL window_resized(int width, int height) {
 
 	// Set the viewport
 	glViewport(0, 0, width, height);
+	window_width = width;
+	window_height = height;
 
 	glClear(GL_COLOR_BUFFER_BIT);
 	glfwSwapBuffers();
@@ -263,6 +902,35 @@ void keyboard(int key, int action) {
 		glfwTerminate();
 		exit(0);
 	}
+	if(key == 'G' && action == GLFW_PRESS) {
+		current_features ^= FEATURE_GRAYSCALE;
+	}
+	if(key == 'V' && action == GLFW_PRESS && virtual_texture_enabled) {
+		show_virtual_texture = !show_virtual_texture;
+	}
+
+	// Pan by a tenth of the view, zoom by a factor of 2 around the center
+	if(action == GLFW_PRESS) {
+		if(key == GLFW_KEY_LEFT) {
+			view_rect[0] -= view_rect[2] * 0.1f;
+		}
+		else if(key == GLFW_KEY_RIGHT) {
+			view_rect[0] += view_rect[2] * 0.1f;
+		}
+		else if(key == GLFW_KEY_DOWN) {
+			view_rect[1] -= view_rect[3] * 0.1f;
+		}
+		else if(key == GLFW_KEY_UP) {
+			view_rect[1] += view_rect[3] * 0.1f;
+		}
+		else if(key == 'Z' || key == 'X') {
+			float factor = key == 'Z' ? 0.5f : 2.0f;
+			view_rect[0] += view_rect[2] * (1.0f - factor) * 0.5f;
+			view_rect[1] += view_rect[3] * (1.0f - factor) * 0.5f;
+			view_rect[2] *= factor;
+			view_rect[3] *= factor;
+		}
+	}
 }
 
 // Read a shader source from a file
@@ -297,8 +965,11 @@ GLuint load_and_compile_shader(const char *fname, GLenum shaderType) {
 	// Load a shader from an external file
 	std::vector<char> buffer;
 	read_shader_src(fname, buffer);
-	const char *src = &buffer[0];
+	return compile_shader_src(&buffer[0], shaderType);
+}
 
+// Compile a shader from a source already loaded in memory
+GLuint compile_shader_src(const char *src, GLenum shaderType) {
 	// Compile the shader
 	GLuint shader = glCreateShader(shaderType);
 	glShaderSource(shader, 1, &src, NULL);
@@ -339,3 +1010,562 @@ GLuint create_program(const char *path_vert_shader, const char *path_frag_shader
 	return shaderProgram;
 }
 
+
+// Get the program for a set of features, only the variants actually used are compiled
+GLuint get_program_variant(unsigned int features) {
+	std::map<unsigned int, GLuint>::iterator it = program_variants.find(features);
+	if(it != program_variants.end()) {
+		return it->second;
+	}
+
+	// First use of this variant, build it
+	std::string vert_src = preprocess_shader(vert_shader_path, features);
+	std::string frag_src = preprocess_shader(frag_shader_path, features);
+	GLuint vertexShader = compile_shader_src(vert_src.c_str(), GL_VERTEX_SHADER);
+	GLuint fragmentShader = compile_shader_src(frag_src.c_str(), GL_FRAGMENT_SHADER);
+
+	GLuint shaderProgram = glCreateProgram();
+	glAttachShader(shaderProgram, vertexShader);
+	glAttachShader(shaderProgram, fragmentShader);
+
+	// Flag the shaders for deletion
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+
+	// Attributes missing from a variant are simply ignored
+	glBindAttribLocation(shaderProgram, POSITION_LOCATION, "position");
+	glBindAttribLocation(shaderProgram, TEXTURE_COORD_LOCATION, "texture_coord");
+	glBindAttribLocation(shaderProgram, COLOR_LOCATION, "color");
+
+	// Link and use the program
+	glLinkProgram(shaderProgram);
+
+	// Check the result of the link, a broken variant is never cached
+	GLint test;
+	glGetProgramiv(shaderProgram, GL_LINK_STATUS, &test);
+	if(!test) {
+		std::cerr << "Linking the shader variant " << features << " failed with this message:" << std::endl;
+		std::vector<char> link_log(512);
+		glGetProgramInfoLog(shaderProgram, link_log.size(), NULL, &link_log[0]);
+		std::cerr << &link_log[0] << std::endl;
+		glfwTerminate();
+		exit(-1);
+	}
+	glUseProgram(shaderProgram);
+
+	// Texture units of the samplers, those missing from a variant are simply ignored
+	glUniform1i(glGetUniformLocation(shaderProgram, "texture_sampler"), 0);
+	glUniform1i(glGetUniformLocation(shaderProgram, "page_cache"), 1);
+	glUniform1i(glGetUniformLocation(shaderProgram, "page_table"), 2);
+
+	// The virtual texture uniforms change every frame, keep their locations
+	vt_uniform_locations &locations = vt_program_uniforms[shaderProgram];
+	locations.view_rect = glGetUniformLocation(shaderProgram, "view_rect");
+	locations.levels = glGetUniformLocation(shaderProgram, "vt_levels");
+	locations.virtual_size = glGetUniformLocation(shaderProgram, "vt_virtual_size");
+	locations.image_scale = glGetUniformLocation(shaderProgram, "vt_image_scale");
+	locations.level_bias = glGetUniformLocation(shaderProgram, "vt_level_bias");
+
+	std::cout << "Compiled the shader variant " << features << std::endl;
+	program_variants[features] = shaderProgram;
+	return shaderProgram;
+}
+
+// Expand the #include directives of a shader and add the defines of the requested features
+std::string preprocess_shader(const char *fname, unsigned int features) {
+	std::string src;
+	std::set<std::string> included;
+	expand_includes(fname, src, included);
+
+	// The defines must come after the #version line
+	std::string defines;
+	for(unsigned int i = 0; i < sizeof(shader_feature_names)/sizeof(shader_feature_names[0]); ++i) {
+		if(features & (1u << i)) {
+			defines += std::string("#define ") + shader_feature_names[i] + "\n";
+		}
+	}
+	size_t pos = 0;
+	if(src.compare(0, 8, "#version") == 0) {
+		pos = src.find('\n') + 1;
+	}
+	src.insert(pos, defines);
+	return src;
+}
+
+// Recursively paste a shader file and the files it includes
+// Includes are relative to the folder of the including file, and a file is pasted only once
+void expand_includes(const std::string &fname, std::string &out, std::set<std::string> &included) {
+	if(!included.insert(fname).second) {
+		return;
+	}
+
+	std::map<std::string, std::string>::iterator it = shader_files.find(fname);
+	if(it == shader_files.end()) {
+		std::vector<char> buffer;
+		read_shader_src(fname.c_str(), buffer);
+		it = shader_files.insert(std::make_pair(fname, std::string(&buffer[0]))).first;
+	}
+	const std::string &src = it->second;
+	std::string dir = fname.substr(0, fname.find_last_of('/') + 1);
+
+	size_t start = 0;
+	while(start < src.size()) {
+		size_t end = src.find('\n', start);
+		if(end == std::string::npos) {
+			end = src.size();
+		}
+		std::string line = src.substr(start, end - start);
+		size_t first = line.find_first_not_of(" \t");
+		if(first != std::string::npos && line.compare(first, 8, "#include") == 0) {
+			size_t open = line.find('"', first);
+			size_t close = line.find('"', open + 1);
+			if(open == std::string::npos || close == std::string::npos) {
+				std::cerr << "Malformed #include in " << fname << " I'm out!" << std::endl;
+				exit(-1);
+			}
+			expand_includes(dir + line.substr(open + 1, close - open - 1), out, included);
+		}
+		else {
+			out += line;
+			out += '\n';
+		}
+		start = end + 1;
+	}
+}
+
+// Load an image from the disk with FreeImage, returns NULL if the image can't be read
+FIBITMAP *load_bitmap(const char *fname) {
+	// Get the format of the image file
+	FREE_IMAGE_FORMAT fif =FreeImage_GetFileType(fname, 0);
+
+	// If the format can't be determined, try to guess the format from the file name
+	if(fif == FIF_UNKNOWN) {
+		fif = FreeImage_GetFIFFromFilename(fname);
+	}
+
+	// Load the data in bitmap if possible
+	if(fif != FIF_UNKNOWN && FreeImage_FIFSupportsReading(fif)) {
+		return FreeImage_Load(fif, fname);
+	}
+	return NULL;
+}
+
+// Bilinear sample of a bitmap at a position in pixels, the pixel centers are at .5
+void sample_bitmap(FIBITMAP *bitmap, unsigned int bytes, double x, double y, double *color) {
+	int w = FreeImage_GetWidth(bitmap), h = FreeImage_GetHeight(bitmap);
+	x = std::min(std::max(x - 0.5, 0.0), w - 1.0);
+	y = std::min(std::max(y - 0.5, 0.0), h - 1.0);
+	int x0 = (int)x, y0 = (int)y;
+	int x1 = std::min(x0 + 1, w - 1), y1 = std::min(y0 + 1, h - 1);
+	double fx = x - x0, fy = y - y0;
+	const BYTE *row0 = FreeImage_GetScanLine(bitmap, y0);
+	const BYTE *row1 = FreeImage_GetScanLine(bitmap, y1);
+	for(unsigned int c = 0; c < 4; ++c) {
+		double a = c < bytes ? row0[x0 * bytes + c] : 255, b = c < bytes ? row0[x1 * bytes + c] : 255;
+		double d = c < bytes ? row1[x0 * bytes + c] : 255, e = c < bytes ? row1[x1 * bytes + c] : 255;
+		color[c] = (a * (1 - fx) + b * fx) * (1 - fy) + (d * (1 - fx) + e * fx) * fy;
+	}
+}
+
+// Bake an image, scaled up by an integer factor, to a page file, returns false on failure
+// Each page is sampled from the source image, so the whole pyramid is never in memory: texels covering
+// less than a source pixel are bilinear samples, larger ones average a grid of samples over their footprint
+bool build_page_file(const char *fname, unsigned int scale, const std::string &page_file) {
+	FIBITMAP *bitmap = load_bitmap(fname);
+	if(!bitmap) {
+		return false;
+	}
+	unsigned int bytes = FreeImage_GetBPP(bitmap) / 8;
+	if(bytes != 3 && bytes != 4) {
+		FreeImage_Unload(bitmap);
+		return false;
+	}
+	struct stat info;
+	if(stat(fname, &info) != 0) {
+		FreeImage_Unload(bitmap);
+		return false;
+	}
+
+	vt_file_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "VTPAGES1", 8);
+	header.version = 1;
+	header.width = FreeImage_GetWidth(bitmap) * scale;
+	header.height = FreeImage_GetHeight(bitmap) * scale;
+	header.scale = scale;
+	header.page_size = vt_page_size;
+	header.page_border = vt_page_border;
+	header.source_size = (unsigned long long)info.st_size;
+	header.source_mtime = (long long)info.st_mtime;
+	header.levels = 1;
+	while((vt_page_payload << (header.levels - 1)) < std::max(header.width, header.height)) {
+		header.levels++;
+	}
+	if((1 << (header.levels - 1)) > vt_max_pages_per_side) {
+		std::cerr << "A scale of " << scale << " needs more than " << vt_max_pages_per_side << " pages on a side" << std::endl;
+		FreeImage_Unload(bitmap);
+		return false;
+	}
+
+	std::string temp_file = page_file + ".tmp";
+	std::ofstream out(temp_file.c_str(), std::ios::binary);
+	if(!out.is_open()) {
+		FreeImage_Unload(bitmap);
+		return false;
+	}
+	std::vector<char> header_page(vt_header_size, 0);
+	memcpy(&header_page[0], &header, sizeof(header));
+	out.write(&header_page[0], header_page.size());
+
+	std::vector<GLubyte> page(vt_page_size * vt_page_size * 4);
+	for(unsigned int level = 0; level < header.levels; ++level) {
+		double texel_size = (double)(1u << level) / scale;
+		int samples = std::min(4, std::max(1, (int)ceil(texel_size)));
+		for(int py = 0; py < vt_level_pages(header.height, level); ++py) {
+			for(int px = 0; px < vt_level_pages(header.width, level); ++px) {
+				for(unsigned int y = 0; y < vt_page_size; ++y) {
+					for(unsigned int x = 0; x < vt_page_size; ++x) {
+						// Center of the texel in source pixels, outside the image the pages are black
+						double sx = ((double)px * vt_page_payload + x - vt_page_border + 0.5) * texel_size;
+						double sy = ((double)py * vt_page_payload + y - vt_page_border + 0.5) * texel_size;
+						double color[4] = { 0, 0, 0, 255 };
+						if(sx < header.width / (double)scale + texel_size && sy < header.height / (double)scale + texel_size) {
+							color[3] = 0;
+							for(int j = 0; j < samples; ++j) {
+								for(int i = 0; i < samples; ++i) {
+									double sample[4];
+									sample_bitmap(bitmap, bytes, sx + ((i + 0.5) / samples - 0.5) * texel_size,
+										sy + ((j + 0.5) / samples - 0.5) * texel_size, sample);
+									for(int c = 0; c < 4; ++c) {
+										color[c] += sample[c] / (samples * samples);
+									}
+								}
+							}
+						}
+						GLubyte *texel = &page[(y * vt_page_size + x) * 4];
+						texel[0] = (GLubyte)(color[FI_RGBA_BLUE] + 0.5);
+						texel[1] = (GLubyte)(color[FI_RGBA_GREEN] + 0.5);
+						texel[2] = (GLubyte)(color[FI_RGBA_RED] + 0.5);
+						texel[3] = (GLubyte)(color[FI_RGBA_ALPHA] + 0.5);
+					}
+				}
+				out.write((const char *)&page[0], page.size());
+			}
+		}
+	}
+	out.close();
+	FreeImage_Unload(bitmap);
+	if(!out || rename(temp_file.c_str(), page_file.c_str()) != 0) {
+		remove(temp_file.c_str());
+		return false;
+	}
+	return true;
+}
+
+// Open the page file of an image, baking it first if needed, and create the cache, page table and feedback pass
+// The page file is rebuilt when the source image or the page layout changes
+void open_virtual_texture(virtual_texture &vt, const char *fname, unsigned int scale) {
+	char page_file[256];
+	snprintf(page_file, sizeof(page_file), "%s.x%u.pages", fname, scale);
+
+	vt_file_header header;
+	bool valid = false;
+	struct stat info;
+	if(stat(fname, &info) == 0) {
+		std::ifstream in(page_file, std::ios::binary);
+		if(in.read((char *)&header, sizeof(header)) && memcmp(header.magic, "VTPAGES1", 8) == 0 && header.version == 1 &&
+			header.scale == scale && header.page_size == vt_page_size && header.page_border == vt_page_border &&
+			header.source_size == (unsigned long long)info.st_size && header.source_mtime == (long long)info.st_mtime) {
+			valid = true;
+		}
+	}
+	if(!valid) {
+		std::cout << "Baking the pages of " << fname << " scaled " << scale << " times" << std::endl;
+		double start = glfwGetTime();
+		if(!build_page_file(fname, scale, page_file)) {
+			std::cerr << "Unable to bake the pages of " << fname << " I'm out!" << std::endl;
+			exit(-1);
+		}
+		std::cout << "Baked in " << glfwGetTime() - start << " s" << std::endl;
+		std::ifstream in(page_file, std::ios::binary);
+		in.read((char *)&header, sizeof(header));
+	}
+
+	vt.pages.open(page_file, std::ios::binary);
+	vt.width = header.width;
+	vt.height = header.height;
+	vt.levels = (int)header.levels;
+
+	// The level 0 of the page table has a texel per page
+	GLint max_size;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+	if((1 << (vt.levels - 1)) > std::min(vt_max_pages_per_side, (int)max_size)) {
+		std::cerr << "The virtual texture of " << fname << " has too many pages. I'm out!" << std::endl;
+		exit(-1);
+	}
+	vt.virtual_size = vt_page_payload << (vt.levels - 1);
+	vt.level_first_page.resize(vt.levels);
+	vt.level_pages_x.resize(vt.levels);
+	vt.level_pages_y.resize(vt.levels);
+	unsigned long long first = 0;
+	for(int level = 0; level < vt.levels; ++level) {
+		vt.level_first_page[level] = first;
+		vt.level_pages_x[level] = vt_level_pages(vt.width, level);
+		vt.level_pages_y[level] = vt_level_pages(vt.height, level);
+		first += (unsigned long long)vt.level_pages_x[level] * vt.level_pages_y[level];
+	}
+	std::cout << "Virtual texture of " << vt.width << "x" << vt.height << ", " << vt.levels << " levels, " << first << " pages" << std::endl;
+
+	// The page cache, as large as the implementation allows up to the requested size
+	vt.cache_pages_per_side = std::min(vt_cache_pages_per_side, (int)(max_size / vt_page_size));
+	int cache_size = vt.cache_pages_per_side * vt_page_size;
+	glGenTextures(1, &vt.cache_texture);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, vt.cache_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cache_size, cache_size, 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	int slots = vt.cache_pages_per_side * vt.cache_pages_per_side;
+	vt.slot_page.assign(slots, 0xFFFFFFFFu);
+	vt.lru_position.resize(slots);
+	for(int slot = 1; slot < slots; ++slot) {
+		vt.lru_position[slot] = vt.lru.insert(vt.lru.end(), slot);
+	}
+
+	// The page table, a mip level per level of the pyramid, integer texels are fetched without filtering
+	glGenTextures(1, &vt.page_table_texture);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, vt.page_table_texture);
+	vt.page_table.resize(vt.levels);
+	for(int level = 0; level < vt.levels; ++level) {
+		int pages = 1 << (vt.levels - 1 - level);
+		vt.page_table[level].assign((size_t)pages * pages * 4, 0);
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA16UI, pages, pages, 0, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, NULL);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, vt.levels - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glActiveTexture(GL_TEXTURE0);
+
+	// The feedback pass, its pixels are read back through a pixel buffer
+	// 16 bits per channel, the page x and y of the level 0 go past 255 on large images
+	vt.feedback_width = std::max(1, window_width / vt_feedback_divisor);
+	vt.feedback_height = std::max(1, window_height / vt_feedback_divisor);
+	glGenRenderbuffers(1, &vt.feedback_renderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, vt.feedback_renderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA16UI, vt.feedback_width, vt.feedback_height);
+	glGenFramebuffers(1, &vt.feedback_framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, vt.feedback_framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, vt.feedback_renderbuffer);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cerr << "The feedback framebuffer is incomplete. I'm out!" << std::endl;
+		exit(-1);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glGenBuffers(1, &vt.feedback_pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, vt.feedback_pbo);
+	glBufferData(GL_PIXEL_PACK_BUFFER, vt.feedback_width * vt.feedback_height * 4 * sizeof(GLushort), NULL, GL_STREAM_READ);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	vt.feedback_fence = 0;
+
+	// The single page of the last level stays in the slot 0
+	vt.pages_loaded = vt.pages_evicted = 0;
+	vt_load_page(vt, vt_page_key(vt.levels - 1, 0, 0));
+	vt_update_page_table(vt);
+}
+
+// Number of pages overlapping the image on a side of a level
+int vt_level_pages(unsigned int size, int level) {
+	unsigned int page_texels = vt_page_payload << level;
+	return (int)((size + page_texels - 1) / page_texels);
+}
+
+// Key of a page, used to find it in the cache
+unsigned int vt_page_key(int level, int x, int y) {
+	return (unsigned int)level << 24 | (unsigned int)y << 12 | (unsigned int)x;
+}
+
+// Read a page from the disk to a slot of the cache, the least recently used page is evicted when the cache is full
+void vt_load_page(virtual_texture &vt, unsigned int key) {
+	int level = key >> 24, y = (key >> 12) & 0xFFF, x = key & 0xFFF;
+	int slot = 0;
+	if(level != vt.levels - 1) {
+		slot = vt.lru.front();
+		if(vt.slot_page[slot] != 0xFFFFFFFFu) {
+			vt.resident.erase(vt.slot_page[slot]);
+			vt.page_table_changes.insert(vt.slot_page[slot]);
+			vt.pages_evicted++;
+		}
+		vt_touch_page(vt, slot);
+	}
+
+	std::vector<GLubyte> page(vt_page_size * vt_page_size * 4);
+	unsigned long long index = vt.level_first_page[level] + (unsigned long long)y * vt.level_pages_x[level] + x;
+	vt.pages.seekg((std::streamoff)(vt_header_size + index * page.size()));
+	vt.pages.read((char *)&page[0], page.size());
+	if(!vt.pages) {
+		std::cerr << "Unable to read a page of the virtual texture. I'm out!" << std::endl;
+		exit(-1);
+	}
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, vt.cache_texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % vt.cache_pages_per_side) * vt_page_size, (slot / vt.cache_pages_per_side) * vt_page_size,
+		vt_page_size, vt_page_size, GL_BGRA, GL_UNSIGNED_BYTE, &page[0]);
+	glActiveTexture(GL_TEXTURE0);
+
+	vt.slot_page[slot] = key;
+	vt.resident[key] = slot;
+	vt.page_table_changes.insert(key);
+	vt.pages_loaded++;
+}
+
+// Mark a resident page as used
+void vt_touch_page(virtual_texture &vt, int slot) {
+	if(slot != 0) {
+		vt.lru.splice(vt.lru.end(), vt.lru, vt.lru_position[slot]);
+	}
+}
+
+// Point each page of the page table to itself if resident, otherwise to its closest resident ancestor,
+// only the entries under the pages loaded or evicted since the last update are rewritten
+// A change only affects the square of entries under the page on each finer level. The changes are
+// applied from the coarsest level, so the parent of an entry is always up to date when it is copied,
+// and each square is uploaded alone with the row length of its level
+void vt_update_page_table(virtual_texture &vt) {
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, vt.page_table_texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	// The level is in the high bits of a key, the coarsest pages come last in the set
+	for(std::set<unsigned int>::reverse_iterator change = vt.page_table_changes.rbegin(); change != vt.page_table_changes.rend(); ++change) {
+		int changed_level = *change >> 24, changed_y = (*change >> 12) & 0xFFF, changed_x = *change & 0xFFF;
+		for(int level = changed_level; level >= 0; --level) {
+			int pages = 1 << (vt.levels - 1 - level);
+			int side = 1 << (changed_level - level);
+			int first_x = changed_x << (changed_level - level), first_y = changed_y << (changed_level - level);
+			std::vector<GLushort> &table = vt.page_table[level];
+			for(int y = first_y; y < first_y + side; ++y) {
+				for(int x = first_x; x < first_x + side; ++x) {
+					GLushort *entry = &table[((size_t)y * pages + x) * 4];
+					std::map<unsigned int, int>::iterator it = vt.resident.find(vt_page_key(level, x, y));
+					if(it != vt.resident.end()) {
+						entry[0] = (GLushort)(it->second % vt.cache_pages_per_side);
+						entry[1] = (GLushort)(it->second / vt.cache_pages_per_side);
+						entry[2] = (GLushort)level;
+						entry[3] = 255;
+					}
+					else if(level + 1 < vt.levels) {
+						memcpy(entry, &vt.page_table[level + 1][((size_t)(y / 2) * (pages / 2) + x / 2) * 4], 4 * sizeof(GLushort));
+					}
+				}
+			}
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, pages);
+			glPixelStorei(GL_UNPACK_SKIP_PIXELS, first_x);
+			glPixelStorei(GL_UNPACK_SKIP_ROWS, first_y);
+			glTexSubImage2D(GL_TEXTURE_2D, level, first_x, first_y, side, side, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, &table[0]);
+		}
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+	glActiveTexture(GL_TEXTURE0);
+	vt.page_table_changes.clear();
+}
+
+// Render the pages needed by the current view to the feedback framebuffer and start reading them back
+// Only one read back is in flight, the pass is skipped until the previous one was processed
+void vt_render_feedback(virtual_texture &vt, GLuint &vao) {
+	if(vt.feedback_fence) {
+		return;
+	}
+	GLuint shaderProgram = get_program_variant(FEATURE_VIRTUAL_TEXTURE | FEATURE_VT_FEEDBACK);
+	glUseProgram(shaderProgram);
+
+	// The derivatives are larger at the lower resolution, the level bias compensates
+	vt_set_uniforms(vt, shaderProgram, -log2((float)window_width / vt.feedback_width));
+
+	glBindFramebuffer(GL_FRAMEBUFFER, vt.feedback_framebuffer);
+	glViewport(0, 0, vt.feedback_width, vt.feedback_height);
+	const GLuint clear_page[4] = { 0, 0, 0, 0 };
+	glClearBufferuiv(GL_COLOR, 0, clear_page);
+	glBindVertexArray(vao);
+	draw_indices(scene_indices, 0, scene_indices.count);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, vt.feedback_pbo);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, vt.feedback_width, vt.feedback_height, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	vt.feedback_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, window_width, window_height);
+}
+
+// Load the pages found by the last feedback pass, if it is available, never waits for the GPU
+// The pages are loaded from the coarsest to the finest, so the view sharpens progressively
+void vt_process_feedback(virtual_texture &vt) {
+	if(vt.feedback_fence) {
+		GLenum result = glClientWaitSync(vt.feedback_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if(result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED) {
+			glDeleteSync(vt.feedback_fence);
+			vt.feedback_fence = 0;
+
+			std::set<unsigned int> needed;
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, vt.feedback_pbo);
+			const GLushort *pixels = (const GLushort *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+				vt.feedback_width * vt.feedback_height * 4 * sizeof(GLushort), GL_MAP_READ_BIT);
+
+			// The read back can't be mapped, the pages of this pass are lost and the next pass tries again
+			int feedback_pixels = pixels ? vt.feedback_width * vt.feedback_height : 0;
+			for(int i = 0; i < feedback_pixels; ++i) {
+				const GLushort *page = pixels + i * 4;
+				if(page[3] && page[2] < vt.levels && page[0] < vt.level_pages_x[page[2]] && page[1] < vt.level_pages_y[page[2]]) {
+					// The ancestors are needed too, they are the fallback while the page loads
+					for(int level = page[2], x = page[0], y = page[1]; level < vt.levels; ++level, x /= 2, y /= 2) {
+						needed.insert(vt_page_key(level, x, y));
+					}
+				}
+			}
+			if(pixels) {
+				glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			}
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+			std::vector<unsigned int> missing;
+			for(std::set<unsigned int>::iterator it = needed.begin(); it != needed.end(); ++it) {
+				std::map<unsigned int, int>::iterator page = vt.resident.find(*it);
+				if(page != vt.resident.end()) {
+					vt_touch_page(vt, page->second);
+				}
+				else {
+					missing.push_back(*it);
+				}
+			}
+			std::sort(missing.begin(), missing.end(), std::greater<unsigned int>());
+			for(size_t i = 0; i < missing.size() && (int)i < vt_pages_per_frame; ++i) {
+				vt_load_page(vt, missing[i]);
+			}
+		}
+	}
+	if(!vt.page_table_changes.empty()) {
+		vt_update_page_table(vt);
+	}
+}
+
+// Set the uniforms of a virtual texture program, their locations come from get_program_variant
+void vt_set_uniforms(virtual_texture &vt, GLuint shaderProgram, float level_bias) {
+	std::map<GLuint, vt_uniform_locations>::const_iterator it = vt_program_uniforms.find(shaderProgram);
+	if(it == vt_program_uniforms.end()) {
+		return;
+	}
+	const vt_uniform_locations &locations = it->second;
+	glUniform4fv(locations.view_rect, 1, view_rect);
+	glUniform1i(locations.levels, vt.levels);
+	glUniform1f(locations.virtual_size, (float)vt.virtual_size);
+	glUniform2f(locations.image_scale, (float)vt.width / vt.virtual_size, (float)vt.height / vt.virtual_size);
+	glUniform1f(locations.level_bias, level_bias);
+}
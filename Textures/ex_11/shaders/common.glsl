@@ -0,0 +1,7 @@
+// Code shared by the shader variants
+
+// Average of the red, green and blue components
+vec4 grayscale(vec4 color) {
+	float average_color = (color.r + color.g + color.b)/3.0;
+	return vec4(average_color, average_color, average_color, 1.0);
+}
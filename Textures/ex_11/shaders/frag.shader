@@ -1,12 +1,40 @@
 #version 150
 
-in vec2 texture_coord_from_vshader;
-out vec4 out_color;
+// Feature switches, defined by the program when a variant is requested:
+// GRAYSCALE - convert the output color to gray levels
+// VERTEX_COLOR - use the color from the vertex shader instead of the texture
+// VIRTUAL_TEXTURE - sample the virtual texture instead of the texture
+// VT_FEEDBACK - with VIRTUAL_TEXTURE, write the pages needed instead of a color
+
+#include "common.glsl"
+#include "virtual_texture.glsl"
 
+#ifdef VERTEX_COLOR
+in vec4 color_from_vshader;
+#else
+in vec2 texture_coord_from_vshader;
 uniform sampler2D texture_sampler;
+#endif
+
+#ifdef VT_FEEDBACK
+out uvec4 out_page;
+#else
+out vec4 out_color;
+#endif
 
 void main() {
+#if defined(VT_FEEDBACK)
+	out_page = vt_feedback(texture_coord_from_vshader);
+#else
+#if defined(VERTEX_COLOR)
+	out_color = color_from_vshader;
+#elif defined(VIRTUAL_TEXTURE)
+	out_color = vt_sample(texture_coord_from_vshader);
+#else
 	out_color = texture(texture_sampler, texture_coord_from_vshader);
-	float average_color = (out_color.r + out_color.g + out_color.b)/3.0;
-	out_color = vec4(average_color, average_color, average_color, 1.0);
+#endif
+#ifdef GRAYSCALE
+	out_color = grayscale(out_color);
+#endif
+#endif
 }
@@ -1,10 +1,39 @@
 #version 150
 
+// Feature switches, defined by the program when a variant is requested:
+// VERTEX_COLOR - pass a per vertex color instead of texture coordinates
+// POINT_SIZE - set the size of the points from the point_size uniform
+// VIRTUAL_TEXTURE - pan and zoom the texture coordinates with the view_rect uniform
+
 in vec4 position;
+
+#ifdef VERTEX_COLOR
+in vec4 color;
+out vec4 color_from_vshader;
+#else
 in vec2 texture_coord;
 out vec2 texture_coord_from_vshader;
+#endif
+
+#ifdef POINT_SIZE
+uniform float point_size;
+#endif
+
+#ifdef VIRTUAL_TEXTURE
+// Origin and size of the visible part of the image, in texture coordinates
+uniform vec4 view_rect;
+#endif
 
 void main() {
 	gl_Position = position;
+#ifdef VERTEX_COLOR
+	color_from_vshader = color;
+#elif defined(VIRTUAL_TEXTURE)
+	texture_coord_from_vshader = view_rect.xy + texture_coord * view_rect.zw;
+#else
 	texture_coord_from_vshader = texture_coord;
+#endif
+#ifdef POINT_SIZE
+	gl_PointSize = point_size;
+#endif
 }
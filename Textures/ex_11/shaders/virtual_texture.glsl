@@ -0,0 +1,71 @@
+// Virtual texture lookups, only compiled in the VIRTUAL_TEXTURE variants
+// The pages of the image pyramid are spread in the page cache texture, the page table has one texel
+// per page and per level telling where the page, or the closest coarser page in the cache, is
+
+#ifdef VIRTUAL_TEXTURE
+
+uniform sampler2D page_cache;
+uniform usampler2D page_table;
+
+// Number of levels of the pyramid, the last one is a single page
+uniform int vt_levels;
+
+// Size in texels of the level 0, a power of two number of pages
+uniform float vt_virtual_size;
+
+// Part of the virtual texture covered by the image, the rest of the last pages is padding
+uniform vec2 vt_image_scale;
+
+// Added to the level, the feedback pass renders at a lower resolution than the screen
+uniform float vt_level_bias;
+
+// Size of a page in the cache and of the border repeated from its neighbours
+const float vt_page_size = 128.0;
+const float vt_page_border = 4.0;
+
+// Level of the pyramid wanted at a virtual texture coordinate, about one texel per pixel
+int vt_level(vec2 coord) {
+	vec2 texels = coord * vt_virtual_size;
+	float footprint = max(length(dFdx(texels)), length(dFdy(texels)));
+	return int(clamp(floor(log2(max(footprint, 1e-8)) + vt_level_bias), 0.0, float(vt_levels - 1)));
+}
+
+// Page containing a virtual texture coordinate at a level
+ivec2 vt_page(vec2 coord, int level) {
+	int pages = 1 << (vt_levels - 1 - level);
+	return clamp(ivec2(coord * float(pages)), ivec2(0), ivec2(pages - 1));
+}
+
+// True if the image covers a texture coordinate
+bool vt_inside(vec2 coord) {
+	return all(greaterThanEqual(coord, vec2(0.0))) && all(lessThanEqual(coord, vec2(1.0)));
+}
+
+// Sample the virtual texture, the image covers the texture coordinates from 0 to 1
+// The level is computed before any branch, the derivatives are undefined in non uniform control flow
+vec4 vt_sample(vec2 coord) {
+	int level = vt_level(coord * vt_image_scale);
+	if(!vt_inside(coord)) {
+		return vec4(0.0, 0.0, 0.0, 1.0);
+	}
+	coord = min(coord, vec2(0.999999)) * vt_image_scale;
+	uvec4 entry = texelFetch(page_table, vt_page(coord, level), level);
+
+	// entry.z is the level of the page in the cache, the one asked for or a coarser one
+	float pages = exp2(float(vt_levels - 1) - float(entry.z));
+	vec2 within = clamp(coord * pages - floor(coord * pages), 0.0, 1.0);
+	vec2 texel = vec2(entry.xy) * vt_page_size + vt_page_border + within * (vt_page_size - 2.0 * vt_page_border);
+	return textureLod(page_cache, texel / vec2(textureSize(page_cache, 0)), 0.0);
+}
+
+// The page needed at a texture coordinate, written by the feedback pass, alpha is 0 where nothing is needed
+uvec4 vt_feedback(vec2 coord) {
+	int level = vt_level(coord * vt_image_scale);
+	if(!vt_inside(coord)) {
+		return uvec4(0u);
+	}
+	coord = min(coord, vec2(0.999999)) * vt_image_scale;
+	return uvec4(uvec2(vt_page(coord, level)), uint(level), 255u);
+}
+
+#endif
@@ -5,9 +5,21 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <cstdio>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <map>
 //#include <ctime>
 #include <FreeImage.h>
 
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 // Read a shader source from a file
 // store the shader source in a std::vector<char>
 void read_shader_src(const char *fname, std::vector<char> &buffer);
@@ -30,6 +42,35 @@ void display(GLuint &vao);
 // Initialize the data to be rendered
 void initialize(GLuint &vao);
 
+// An attribute of the vertices, its values are size floats per vertex, the offset is set by upload_vertices
+struct vertex_attribute {
+	const char *name;
+	GLint size;
+	const GLfloat *data;
+	size_t offset;
+};
+
+// Attributes of the vertices and how they are stored in the vertex buffer, either interleaved,
+// all the attributes of a vertex next to each other, or planar, all the values of an attribute together
+struct vertex_layout {
+	std::vector<vertex_attribute> attributes;
+	GLsizei vertex_count;
+	bool interleaved;
+	GLsizei stride;
+};
+
+// Add an attribute to a layout, its data must stay valid until the vertices are uploaded
+void add_vertex_attribute(vertex_layout &layout, const char *name, GLint size, const GLfloat *data);
+
+// Compute the stride and the offsets of the attributes, then fill the bound GL_ARRAY_BUFFER with the vertices
+void upload_vertices(vertex_layout &layout, GLsizei vertex_count, bool interleaved);
+
+// Point an attribute location to an attribute of the uploaded vertices and enable it
+void enable_vertex_attribute(const vertex_layout &layout, const char *name, GLint location);
+
+// Run with --planar to store all the positions then all the other attributes, instead of interleaved vertices
+bool interleaved_vertices = true;
+
 // Load an image from the disk with FreeImage
 void load_image(const char *fname);
 
@@ -39,7 +80,132 @@ void wrap_tests();
 // Global variable for switching through the warpping modes
 GLuint wrap_option = 0;
 
-int main () {
+// The wrapping modes cycled through by W, and their names
+const GLenum wrap_modes[] = { GL_REPEAT, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_BORDER, GL_MIRRORED_REPEAT };
+const char *wrap_mode_names[] = { "GL_REPEAT", "GL_CLAMP_TO_EDGE", "GL_CLAMP_TO_BORDER", "GL_MIRRORED_REPEAT" };
+
+// The sampling parameters held by a sampler object
+struct sampler_state {
+	GLenum wrap;
+	GLenum min_filter;
+	GLenum mag_filter;
+
+	bool operator<(const sampler_state &other) const {
+		if(wrap != other.wrap) {
+			return wrap < other.wrap;
+		}
+		if(min_filter != other.min_filter) {
+			return min_filter < other.min_filter;
+		}
+		return mag_filter < other.mag_filter;
+	}
+};
+
+// Get the sampler object for a combination of parameters, created the first time it is asked for
+GLuint get_sampler(const sampler_state &state);
+
+// Sampler objects created so far, one per distinct combination
+std::map<sampler_state, GLuint> sampler_cache;
+
+// Sampler objects need OpenGL 3.3 or ARB_sampler_objects, without them the texture parameters are changed
+bool use_samplers = false;
+
+// A run of triangle indices drawn with one call, its indices are stored relative to base_vertex
+struct index_chunk {
+	GLsizei first;
+	GLsizei count;
+	GLint base_vertex;
+};
+
+// Indices stored with the smallest type that holds them, GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+// A mesh with more vertices than 16 bits indices can address is split in chunks drawn with a base vertex
+struct index_buffer {
+	GLenum type;
+	GLsizei count;
+	std::vector<index_chunk> chunks;
+};
+
+// Fill the bound GL_ELEMENT_ARRAY_BUFFER with triangle indices, using the smallest index type
+void upload_indices(index_buffer &buffer, const GLuint *indices, GLsizei count);
+
+// Draw count indices from first, one call per chunk they cover
+void draw_indices(const index_buffer &buffer, GLsizei first, GLsizei count);
+
+// Size in bytes of an index type
+size_t index_type_size(GLenum type);
+
+// Indices of the scene
+index_buffer scene_indices;
+
+// Load an image from the disk with FreeImage, returns NULL if the image can't be read
+FIBITMAP *load_bitmap(const char *fname);
+
+// Pixels of an image ready to be given to OpenGL, either decoded by FreeImage
+// or mapped from the texture cache, rows go from the bottom to the top
+struct decoded_image {
+	FIBITMAP *bitmap;
+	void *mapping;
+	size_t mapping_size;
+	const BYTE *pixels;
+	unsigned int width;
+	unsigned int height;
+	unsigned int pitch;
+	unsigned int pixel_size;
+};
+
+// Get the pixels of an image, from the texture cache if possible, otherwise the image
+// is decoded and stored in the cache for the next runs, returns false on failure
+bool acquire_image(const char *fname, decoded_image &image);
+
+// Free the pixels obtained with acquire_image
+void release_image(decoded_image &image);
+
+// Header of a texture cache file, the pixels of each level start on a page boundary
+// so they can be given to OpenGL straight from the mapped file
+struct texture_cache_header {
+	char magic[8];
+	unsigned int version;
+	unsigned int width;
+	unsigned int height;
+	unsigned int pitch;
+	unsigned int pixel_size;
+	unsigned int levels;
+	unsigned long long source_size;
+	long long source_mtime;
+	unsigned long long source_hash;
+	unsigned long long level_offset[16];
+	unsigned long long level_size[16];
+};
+
+// Folder of the texture cache and the alignment of the pixels in its files
+const char *texture_cache_dir = "texture_cache";
+const size_t texture_cache_alignment = 4096;
+
+// Try to map the cached pixels of an image, checking that the source file didn't change
+bool open_cached_image(const char *fname, unsigned long long source_size, long long source_mtime,
+	unsigned long long source_hash, decoded_image &image);
+
+// Store the decoded pixels of an image in the texture cache
+void store_cached_image(const char *fname, unsigned long long source_size, long long source_mtime,
+	unsigned long long source_hash, const decoded_image &image);
+
+// Name of the cache file of an image
+std::string texture_cache_file(const char *fname);
+
+// 64 bits FNV-1a hash, used to key the texture cache
+unsigned long long fnv1a_hash(const unsigned char *data, size_t length, unsigned long long hash = 14695981039346656037ULL);
+
+// Texture cache statistics, printed at exit
+int texture_cache_hits = 0;
+int texture_cache_misses = 0;
+
+int main (int argc, char **argv) {
+	for(int i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "--planar") == 0) {
+			interleaved_vertices = false;
+		}
+	}
+
 	// Initialize GLFW
 	if ( !glfwInit()) {
 		std::cerr << "Failed to initialize GLFW! I'm out!" << std::endl;
@@ -100,6 +266,8 @@ int main () {
 	// Terminate GLFW
 	glfwTerminate();
 
+	std::cout << "Texture cache: " << texture_cache_hits << " hits, " << texture_cache_misses << " misses" << std::endl;
+
 	return 0;
 }
 
@@ -108,7 +276,7 @@ void display(GLuint &vao) {
 	glClear(GL_COLOR_BUFFER_BIT);
 
 	glBindVertexArray(vao);
-	glDrawElements( GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	draw_indices(scene_indices, 0, scene_indices.count);
 
 	// Swap front and back buffers
 	glfwSwapBuffers();
@@ -143,15 +311,14 @@ void initialize(GLuint &vao) {
 	GLuint vbo;
 	glGenBuffers(1, &vbo);
 
-	// Allocate space for vertex positions and texture coordinates
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices_position) + sizeof(texture_coord), NULL, GL_STATIC_DRAW);
-
-	// Transfer the vertex positions:
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices_position), vertices_position);
+	// Describe the vertices, the stride and offsets of the attributes follow from the layout
+	vertex_layout layout;
+	add_vertex_attribute(layout, "position", 2, vertices_position);
+	add_vertex_attribute(layout, "texture_coord", 2, texture_coord);
 
-	// Transfer the texture coordinates:
-	glBufferSubData(GL_ARRAY_BUFFER, sizeof(vertices_position), sizeof(texture_coord), texture_coord);
+	// Transfer the vertex positions and texture coordinates
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	upload_vertices(layout, sizeof(vertices_position) / (2 * sizeof(GLfloat)), interleaved_vertices);
 
 	// Create an Element Array Buffer that will store the indices array:
 	GLuint eab;
@@ -159,7 +326,7 @@ void initialize(GLuint &vao) {
 
 	// Transfer the data from indices to eab
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eab);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	upload_indices(scene_indices, indices, sizeof(indices) / sizeof(GLuint));
 
 	// Create a texture
 	GLuint texture;
@@ -168,6 +335,15 @@ void initialize(GLuint &vao) {
 	// Specify that we work with a 2D texture
 	glBindTexture(GL_TEXTURE_2D, texture);
 
+	// Create the samplers of all the wrapping modes up front, switching is then a single bind
+	use_samplers = GLEW_ARB_sampler_objects != GL_FALSE;
+	if(use_samplers) {
+		for(size_t i = 0; i < sizeof(wrap_modes) / sizeof(wrap_modes[0]); ++i) {
+			sampler_state state = { wrap_modes[i], GL_LINEAR, GL_LINEAR };
+			get_sampler(state);
+		}
+	}
+
 	load_image("squirrel.jpg");
 
 	GLuint shaderProgram = create_program("shaders/vert.shader", "shaders/frag.shader");
@@ -175,16 +351,12 @@ void initialize(GLuint &vao) {
 	// Get the location of the attributes that enters in the vertex shader
 	GLint position_attribute = glGetAttribLocation(shaderProgram, "position");
 
-	// Specify how the data for position can be accessed
-	glVertexAttribPointer(position_attribute, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-	// Enable the attribute
-	glEnableVertexAttribArray(position_attribute);
+	// Specify how the data for position can be accessed, and enable the attribute
+	enable_vertex_attribute(layout, "position", position_attribute);
 
 	// Texture coord attribute
 	GLint texture_coord_attribute = glGetAttribLocation(shaderProgram, "texture_coord");
-	glVertexAttribPointer(texture_coord_attribute, 2, GL_FLOAT, GL_FALSE, 0, (GLvoid *)sizeof(vertices_position));
-	glEnableVertexAttribArray(texture_coord_attribute);
+	enable_vertex_attribute(layout, "texture_coord", texture_coord_attribute);
 
 }
 
@@ -195,31 +367,16 @@ void load_image(const char *fname) {
 		FreeImage_Initialise();
 	#endif
 
-	FIBITMAP *bitmap;
-	// Get the format of the image file
-	FREE_IMAGE_FORMAT fif =FreeImage_GetFileType(fname, 0);
+	decoded_image image;
 
-	// If the format can't be determined, try to guess the format from the file name
-	if(fif == FIF_UNKNOWN) {
-		fif = FreeImage_GetFIFFromFilename(fname);
-	}
+	// PROCESS IMAGE if the pixels were successfully obtained
+	if(acquire_image(fname, image)) {
+		unsigned int w = image.width;
+		unsigned int h = image.height;
+		unsigned pixel_size = image.pixel_size;
 
-	// Load the data in bitmap if possible
-	if(fif != FIF_UNKNOWN && FreeImage_FIFSupportsReading(fif)) {
-		bitmap = FreeImage_Load(fif, fname);
-	}
-	else {
-		bitmap = NULL;
-	}
-
-	// PROCESS IMAGE if bitmap was successfully initialized
-	if(bitmap) {
-		unsigned int w = FreeImage_GetWidth(bitmap);
-		unsigned int h = FreeImage_GetHeight(bitmap);
-		unsigned pixel_size = FreeImage_GetBPP(bitmap);
-
-		// Get a pointer to the pixel data
-		BYTE *data = (BYTE*)FreeImage_GetBits(bitmap);
+		// Get a pointer to the pixel data, decoded or mapped from the cache
+		const BYTE *data = image.pixels;
 
 		// Process only RGB and RGBA images
 		if(pixel_size == 24) {
@@ -244,7 +401,7 @@ void load_image(const char *fname) {
 	}
 
 	// Clean bitmap;
-	FreeImage_Unload(bitmap);
+	release_image(image);
 
 	// active only for static linking
 	#ifdef FREEIMAGE_LIB
@@ -252,29 +409,366 @@ void load_image(const char *fname) {
 	#endif	
 }
 
+// The sampler bound to the texture unit overrides the sampling parameters of the texture,
+// which stays untouched and complete
 void wrap_tests() {
-		if (wrap_option == 0) {
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-			std::cout << "Using GL_REPEAT" << std::endl;
+		if(use_samplers) {
+			sampler_state state = { wrap_modes[wrap_option], GL_LINEAR, GL_LINEAR };
+			glBindSampler(0, get_sampler(state));
+		}
+		else {
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap_modes[wrap_option]);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap_modes[wrap_option]);
+		}
+		std::cout << "Using " << wrap_mode_names[wrap_option] << std::endl;
+}
+
+// Get the sampler object for a combination of parameters, created the first time it is asked for
+GLuint get_sampler(const sampler_state &state) {
+	std::map<sampler_state, GLuint>::iterator it = sampler_cache.find(state);
+	if(it != sampler_cache.end()) {
+		return it->second;
+	}
+
+	GLuint sampler;
+	glGenSamplers(1, &sampler);
+	glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, state.wrap);
+	glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, state.wrap);
+	glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, state.min_filter);
+	glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, state.mag_filter);
+	sampler_cache[state] = sampler;
+	return sampler;
+}
+
+
+// Add an attribute to a layout, its data must stay valid until the vertices are uploaded
+void add_vertex_attribute(vertex_layout &layout, const char *name, GLint size, const GLfloat *data) {
+	vertex_attribute attribute = { name, size, data, 0 };
+	layout.attributes.push_back(attribute);
+}
+
+// Compute the stride and the offsets of the attributes, then fill the bound GL_ARRAY_BUFFER with the vertices
+// Interleaved, the stride is the size of a whole vertex and an attribute starts at the sum of the sizes before it,
+// planar, each attribute is a tightly packed block of vertex_count values
+void upload_vertices(vertex_layout &layout, GLsizei vertex_count, bool interleaved) {
+	layout.vertex_count = vertex_count;
+	layout.interleaved = interleaved;
+	size_t vertex_size = 0;
+	for(size_t i = 0; i < layout.attributes.size(); ++i) {
+		layout.attributes[i].offset = interleaved ? vertex_size : vertex_size * vertex_count;
+		vertex_size += layout.attributes[i].size * sizeof(GLfloat);
+	}
+	layout.stride = interleaved ? (GLsizei)vertex_size : 0;
+
+	// The vertices are written straight in the buffer, without an intermediate copy
+	GLsizeiptr size = (GLsizeiptr)(vertex_size * vertex_count);
+	glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STATIC_DRAW);
+	unsigned char *dst = (unsigned char *)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	for(size_t i = 0; i < layout.attributes.size(); ++i) {
+		const vertex_attribute &attribute = layout.attributes[i];
+		size_t attribute_size = attribute.size * sizeof(GLfloat);
+		if(interleaved) {
+			for(GLsizei v = 0; v < vertex_count; ++v) {
+				memcpy(dst + attribute.offset + v * vertex_size, attribute.data + (size_t)v * attribute.size, attribute_size);
+			}
+		}
+		else {
+			memcpy(dst + attribute.offset, attribute.data, attribute_size * vertex_count);
+		}
+	}
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+}
+
+// Point an attribute location to an attribute of the uploaded vertices and enable it
+void enable_vertex_attribute(const vertex_layout &layout, const char *name, GLint location) {
+	for(size_t i = 0; i < layout.attributes.size(); ++i) {
+		const vertex_attribute &attribute = layout.attributes[i];
+		if(strcmp(attribute.name, name) == 0) {
+			glVertexAttribPointer(location, attribute.size, GL_FLOAT, GL_FALSE, layout.stride, (GLvoid *)attribute.offset);
+			glEnableVertexAttribArray(location);
+			return;
+		}
+	}
+	std::cerr << "The vertex layout has no attribute " << name << " I'm out!" << std::endl;
+	exit(-1);
+}
+
+// Fill the bound GL_ELEMENT_ARRAY_BUFFER with triangle indices, using the smallest index type
+// Up to 65536 vertices the indices are stored as they are, in bytes or shorts. Past that, the triangles are
+// split in chunks whose vertices are within 65536 of the chunk base vertex, each chunk is a draw. A triangle
+// spanning more than that can't be split, the mesh then keeps 32 bits indices
+void upload_indices(index_buffer &buffer, const GLuint *indices, GLsizei count) {
+	GLuint max_index = 0;
+	for(GLsizei i = 0; i < count; ++i) {
+		max_index = std::max(max_index, indices[i]);
+	}
+	buffer.count = count;
+	buffer.chunks.clear();
+	buffer.type = max_index <= 0xFF ? GL_UNSIGNED_BYTE : max_index <= 0xFFFF ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+	if(buffer.type == GL_UNSIGNED_INT) {
+		// A chunk starts at the lowest vertex of its first triangle and ends with the first triangle out of range
+		buffer.type = GL_UNSIGNED_SHORT;
+		index_chunk chunk = { 0, 0, 0 };
+		for(GLsizei i = 0; i + 2 < count; i += 3) {
+			GLuint low = std::min(indices[i], std::min(indices[i + 1], indices[i + 2]));
+			GLuint high = std::max(indices[i], std::max(indices[i + 1], indices[i + 2]));
+			if(high - low > 0xFFFF) {
+				buffer.type = GL_UNSIGNED_INT;
+				buffer.chunks.clear();
+				break;
+			}
+			if(chunk.count == 0 || low < (GLuint)chunk.base_vertex || high - chunk.base_vertex > 0xFFFF) {
+				if(chunk.count > 0) {
+					buffer.chunks.push_back(chunk);
+				}
+				chunk.first = i;
+				chunk.count = 0;
+				chunk.base_vertex = (GLint)low;
+			}
+			chunk.count += 3;
+		}
+		if(buffer.type == GL_UNSIGNED_SHORT && chunk.count > 0) {
+			buffer.chunks.push_back(chunk);
+		}
+	}
+	if(buffer.chunks.empty()) {
+		index_chunk chunk = { 0, count, 0 };
+		buffer.chunks.push_back(chunk);
+	}
+
+	// Write the indices relative to their chunk, straight in the buffer
+	size_t size = index_type_size(buffer.type);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * size, NULL, GL_STATIC_DRAW);
+	unsigned char *dst = (unsigned char *)glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, count * size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	for(size_t c = 0; c < buffer.chunks.size(); ++c) {
+		const index_chunk &chunk = buffer.chunks[c];
+		for(GLsizei i = chunk.first; i < chunk.first + chunk.count; ++i) {
+			GLuint index = indices[i] - chunk.base_vertex;
+			if(buffer.type == GL_UNSIGNED_BYTE) {
+				dst[i] = (GLubyte)index;
+			}
+			else if(buffer.type == GL_UNSIGNED_SHORT) {
+				((GLushort *)dst)[i] = (GLushort)index;
+			}
+			else {
+				((GLuint *)dst)[i] = index;
+			}
+		}
+	}
+	glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+}
+
+// Draw count indices from first, one call per chunk they cover
+// The base vertex draws are core from OpenGL 3.2, the chunk at the start of the mesh doesn't need one
+void draw_indices(const index_buffer &buffer, GLsizei first, GLsizei count) {
+	size_t size = index_type_size(buffer.type);
+	for(size_t c = 0; c < buffer.chunks.size(); ++c) {
+		const index_chunk &chunk = buffer.chunks[c];
+		GLsizei begin = std::max(first, chunk.first);
+		GLsizei end = std::min(first + count, chunk.first + chunk.count);
+		if(begin >= end) {
+			continue;
+		}
+		const GLvoid *offset = (const GLvoid *)(begin * size);
+		if(chunk.base_vertex == 0) {
+			glDrawElements(GL_TRIANGLES, end - begin, buffer.type, offset);
+		}
+		else {
+			glDrawElementsBaseVertex(GL_TRIANGLES, end - begin, buffer.type, offset, chunk.base_vertex);
+		}
+	}
+}
+
+// Size in bytes of an index type
+size_t index_type_size(GLenum type) {
+	return type == GL_UNSIGNED_BYTE ? 1 : type == GL_UNSIGNED_SHORT ? 2 : 4;
+}
+
+// Load an image from the disk with FreeImage, returns NULL if the image can't be read
+FIBITMAP *load_bitmap(const char *fname) {
+	// Get the format of the image file
+	FREE_IMAGE_FORMAT fif =FreeImage_GetFileType(fname, 0);
+
+	// If the format can't be determined, try to guess the format from the file name
+	if(fif == FIF_UNKNOWN) {
+		fif = FreeImage_GetFIFFromFilename(fname);
+	}
+
+	// Load the data in bitmap if possible
+	if(fif != FIF_UNKNOWN && FreeImage_FIFSupportsReading(fif)) {
+		return FreeImage_Load(fif, fname);
+	}
+	return NULL;
+}
+
+// Get the pixels of an image, from the texture cache if possible, otherwise the image
+// is decoded and stored in the cache for the next runs, returns false on failure
+bool acquire_image(const char *fname, decoded_image &image) {
+	image.bitmap = NULL;
+	image.mapping = NULL;
+	image.mapping_size = 0;
+	image.pixels = NULL;
+
+	#ifndef _WIN32
+		// The cache entry is valid for the same file size, modification time and content
+		unsigned long long source_size = 0, source_hash = 0;
+		long long source_mtime = 0;
+		bool use_cache = false;
+		int fd = open(fname, O_RDONLY);
+		if(fd >= 0) {
+			struct stat info;
+			if(fstat(fd, &info) == 0 && info.st_size > 0) {
+				source_size = (unsigned long long)info.st_size;
+				source_mtime = (long long)info.st_mtime;
+				void *source = mmap(NULL, (size_t)source_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if(source != MAP_FAILED) {
+					source_hash = fnv1a_hash((const unsigned char *)source, (size_t)source_size);
+					munmap(source, (size_t)source_size);
+					use_cache = true;
+				}
+			}
+			close(fd);
 		}
-		else if(wrap_option == 1) {
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-			std::cout << "Using GL_CLAMP_TO_EDGE" << std::endl;
+
+		if(use_cache && open_cached_image(fname, source_size, source_mtime, source_hash, image)) {
+			texture_cache_hits++;
+			return true;
 		}
-		else if(wrap_option == 2) {
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-			std::cout << "Using GL_CLAMP_TO_BORDER" << std::endl;
+		texture_cache_misses++;
+	#endif
+
+	image.bitmap = load_bitmap(fname);
+	if(!image.bitmap) {
+		return false;
+	}
+	image.width = FreeImage_GetWidth(image.bitmap);
+	image.height = FreeImage_GetHeight(image.bitmap);
+	image.pitch = FreeImage_GetPitch(image.bitmap);
+	image.pixel_size = FreeImage_GetBPP(image.bitmap);
+	image.pixels = FreeImage_GetBits(image.bitmap);
+
+	#ifndef _WIN32
+		if(use_cache) {
+			store_cached_image(fname, source_size, source_mtime, source_hash, image);
 		}
-		else if(wrap_option == 3) {
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-			std::cout << "Using GL_MIRRORED_REPEAT" << std::endl;
-		}	
+	#endif
+	return true;
+}
+
+// Free the pixels obtained with acquire_image
+void release_image(decoded_image &image) {
+	if(image.bitmap) {
+		FreeImage_Unload(image.bitmap);
+	}
+	#ifndef _WIN32
+		if(image.mapping) {
+			munmap(image.mapping, image.mapping_size);
+		}
+	#endif
+	image.bitmap = NULL;
+	image.mapping = NULL;
+	image.pixels = NULL;
+}
+
+// Name of the cache file of an image
+std::string texture_cache_file(const char *fname) {
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.tex", fnv1a_hash((const unsigned char *)fname, strlen(fname)));
+	return std::string(texture_cache_dir) + "/" + name;
 }
 
+// Try to map the cached pixels of an image, checking that the source file didn't change
+bool open_cached_image(const char *fname, unsigned long long source_size, long long source_mtime,
+	unsigned long long source_hash, decoded_image &image) {
+	#ifdef _WIN32
+		return false;
+	#else
+		std::string cache_file = texture_cache_file(fname);
+		int fd = open(cache_file.c_str(), O_RDONLY);
+		if(fd < 0) {
+			return false;
+		}
+		struct stat info;
+		if(fstat(fd, &info) != 0 || (size_t)info.st_size < texture_cache_alignment) {
+			close(fd);
+			return false;
+		}
+		size_t size = (size_t)info.st_size;
+		void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(mapping == MAP_FAILED) {
+			return false;
+		}
+
+		const texture_cache_header *header = (const texture_cache_header *)mapping;
+		if(memcmp(header->magic, "TEXCACHE", 8) != 0 || header->version != 1 || header->levels < 1 ||
+			header->source_size != source_size || header->source_mtime != source_mtime || header->source_hash != source_hash ||
+			header->level_offset[0] + header->level_size[0] > size ||
+			header->level_size[0] != (unsigned long long)header->pitch * header->height) {
+			munmap(mapping, size);
+			return false;
+		}
+
+		image.mapping = mapping;
+		image.mapping_size = size;
+		image.width = header->width;
+		image.height = header->height;
+		image.pitch = header->pitch;
+		image.pixel_size = header->pixel_size;
+		image.pixels = (const BYTE *)mapping + header->level_offset[0];
+		return true;
+	#endif
+}
+
+// Store the decoded pixels of an image in the texture cache
+// The file is written under a temporary name then renamed, so a reader never sees half of it
+void store_cached_image(const char *fname, unsigned long long source_size, long long source_mtime,
+	unsigned long long source_hash, const decoded_image &image) {
+	#ifndef _WIN32
+		mkdir(texture_cache_dir, 0755);
+
+		std::vector<char> header_page(texture_cache_alignment, 0);
+		texture_cache_header *header = (texture_cache_header *)&header_page[0];
+		memcpy(header->magic, "TEXCACHE", 8);
+		header->version = 1;
+		header->width = image.width;
+		header->height = image.height;
+		header->pitch = image.pitch;
+		header->pixel_size = image.pixel_size;
+		header->levels = 1;
+		header->source_size = source_size;
+		header->source_mtime = source_mtime;
+		header->source_hash = source_hash;
+		header->level_offset[0] = texture_cache_alignment;
+		header->level_size[0] = (unsigned long long)image.pitch * image.height;
+
+		std::string cache_file = texture_cache_file(fname);
+		std::string temp_file = cache_file + ".tmp";
+		std::ofstream out(temp_file.c_str(), std::ios::binary);
+		if(!out.is_open()) {
+			std::cerr << "Unable to write the texture cache file " << cache_file << std::endl;
+			return;
+		}
+		out.write(&header_page[0], header_page.size());
+		out.write((const char *)image.pixels, (std::streamsize)header->level_size[0]);
+		out.close();
+		if(!out || rename(temp_file.c_str(), cache_file.c_str()) != 0) {
+			std::cerr << "Unable to write the texture cache file " << cache_file << std::endl;
+			remove(temp_file.c_str());
+		}
+	#endif
+}
+
+// 64 bits FNV-1a hash, used to key the texture cache
+unsigned long long fnv1a_hash(const unsigned char *data, size_t length, unsigned long long hash) {
+	for(size_t i = 0; i < length; ++i) {
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
 
 // Called when the window is resized
 void GLFWCALL window_resized(int width, int height) {
@@ -0,0 +1,698 @@
+// Draw many small images packed in a texture atlas, with one draw call per atlas page
+#include <GL/glew.h>
+#include <GL/glfw.h>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+//#include <ctime>
+#include <FreeImage.h>
+
+// Read a shader source from a file
+// store the shader source in a std::vector<char>
+void read_shader_src(const char *fname, std::vector<char> &buffer);
+
+// Compile a shader
+GLuint load_and_compile_shader(const char *fname, GLenum shaderType);
+
+// Create a program from two shaders
+GLuint create_program(const char *path_vert_shader, const char *path_frag_shader);
+
+// Called when the window is resized
+void GLFWCALL window_resized(int width, int height);
+
+// Called for keyboard events
+void keyboard(int key, int action);
+
+// Render scene
+void display(GLuint &vao);
+
+// Initialize the data to be rendered
+void initialize(GLuint &vao);
+
+// Load an image from the disk with FreeImage, returns NULL if the image can't be read
+FIBITMAP *load_bitmap(const char *fname);
+
+// Place of an image in an atlas, in pixels without the gutter, and as texture coordinates
+struct atlas_rect {
+	int page;
+	unsigned int x, y;
+	unsigned int width, height;
+	float u0, v0, u1, v1;
+};
+
+// Images packed in one or more textures, the pages
+// Each image is surrounded by a gutter of repeated edge pixels and starts on a multiple of the gutter,
+// so the images don't bleed into each other for the mip levels up to log2(gutter)
+struct texture_atlas {
+	unsigned int page_width;
+	unsigned int page_height;
+	unsigned int gutter;
+	std::vector<GLuint> pages;
+	std::vector<atlas_rect> rects;
+	double occupancy;
+};
+
+// A horizontal segment of the skyline, the top of the space used so far on a page
+struct skyline_segment {
+	unsigned int x, y;
+	unsigned int width;
+};
+
+// Pack RGB or RGBA images in atlas pages of the given size, the gutter must be a power of two
+// The rects of the atlas are in the same order as the images
+void build_atlas(const std::vector<FIBITMAP *> &images, unsigned int page_size, unsigned int gutter, texture_atlas &atlas);
+
+// Find the lowest place, then the leftmost, where a rectangle fits on the skyline and add it to the skyline
+// Returns false if the rectangle doesn't fit on the page
+bool skyline_insert(std::vector<skyline_segment> &skyline, unsigned int page_width, unsigned int page_height,
+	unsigned int width, unsigned int height, unsigned int &x, unsigned int &y);
+
+// Copy an image in a BGRA page, with its gutter
+void copy_with_gutter(FIBITMAP *image, std::vector<BYTE> &page, unsigned int page_width, const atlas_rect &rect, unsigned int gutter);
+
+// Make small images out of the squirrel, when no image files are given on the command line
+void make_thumbnails(const char *fname, int count, std::vector<FIBITMAP *> &images);
+
+// Image files given on the command line
+std::vector<const char *> image_files;
+
+// The atlas of the scene and the number of indices drawn from each of its pages
+texture_atlas scene_atlas;
+std::vector<GLsizei> page_index_counts;
+
+// A run of triangle indices drawn with one call, its indices are stored relative to base_vertex
+struct index_chunk {
+	GLsizei first;
+	GLsizei count;
+	GLint base_vertex;
+};
+
+// Indices stored with the smallest type that holds them, GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+// A mesh with more vertices than 16 bits indices can address is split in chunks drawn with a base vertex
+struct index_buffer {
+	GLenum type;
+	GLsizei count;
+	std::vector<index_chunk> chunks;
+};
+
+// Fill the bound GL_ELEMENT_ARRAY_BUFFER with triangle indices, using the smallest index type
+void upload_indices(index_buffer &buffer, const GLuint *indices, GLsizei count);
+
+// Draw count indices from first, one call per chunk they cover
+void draw_indices(const index_buffer &buffer, GLsizei first, GLsizei count);
+
+// Size in bytes of an index type
+size_t index_type_size(GLenum type);
+
+// Indices of the scene
+index_buffer scene_indices;
+
+int main (int argc, char **argv) {
+	for(int i = 1; i < argc; ++i) {
+		image_files.push_back(argv[i]);
+	}
+
+	// Initialize GLFW
+	if ( !glfwInit()) {
+		std::cerr << "Failed to initialize GLFW! I'm out!" << std::endl;
+		exit(-1);
+	}
+
+	// Use OpenGL 3.2 core profile
+	glfwOpenWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwOpenWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwOpenWindowHint(GLFW_OPENGL_VERSION_MAJOR, 3);
+	glfwOpenWindowHint(GLFW_OPENGL_VERSION_MINOR, 2);
+
+	// Open a window and attach an OpenGL rendering context to the window surface
+	if( !glfwOpenWindow(800, 600, 8, 8, 8, 0, 0, 0, GLFW_WINDOW)) {
+		std::cerr << "Failed to open a window! I'm out!" << std::endl;
+		glfwTerminate();
+		exit(-1);
+	}
+
+	// Register a callback function for window resize events
+	glfwSetWindowSizeCallback( window_resized );
+
+	// Register a callback function for keyboard pressed events
+	glfwSetKeyCallback(keyboard);	
+
+	// Print the OpenGL version
+	int major, minor, rev;
+	glfwGetGLVersion(&major, &minor, &rev);
+	std::cout << "OpenGL - " << major << "." << minor << "." << rev << std::endl;
+
+	// Initialize GLEW
+	glewExperimental = GL_TRUE;
+	if(glewInit() != GLEW_OK) {
+		std::cerr << "Failed to initialize GLEW! I'm out!" << std::endl;
+		glfwTerminate();
+		exit(-1);
+	}
+
+	// Create a vertex array object
+	GLuint vao;
+
+	// Initialize the data to be rendered
+	initialize(vao);
+
+	// Create a rendering loop
+	int running = GL_TRUE;
+
+	while(running) {
+		// Display scene
+		display(vao);
+
+		// Pool for events
+		glfwPollEvents();
+		// Check if the window was closed
+		running = glfwGetWindowParam(GLFW_OPENED);
+	}
+
+	// Terminate GLFW
+	glfwTerminate();
+
+	return 0;
+}
+
+// Render scene
+// The quads of each page are consecutive in the index buffer, one bind and one draw per page
+void display(GLuint &vao) {
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	glBindVertexArray(vao);
+	GLsizei first = 0;
+	for(size_t page = 0; page < scene_atlas.pages.size(); ++page) {
+		glBindTexture(GL_TEXTURE_2D, scene_atlas.pages[page]);
+		draw_indices(scene_indices, first, page_index_counts[page]);
+		first += page_index_counts[page];
+	}
+
+	// Swap front and back buffers
+	glfwSwapBuffers();
+}
+
+void initialize(GLuint &vao) {
+	// Use a Vertex Array Object
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+
+	// active only for static linking
+	#ifdef FREEIMAGE_LIB
+		FreeImage_Initialise();
+	#endif
+
+	// Load the images and pack them
+	std::vector<FIBITMAP *> images;
+	if(image_files.empty()) {
+		make_thumbnails("squirrel.jpg", 400, images);
+	}
+	else {
+		for(size_t i = 0; i < image_files.size(); ++i) {
+			FIBITMAP *bitmap = load_bitmap(image_files[i]);
+			if(!bitmap) {
+				std::cerr << "Unable to load the image file " << image_files[i]  << " I'm out!" << std::endl;
+				exit(-1);
+			}
+			images.push_back(bitmap);
+		}
+	}
+
+	GLint max_size;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+	build_atlas(images, std::min(1024, (int)max_size), 4, scene_atlas);
+	std::cout << images.size() << " images packed in " << scene_atlas.pages.size() << " pages of " << scene_atlas.page_width << "x" <<
+		scene_atlas.page_height << ", " << scene_atlas.occupancy * 100.0 << "% used, " << scene_atlas.pages.size() << " draw calls" << std::endl;
+
+	// Lay the images out on a grid, each one keeps its aspect ratio in its cell
+	// The quads are sorted by page, so each page is a contiguous range of indices
+	int columns = 1;
+	while(columns * columns * 3 < (int)images.size() * 4) {
+		columns++;
+	}
+	int rows = ((int)images.size() + columns - 1) / columns;
+	float cell_width = 2.0f / columns, cell_height = 2.0f / rows;
+
+	std::vector<GLfloat> vertices;
+	std::vector<GLuint> indices;
+	page_index_counts.assign(scene_atlas.pages.size(), 0);
+	int cell = 0;
+	for(size_t page = 0; page < scene_atlas.pages.size(); ++page) {
+		for(size_t i = 0; i < scene_atlas.rects.size(); ++i) {
+			const atlas_rect &rect = scene_atlas.rects[i];
+			if(rect.page != (int)page) {
+				continue;
+			}
+			float x = -1.0f + (cell % columns) * cell_width;
+			float y = 1.0f - (cell / columns + 1) * cell_height;
+			float scale = 0.9f * std::min(cell_width * 400.0f / rect.width, cell_height * 300.0f / rect.height);
+			float w = rect.width * scale / 400.0f, h = rect.height * scale / 300.0f;
+			x += (cell_width - w) / 2;
+			y += (cell_height - h) / 2;
+			cell++;
+
+			// Position and texture coordinates of the 4 corners
+			GLfloat quad[16] = {
+				x, y, rect.u0, rect.v0,
+				x + w, y, rect.u1, rect.v0,
+				x + w, y + h, rect.u1, rect.v1,
+				x, y + h, rect.u0, rect.v1
+			};
+			GLuint first = (GLuint)(vertices.size() / 4);
+			vertices.insert(vertices.end(), quad, quad + 16);
+			GLuint quad_indices[6] = {first, first + 1, first + 2, first + 2, first + 3, first};
+			indices.insert(indices.end(), quad_indices, quad_indices + 6);
+			page_index_counts[page] += 6;
+		}
+	}
+
+	for(size_t i = 0; i < images.size(); ++i) {
+		FreeImage_Unload(images[i]);
+	}
+
+	// active only for static linking
+	#ifdef FREEIMAGE_LIB
+		FreeImage_DeInitialise();
+	#endif
+
+	// Create a Vector Buffer Object that will store the vertices on video memory
+	// The positions and texture coordinates are interleaved
+	GLuint vbo;
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), &vertices[0], GL_STATIC_DRAW);
+
+	// Create an Element Array Buffer that will store the indices array:
+	GLuint eab;
+	glGenBuffers(1, &eab);
+
+	// Transfer the data from indices to eab
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eab);
+	upload_indices(scene_indices, &indices[0], (GLsizei)indices.size());
+
+	GLuint shaderProgram = create_program("shaders/vert.shader", "shaders/frag.shader");
+
+	// Get the location of the attributes that enters in the vertex shader
+	GLint position_attribute = glGetAttribLocation(shaderProgram, "position");
+
+	// Specify how the data for position can be accessed
+	glVertexAttribPointer(position_attribute, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
+
+	// Enable the attribute
+	glEnableVertexAttribArray(position_attribute);
+
+	// Texture coord attribute
+	GLint texture_coord_attribute = glGetAttribLocation(shaderProgram, "texture_coord");
+	glVertexAttribPointer(texture_coord_attribute, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (GLvoid *)(2 * sizeof(GLfloat)));
+	glEnableVertexAttribArray(texture_coord_attribute);
+
+}
+
+// Load an image from the disk with FreeImage, returns NULL if the image can't be read
+FIBITMAP *load_bitmap(const char *fname) {
+	// Get the format of the image file
+	FREE_IMAGE_FORMAT fif =FreeImage_GetFileType(fname, 0);
+
+	// If the format can't be determined, try to guess the format from the file name
+	if(fif == FIF_UNKNOWN) {
+		fif = FreeImage_GetFIFFromFilename(fname);
+	}
+
+	// Load the data in bitmap if possible
+	if(fif != FIF_UNKNOWN && FreeImage_FIFSupportsReading(fif)) {
+		return FreeImage_Load(fif, fname);
+	}
+	return NULL;
+}
+
+// Make small images out of the squirrel, when no image files are given on the command line
+// Random crops of the image are scaled to random sizes, the same ones on every run
+void make_thumbnails(const char *fname, int count, std::vector<FIBITMAP *> &images) {
+	FIBITMAP *bitmap = load_bitmap(fname);
+	if(!bitmap) {
+		std::cerr << "Unable to load the image file " << fname  << " I'm out!" << std::endl;
+		exit(-1);
+	}
+	int w = FreeImage_GetWidth(bitmap);
+	int h = FreeImage_GetHeight(bitmap);
+	srand(1);
+	for(int i = 0; i < count; ++i) {
+		int crop_width = w / 4 + rand() % (w * 3 / 4);
+		int crop_height = h / 4 + rand() % (h * 3 / 4);
+		int left = rand() % (w - crop_width + 1);
+		int top = rand() % (h - crop_height + 1);
+		FIBITMAP *crop = FreeImage_Copy(bitmap, left, top, left + crop_width, top + crop_height);
+		int size = 16 + rand() % 81;
+		int thumb_width = std::max(1, crop_width >= crop_height ? size : size * crop_width / crop_height);
+		int thumb_height = std::max(1, crop_height >= crop_width ? size : size * crop_height / crop_width);
+		images.push_back(FreeImage_Rescale(crop, thumb_width, thumb_height, FILTER_BILINEAR));
+		FreeImage_Unload(crop);
+	}
+	FreeImage_Unload(bitmap);
+}
+
+// Pack RGB or RGBA images in atlas pages of the given size, the gutter must be a power of two
+// The images are placed from the tallest to the shortest with a skyline packer, a new page is
+// started when an image doesn't fit on the current one
+void build_atlas(const std::vector<FIBITMAP *> &images, unsigned int page_size, unsigned int gutter, texture_atlas &atlas) {
+	atlas.page_width = page_size;
+	atlas.page_height = page_size;
+	atlas.gutter = gutter;
+	atlas.rects.resize(images.size());
+
+	std::vector<size_t> order(images.size());
+	for(size_t i = 0; i < order.size(); ++i) {
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&images](size_t a, size_t b) {
+		return FreeImage_GetHeight(images[a]) > FreeImage_GetHeight(images[b]);
+	});
+
+	// Each image takes its size plus the gutter on both sides, rounded up to a multiple of the gutter
+	std::vector<skyline_segment> skyline;
+	int page = -1;
+	unsigned long long used = 0;
+	for(size_t i = 0; i < order.size(); ++i) {
+		FIBITMAP *image = images[order[i]];
+		atlas_rect &rect = atlas.rects[order[i]];
+		rect.width = FreeImage_GetWidth(image);
+		rect.height = FreeImage_GetHeight(image);
+		unsigned int width = (rect.width + 3 * gutter - 1) / gutter * gutter;
+		unsigned int height = (rect.height + 3 * gutter - 1) / gutter * gutter;
+		if(width > page_size || height > page_size) {
+			std::cerr << "An image of " << rect.width << "x" << rect.height << " doesn't fit in the atlas pages. I'm out!" << std::endl;
+			exit(-1);
+		}
+
+		unsigned int x, y;
+		if(page < 0 || !skyline_insert(skyline, page_size, page_size, width, height, x, y)) {
+			page++;
+			skyline.assign(1, skyline_segment());
+			skyline[0].x = skyline[0].y = 0;
+			skyline[0].width = page_size;
+			skyline_insert(skyline, page_size, page_size, width, height, x, y);
+		}
+		rect.page = page;
+		rect.x = x + gutter;
+		rect.y = y + gutter;
+		rect.u0 = (float)rect.x / page_size;
+		rect.v0 = (float)rect.y / page_size;
+		rect.u1 = (float)(rect.x + rect.width) / page_size;
+		rect.v1 = (float)(rect.y + rect.height) / page_size;
+		used += (unsigned long long)rect.width * rect.height;
+	}
+	atlas.occupancy = (double)used / ((double)(page + 1) * page_size * page_size);
+
+	// Fill the pages, then let OpenGL build the mip levels the gutter protects
+	int max_level = 0;
+	while((2u << max_level) <= gutter) {
+		max_level++;
+	}
+	atlas.pages.resize(page + 1);
+	glGenTextures((GLsizei)atlas.pages.size(), &atlas.pages[0]);
+	std::vector<BYTE> pixels((size_t)page_size * page_size * 4);
+	for(int p = 0; p <= page; ++p) {
+		std::fill(pixels.begin(), pixels.end(), 0);
+		for(size_t i = 0; i < images.size(); ++i) {
+			if(atlas.rects[i].page == p) {
+				copy_with_gutter(images[i], pixels, page_size, atlas.rects[i], gutter);
+			}
+		}
+		glBindTexture(GL_TEXTURE_2D, atlas.pages[p]);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, page_size, page_size, 0, GL_BGRA, GL_UNSIGNED_BYTE, (GLvoid*)&pixels[0]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, max_level);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, max_level > 0 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+}
+
+// Find the lowest place, then the leftmost, where a rectangle fits on the skyline and add it to the skyline
+// Returns false if the rectangle doesn't fit on the page
+bool skyline_insert(std::vector<skyline_segment> &skyline, unsigned int page_width, unsigned int page_height,
+	unsigned int width, unsigned int height, unsigned int &x, unsigned int &y) {
+	size_t best = skyline.size();
+	unsigned int best_y = page_height;
+	for(size_t i = 0; i < skyline.size(); ++i) {
+		if(skyline[i].x + width > page_width) {
+			break;
+		}
+		// The rectangle rests on the highest segment it spans
+		unsigned int top = 0, covered = 0;
+		for(size_t j = i; j < skyline.size() && covered < width; ++j) {
+			top = std::max(top, skyline[j].y);
+			covered += skyline[j].width;
+		}
+		if(top + height <= page_height && top < best_y) {
+			best = i;
+			best_y = top;
+		}
+	}
+	if(best == skyline.size()) {
+		return false;
+	}
+	x = skyline[best].x;
+	y = best_y;
+
+	// The new segment replaces the ones under the rectangle, the last one may be cut
+	skyline_segment segment = { x, y + height, width };
+	size_t end = best;
+	while(end < skyline.size() && skyline[end].x + skyline[end].width <= x + width) {
+		end++;
+	}
+	if(end < skyline.size() && skyline[end].x < x + width) {
+		skyline[end].width -= x + width - skyline[end].x;
+		skyline[end].x = x + width;
+	}
+	skyline.erase(skyline.begin() + best, skyline.begin() + end);
+	skyline.insert(skyline.begin() + best, segment);
+
+	// Merge the neighbours at the same height
+	for(size_t i = 0; i + 1 < skyline.size(); ) {
+		if(skyline[i].y == skyline[i + 1].y) {
+			skyline[i].width += skyline[i + 1].width;
+			skyline.erase(skyline.begin() + i + 1);
+		}
+		else {
+			++i;
+		}
+	}
+	return true;
+}
+
+// Copy an image in a BGRA page, with its gutter
+// The gutter repeats the edge pixels, so filtering across the border of the image sees its own colors
+void copy_with_gutter(FIBITMAP *image, std::vector<BYTE> &page, unsigned int page_width, const atlas_rect &rect, unsigned int gutter) {
+	unsigned int bytes = FreeImage_GetBPP(image) / 8;
+	if(bytes != 3 && bytes != 4) {
+		std::cerr << "pixel size = " << bytes * 8 << " don't know how to process this case. I'm out!" << std::endl;
+		exit(-1);
+	}
+	for(unsigned int y = 0; y < rect.height + 2 * gutter; ++y) {
+		unsigned int src_y = (unsigned int)std::min(std::max((int)y - (int)gutter, 0), (int)rect.height - 1);
+		const BYTE *src = FreeImage_GetScanLine(image, src_y);
+		BYTE *dst = &page[((size_t)(rect.y - gutter + y) * page_width + rect.x - gutter) * 4];
+		for(unsigned int x = 0; x < rect.width + 2 * gutter; ++x) {
+			unsigned int src_x = (unsigned int)std::min(std::max((int)x - (int)gutter, 0), (int)rect.width - 1);
+			const BYTE *p = src + src_x * bytes;
+			dst[x * 4] = p[FI_RGBA_BLUE];
+			dst[x * 4 + 1] = p[FI_RGBA_GREEN];
+			dst[x * 4 + 2] = p[FI_RGBA_RED];
+			dst[x * 4 + 3] = bytes == 4 ? p[FI_RGBA_ALPHA] : 255;
+		}
+	}
+}
+
+
+// Fill the bound GL_ELEMENT_ARRAY_BUFFER with triangle indices, using the smallest index type
+// Up to 65536 vertices the indices are stored as they are, in bytes or shorts. Past that, the triangles are
+// split in chunks whose vertices are within 65536 of the chunk base vertex, each chunk is a draw. A triangle
+// spanning more than that can't be split, the mesh then keeps 32 bits indices
+void upload_indices(index_buffer &buffer, const GLuint *indices, GLsizei count) {
+	GLuint max_index = 0;
+	for(GLsizei i = 0; i < count; ++i) {
+		max_index = std::max(max_index, indices[i]);
+	}
+	buffer.count = count;
+	buffer.chunks.clear();
+	buffer.type = max_index <= 0xFF ? GL_UNSIGNED_BYTE : max_index <= 0xFFFF ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+	if(buffer.type == GL_UNSIGNED_INT) {
+		// A chunk starts at the lowest vertex of its first triangle and ends with the first triangle out of range
+		buffer.type = GL_UNSIGNED_SHORT;
+		index_chunk chunk = { 0, 0, 0 };
+		for(GLsizei i = 0; i + 2 < count; i += 3) {
+			GLuint low = std::min(indices[i], std::min(indices[i + 1], indices[i + 2]));
+			GLuint high = std::max(indices[i], std::max(indices[i + 1], indices[i + 2]));
+			if(high - low > 0xFFFF) {
+				buffer.type = GL_UNSIGNED_INT;
+				buffer.chunks.clear();
+				break;
+			}
+			if(chunk.count == 0 || low < (GLuint)chunk.base_vertex || high - chunk.base_vertex > 0xFFFF) {
+				if(chunk.count > 0) {
+					buffer.chunks.push_back(chunk);
+				}
+				chunk.first = i;
+				chunk.count = 0;
+				chunk.base_vertex = (GLint)low;
+			}
+			chunk.count += 3;
+		}
+		if(buffer.type == GL_UNSIGNED_SHORT && chunk.count > 0) {
+			buffer.chunks.push_back(chunk);
+		}
+	}
+	if(buffer.chunks.empty()) {
+		index_chunk chunk = { 0, count, 0 };
+		buffer.chunks.push_back(chunk);
+	}
+
+	// Write the indices relative to their chunk, straight in the buffer
+	size_t size = index_type_size(buffer.type);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * size, NULL, GL_STATIC_DRAW);
+	unsigned char *dst = (unsigned char *)glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, count * size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	for(size_t c = 0; c < buffer.chunks.size(); ++c) {
+		const index_chunk &chunk = buffer.chunks[c];
+		for(GLsizei i = chunk.first; i < chunk.first + chunk.count; ++i) {
+			GLuint index = indices[i] - chunk.base_vertex;
+			if(buffer.type == GL_UNSIGNED_BYTE) {
+				dst[i] = (GLubyte)index;
+			}
+			else if(buffer.type == GL_UNSIGNED_SHORT) {
+				((GLushort *)dst)[i] = (GLushort)index;
+			}
+			else {
+				((GLuint *)dst)[i] = index;
+			}
+		}
+	}
+	glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+}
+
+// Draw count indices from first, one call per chunk they cover
+// The base vertex draws are core from OpenGL 3.2, the chunk at the start of the mesh doesn't need one
+void draw_indices(const index_buffer &buffer, GLsizei first, GLsizei count) {
+	size_t size = index_type_size(buffer.type);
+	for(size_t c = 0; c < buffer.chunks.size(); ++c) {
+		const index_chunk &chunk = buffer.chunks[c];
+		GLsizei begin = std::max(first, chunk.first);
+		GLsizei end = std::min(first + count, chunk.first + chunk.count);
+		if(begin >= end) {
+			continue;
+		}
+		const GLvoid *offset = (const GLvoid *)(begin * size);
+		if(chunk.base_vertex == 0) {
+			glDrawElements(GL_TRIANGLES, end - begin, buffer.type, offset);
+		}
+		else {
+			glDrawElementsBaseVertex(GL_TRIANGLES, end - begin, buffer.type, offset, chunk.base_vertex);
+		}
+	}
+}
+
+// Size in bytes of an index type
+size_t index_type_size(GLenum type) {
+	return type == GL_UNSIGNED_BYTE ? 1 : type == GL_UNSIGNED_SHORT ? 2 : 4;
+}
+
+// Called when the window is resized
+void GLFWCALL window_resized(int width, int height) {
+	// Use red to clear the screen
+	//glClearColor(1, 0, 0, 1);
+
+	// Set the viewport
+	glViewport(0, 0, width, height);
+
+	glClear(GL_COLOR_BUFFER_BIT);
+	glfwSwapBuffers();
+}
+
+// Called for keyboard events
+void keyboard(int key, int action) {
+	if(key == 'Q' && action == GLFW_PRESS) {
+		glfwTerminate();
+		exit(0);
+	}
+}
+
+// Read a shader source from a file
+// store the shader source in a std::vector<char>
+void read_shader_src(const char *fname, std::vector<char> &buffer) {
+	std::ifstream in;
+	in.open(fname, std::ios::binary);
+
+	if(in.is_open()) {
+		// Get the number of bytes stored in this file
+		in.seekg(0, std::ios::end);
+		size_t length = (size_t)in.tellg();
+
+		// Go to start of the file
+		in.seekg(0, std::ios::beg);
+
+		// Read the content of the file in a buffer
+		buffer.resize(length + 1);
+		in.read(&buffer[0], length);
+		in.close();
+		// Add a valid C - string end
+		buffer[length] = '\0';
+	}
+	else {
+		std::cerr << "Unable to open " << fname << " I'm out!" << std::endl;
+		exit(-1);
+	}
+}
+
+// Compile a shader
+GLuint load_and_compile_shader(const char *fname, GLenum shaderType) {
+	// Load a shader from an external file
+	std::vector<char> buffer;
+	read_shader_src(fname, buffer);
+	const char *src = &buffer[0];
+
+	// Compile the shader
+	GLuint shader = glCreateShader(shaderType);
+	glShaderSource(shader, 1, &src, NULL);
+	glCompileShader(shader);
+	// Check the result of the compilation
+	GLint test;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &test);
+	if(!test) {
+		std::cerr << "Shader compilation failed with this message:" << std::endl;
+		std::vector<char> compilation_log(512);
+		glGetShaderInfoLog(shader, compilation_log.size(), NULL, &compilation_log[0]);
+		std::cerr << &compilation_log[0] << std::endl;
+		glfwTerminate();
+		exit(-1);
+	}
+	return shader;
+}
+
+// Create a program from two shaders
+GLuint create_program(const char *path_vert_shader, const char *path_frag_shader) {
+	// Load and compile the vertex and fragment shaders
+	GLuint vertexShader = load_and_compile_shader(path_vert_shader, GL_VERTEX_SHADER);
+	GLuint fragmentShader = load_and_compile_shader(path_frag_shader, GL_FRAGMENT_SHADER);
+
+	// Attach the above shader to a program
+	GLuint shaderProgram = glCreateProgram();
+	glAttachShader(shaderProgram, vertexShader);
+	glAttachShader(shaderProgram, fragmentShader);
+
+	// Flag the shaders for deletion
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+
+	// Link and use the program
+	glLinkProgram(shaderProgram);
+	glUseProgram(shaderProgram);
+
+	return shaderProgram;
+}
+
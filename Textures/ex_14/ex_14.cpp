@@ -0,0 +1,644 @@
+// Draw many images of the same size from a 2D texture array, the layer of each quad comes from its vertices,
+// so all the images are drawn with a single texture bind and a single draw call
+#include <GL/glew.h>
+#include <GL/glfw.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+//#include <ctime>
+#include <FreeImage.h>
+
+// Read a shader source from a file
+// store the shader source in a std::vector<char>
+void read_shader_src(const char *fname, std::vector<char> &buffer);
+
+// Compile a shader
+GLuint load_and_compile_shader(const char *fname, GLenum shaderType);
+
+// Create a program from two shaders
+GLuint create_program(const char *path_vert_shader, const char *path_frag_shader);
+
+// Called when the window is resized
+void GLFWCALL window_resized(int width, int height);
+
+// Called for keyboard events
+void keyboard(int key, int action);
+
+// Render scene
+void display(GLuint &vao);
+
+// Initialize the data to be rendered
+void initialize(GLuint &vao);
+
+// Load an image from the disk with FreeImage, returns NULL if the image can't be read
+FIBITMAP *load_bitmap(const char *fname);
+
+// Create a 2D texture array with one layer per image, all the images must have the same size
+GLuint load_texture_array(const std::vector<FIBITMAP *> &images);
+
+// Create a 2D texture per image, used to compare the texture array with a bind per draw
+void load_textures(const std::vector<FIBITMAP *> &images, std::vector<GLuint> &textures);
+
+// Make square tiles out of the squirrel, when no image files are given on the command line
+void make_tiles(const char *fname, int count, int size, std::vector<FIBITMAP *> &images);
+
+// Time the quads drawn with a texture bind and a draw each, with a draw each from the array
+// and with a single draw from the array, then exit
+void benchmark_texture_binds(GLuint &vao);
+
+// Image files given on the command line
+std::vector<const char *> image_files;
+
+// Number of quads drawn, 0 draws each image once
+int quad_count = 0;
+bool benchmark_binds = false;
+
+// The texture array of the scene, and the same images as separate textures for the benchmark
+GLuint texture_array;
+std::vector<FIBITMAP *> scene_images;
+GLsizei scene_quads;
+
+// Vertex layout of the quads: position, texture coordinates and layer, interleaved
+const int vertex_floats = 5;
+
+// Fixed attribute locations, bound before the link so the vertex array object works with both programs,
+// even if the driver drops the layer from the program that doesn't use it
+enum attribute_location {
+	POSITION_LOCATION = 0,
+	TEXTURE_COORD_LOCATION = 1,
+	LAYER_LOCATION = 2
+};
+
+// A run of triangle indices drawn with one call, its indices are stored relative to base_vertex
+struct index_chunk {
+	GLsizei first;
+	GLsizei count;
+	GLint base_vertex;
+};
+
+// Indices stored with the smallest type that holds them, GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+// A mesh with more vertices than 16 bits indices can address is split in chunks drawn with a base vertex
+struct index_buffer {
+	GLenum type;
+	GLsizei count;
+	std::vector<index_chunk> chunks;
+};
+
+// Fill the bound GL_ELEMENT_ARRAY_BUFFER with triangle indices, using the smallest index type
+void upload_indices(index_buffer &buffer, const GLuint *indices, GLsizei count);
+
+// Draw count indices from first, one call per chunk they cover
+void draw_indices(const index_buffer &buffer, GLsizei first, GLsizei count);
+
+// Size in bytes of an index type
+size_t index_type_size(GLenum type);
+
+// Indices of the scene
+index_buffer scene_indices;
+
+int main (int argc, char **argv) {
+	// --bench-binds [quads] times the draws of the texture array against a texture bind per draw
+	for(int i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "--bench-binds") == 0) {
+			benchmark_binds = true;
+			if(i + 1 < argc && atoi(argv[i + 1]) > 0) {
+				quad_count = atoi(argv[++i]);
+			}
+		}
+		else {
+			image_files.push_back(argv[i]);
+		}
+	}
+
+	// Initialize GLFW
+	if ( !glfwInit()) {
+		std::cerr << "Failed to initialize GLFW! I'm out!" << std::endl;
+		exit(-1);
+	}
+
+	// Use OpenGL 3.2 core profile
+	glfwOpenWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwOpenWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwOpenWindowHint(GLFW_OPENGL_VERSION_MAJOR, 3);
+	glfwOpenWindowHint(GLFW_OPENGL_VERSION_MINOR, 2);
+
+	// Open a window and attach an OpenGL rendering context to the window surface
+	if( !glfwOpenWindow(800, 600, 8, 8, 8, 0, 0, 0, GLFW_WINDOW)) {
+		std::cerr << "Failed to open a window! I'm out!" << std::endl;
+		glfwTerminate();
+		exit(-1);
+	}
+
+	// Register a callback function for window resize events
+	glfwSetWindowSizeCallback( window_resized );
+
+	// Register a callback function for keyboard pressed events
+	glfwSetKeyCallback(keyboard);	
+
+	// Print the OpenGL version
+	int major, minor, rev;
+	glfwGetGLVersion(&major, &minor, &rev);
+	std::cout << "OpenGL - " << major << "." << minor << "." << rev << std::endl;
+
+	// Initialize GLEW
+	glewExperimental = GL_TRUE;
+	if(glewInit() != GLEW_OK) {
+		std::cerr << "Failed to initialize GLEW! I'm out!" << std::endl;
+		glfwTerminate();
+		exit(-1);
+	}
+
+	// Create a vertex array object
+	GLuint vao;
+
+	// Initialize the data to be rendered
+	initialize(vao);
+
+	if(benchmark_binds) {
+		benchmark_texture_binds(vao);
+		glfwTerminate();
+		exit(0);
+	}
+
+	// Create a rendering loop
+	int running = GL_TRUE;
+
+	while(running) {
+		// Display scene
+		display(vao);
+
+		// Pool for events
+		glfwPollEvents();
+		// Check if the window was closed
+		running = glfwGetWindowParam(GLFW_OPENED);
+	}
+
+	// Terminate GLFW
+	glfwTerminate();
+
+	return 0;
+}
+
+// Render scene
+// The layer of each quad is a vertex attribute, one bind and one draw for all the images
+void display(GLuint &vao) {
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	glBindVertexArray(vao);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture_array);
+	draw_indices(scene_indices, 0, scene_indices.count);
+
+	// Swap front and back buffers
+	glfwSwapBuffers();
+}
+
+void initialize(GLuint &vao) {
+	// Use a Vertex Array Object
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+
+	// active only for static linking
+	#ifdef FREEIMAGE_LIB
+		FreeImage_Initialise();
+	#endif
+
+	// Load the images, the array takes them as they are, so they must match in size
+	if(image_files.empty()) {
+		make_tiles("squirrel.jpg", 64, 128, scene_images);
+	}
+	else {
+		for(size_t i = 0; i < image_files.size(); ++i) {
+			FIBITMAP *bitmap = load_bitmap(image_files[i]);
+			if(!bitmap) {
+				std::cerr << "Unable to load the image file " << image_files[i]  << " I'm out!" << std::endl;
+				exit(-1);
+			}
+			scene_images.push_back(bitmap);
+		}
+	}
+	texture_array = load_texture_array(scene_images);
+	std::cout << scene_images.size() << " images of " << FreeImage_GetWidth(scene_images[0]) << "x" <<
+		FreeImage_GetHeight(scene_images[0]) << " in one texture array" << std::endl;
+
+	// Lay the quads out on a grid, the layers repeat when there are more quads than images
+	scene_quads = quad_count > 0 ? quad_count : (GLsizei)scene_images.size();
+	int columns = 1;
+	while(columns * columns * 3 < scene_quads * 4) {
+		columns++;
+	}
+	int rows = (scene_quads + columns - 1) / columns;
+	float cell_width = 2.0f / columns, cell_height = 2.0f / rows;
+
+	std::vector<GLfloat> vertices;
+	std::vector<GLuint> indices;
+	for(int cell = 0; cell < scene_quads; ++cell) {
+		float x = -1.0f + (cell % columns) * cell_width + cell_width * 0.05f;
+		float y = 1.0f - (cell / columns + 1) * cell_height + cell_height * 0.05f;
+		float w = cell_width * 0.9f, h = cell_height * 0.9f;
+		GLfloat layer = (GLfloat)(cell % scene_images.size());
+
+		// Position, texture coordinates and layer of the 4 corners
+		GLfloat quad[4 * vertex_floats] = {
+			x, y, 0.0f, 0.0f, layer,
+			x + w, y, 1.0f, 0.0f, layer,
+			x + w, y + h, 1.0f, 1.0f, layer,
+			x, y + h, 0.0f, 1.0f, layer
+		};
+		GLuint first = (GLuint)(vertices.size() / vertex_floats);
+		vertices.insert(vertices.end(), quad, quad + 4 * vertex_floats);
+		GLuint quad_indices[6] = {first, first + 1, first + 2, first + 2, first + 3, first};
+		indices.insert(indices.end(), quad_indices, quad_indices + 6);
+	}
+
+	// The images are kept for the benchmark, which creates a texture per image
+	if(!benchmark_binds) {
+		for(size_t i = 0; i < scene_images.size(); ++i) {
+			FreeImage_Unload(scene_images[i]);
+		}
+		scene_images.clear();
+
+		// active only for static linking
+		#ifdef FREEIMAGE_LIB
+			FreeImage_DeInitialise();
+		#endif
+	}
+
+	// Create a Vector Buffer Object that will store the vertices on video memory
+	// The positions, texture coordinates and layers are interleaved
+	GLuint vbo;
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), &vertices[0], GL_STATIC_DRAW);
+
+	// Create an Element Array Buffer that will store the indices array:
+	GLuint eab;
+	glGenBuffers(1, &eab);
+
+	// Transfer the data from indices to eab
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eab);
+	upload_indices(scene_indices, &indices[0], (GLsizei)indices.size());
+
+	// The program stays in use for the whole run
+	create_program("shaders/vert.shader", "shaders/frag.shader");
+
+	// The locations of the attributes that enters in the vertex shader are fixed by create_program
+	GLint position_attribute = POSITION_LOCATION;
+
+	// Specify how the data for position can be accessed
+	glVertexAttribPointer(position_attribute, 2, GL_FLOAT, GL_FALSE, vertex_floats * sizeof(GLfloat), 0);
+
+	// Enable the attribute
+	glEnableVertexAttribArray(position_attribute);
+
+	// Texture coord attribute
+	GLint texture_coord_attribute = TEXTURE_COORD_LOCATION;
+	glVertexAttribPointer(texture_coord_attribute, 2, GL_FLOAT, GL_FALSE, vertex_floats * sizeof(GLfloat), (GLvoid *)(2 * sizeof(GLfloat)));
+	glEnableVertexAttribArray(texture_coord_attribute);
+
+	// Layer attribute, the same for the 4 corners of a quad
+	GLint layer_attribute = LAYER_LOCATION;
+	glVertexAttribPointer(layer_attribute, 1, GL_FLOAT, GL_FALSE, vertex_floats * sizeof(GLfloat), (GLvoid *)(4 * sizeof(GLfloat)));
+	glEnableVertexAttribArray(layer_attribute);
+
+}
+
+// Load an image from the disk with FreeImage, returns NULL if the image can't be read
+FIBITMAP *load_bitmap(const char *fname) {
+	// Get the format of the image file
+	FREE_IMAGE_FORMAT fif =FreeImage_GetFileType(fname, 0);
+
+	// If the format can't be determined, try to guess the format from the file name
+	if(fif == FIF_UNKNOWN) {
+		fif = FreeImage_GetFIFFromFilename(fname);
+	}
+
+	// Load the data in bitmap if possible
+	if(fif != FIF_UNKNOWN && FreeImage_FIFSupportsReading(fif)) {
+		return FreeImage_Load(fif, fname);
+	}
+	return NULL;
+}
+
+// Create a 2D texture array with one layer per image, all the images must have the same size
+// Each image is converted to 32 bits, so its rows are BGRA without padding, and uploaded to its layer
+GLuint load_texture_array(const std::vector<FIBITMAP *> &images) {
+	unsigned int width = FreeImage_GetWidth(images[0]);
+	unsigned int height = FreeImage_GetHeight(images[0]);
+	for(size_t i = 1; i < images.size(); ++i) {
+		if(FreeImage_GetWidth(images[i]) != width || FreeImage_GetHeight(images[i]) != height) {
+			std::cerr << "The images of a texture array must have the same size, image " << i << " is " <<
+				FreeImage_GetWidth(images[i]) << "x" << FreeImage_GetHeight(images[i]) << " I'm out!" << std::endl;
+			exit(-1);
+		}
+	}
+	GLint max_layers;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+	if((GLint)images.size() > max_layers) {
+		std::cerr << "A texture array can't have more than " << max_layers << " layers. I'm out!" << std::endl;
+		exit(-1);
+	}
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, (GLsizei)images.size(), 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+	for(size_t i = 0; i < images.size(); ++i) {
+		FIBITMAP *bitmap = FreeImage_ConvertTo32Bits(images[i]);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)i, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, (GLvoid*)FreeImage_GetBits(bitmap));
+		FreeImage_Unload(bitmap);
+	}
+
+	// The mip levels are built per layer, the layers never blend into each other
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	return texture;
+}
+
+// Create a 2D texture per image, used to compare the texture array with a bind per draw
+// The textures have the same format, filtering and mip levels as the layers of the array
+void load_textures(const std::vector<FIBITMAP *> &images, std::vector<GLuint> &textures) {
+	textures.resize(images.size());
+	glGenTextures((GLsizei)textures.size(), &textures[0]);
+	for(size_t i = 0; i < images.size(); ++i) {
+		FIBITMAP *bitmap = FreeImage_ConvertTo32Bits(images[i]);
+		glBindTexture(GL_TEXTURE_2D, textures[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, FreeImage_GetWidth(bitmap), FreeImage_GetHeight(bitmap), 0, GL_BGRA, GL_UNSIGNED_BYTE,
+			(GLvoid*)FreeImage_GetBits(bitmap));
+		FreeImage_Unload(bitmap);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+}
+
+// Make square tiles out of the squirrel, when no image files are given on the command line
+// Random square crops of the image are scaled to the tile size, the same ones on every run
+void make_tiles(const char *fname, int count, int size, std::vector<FIBITMAP *> &images) {
+	FIBITMAP *bitmap = load_bitmap(fname);
+	if(!bitmap) {
+		std::cerr << "Unable to load the image file " << fname  << " I'm out!" << std::endl;
+		exit(-1);
+	}
+	int w = FreeImage_GetWidth(bitmap);
+	int h = FreeImage_GetHeight(bitmap);
+	srand(1);
+	for(int i = 0; i < count; ++i) {
+		int crop_size = std::min(w, h) / 4 + rand() % (std::min(w, h) * 3 / 4);
+		int left = rand() % (w - crop_size + 1);
+		int top = rand() % (h - crop_size + 1);
+		FIBITMAP *crop = FreeImage_Copy(bitmap, left, top, left + crop_size, top + crop_size);
+		images.push_back(FreeImage_Rescale(crop, size, size, FILTER_BILINEAR));
+		FreeImage_Unload(crop);
+	}
+	FreeImage_Unload(bitmap);
+}
+
+// Time the quads drawn with a texture bind and a draw each, with a draw each from the array
+// and with a single draw from the array, then exit
+// Each mode draws the same quads with the same texels, glFinish ends every frame so the time
+// includes the GPU, the swaps are left out to stay clear of the vsync
+void benchmark_texture_binds(GLuint &vao) {
+	std::vector<GLuint> textures;
+	load_textures(scene_images, textures);
+	GLuint array_program;
+	glGetIntegerv(GL_CURRENT_PROGRAM, (GLint *)&array_program);
+	GLuint texture_program = create_program("shaders/vert.shader", "shaders/frag_2d.shader");
+
+	const int frames = 100;
+	const char *mode_names[] = { "bind per draw", "array, draw per quad", "array, single draw" };
+	std::cout << scene_quads << " quads, " << scene_images.size() << " images, " << frames << " frames per mode" << std::endl;
+	glBindVertexArray(vao);
+	for(int mode = 0; mode < 3; ++mode) {
+		glUseProgram(mode == 0 ? texture_program : array_program);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture_array);
+		glFinish();
+		double start = glfwGetTime();
+		for(int frame = 0; frame < frames; ++frame) {
+			glClear(GL_COLOR_BUFFER_BIT);
+			if(mode == 2) {
+				draw_indices(scene_indices, 0, scene_indices.count);
+			}
+			else {
+				for(GLsizei quad = 0; quad < scene_quads; ++quad) {
+					if(mode == 0) {
+						glBindTexture(GL_TEXTURE_2D, textures[quad % textures.size()]);
+					}
+					draw_indices(scene_indices, quad * 6, 6);
+				}
+			}
+			glFinish();
+		}
+		double elapsed = glfwGetTime() - start;
+		int draws = mode == 2 ? 1 : scene_quads;
+		std::cout << mode_names[mode] << ": " << elapsed * 1000.0 / frames << " ms per frame, " << draws << " draws, " <<
+			draws * frames / elapsed / 1e6 << " M draws/s, " << (double)scene_quads * frames / elapsed / 1e6 << " M quads/s" << std::endl;
+	}
+
+	glDeleteTextures((GLsizei)textures.size(), &textures[0]);
+	glDeleteProgram(texture_program);
+	for(size_t i = 0; i < scene_images.size(); ++i) {
+		FreeImage_Unload(scene_images[i]);
+	}
+	scene_images.clear();
+}
+
+// Fill the bound GL_ELEMENT_ARRAY_BUFFER with triangle indices, using the smallest index type
+// Up to 65536 vertices the indices are stored as they are, in bytes or shorts. Past that, the triangles are
+// split in chunks whose vertices are within 65536 of the chunk base vertex, each chunk is a draw. A triangle
+// spanning more than that can't be split, the mesh then keeps 32 bits indices
+void upload_indices(index_buffer &buffer, const GLuint *indices, GLsizei count) {
+	GLuint max_index = 0;
+	for(GLsizei i = 0; i < count; ++i) {
+		max_index = std::max(max_index, indices[i]);
+	}
+	buffer.count = count;
+	buffer.chunks.clear();
+	buffer.type = max_index <= 0xFF ? GL_UNSIGNED_BYTE : max_index <= 0xFFFF ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+	if(buffer.type == GL_UNSIGNED_INT) {
+		// A chunk starts at the lowest vertex of its first triangle and ends with the first triangle out of range
+		buffer.type = GL_UNSIGNED_SHORT;
+		index_chunk chunk = { 0, 0, 0 };
+		for(GLsizei i = 0; i + 2 < count; i += 3) {
+			GLuint low = std::min(indices[i], std::min(indices[i + 1], indices[i + 2]));
+			GLuint high = std::max(indices[i], std::max(indices[i + 1], indices[i + 2]));
+			if(high - low > 0xFFFF) {
+				buffer.type = GL_UNSIGNED_INT;
+				buffer.chunks.clear();
+				break;
+			}
+			if(chunk.count == 0 || low < (GLuint)chunk.base_vertex || high - chunk.base_vertex > 0xFFFF) {
+				if(chunk.count > 0) {
+					buffer.chunks.push_back(chunk);
+				}
+				chunk.first = i;
+				chunk.count = 0;
+				chunk.base_vertex = (GLint)low;
+			}
+			chunk.count += 3;
+		}
+		if(buffer.type == GL_UNSIGNED_SHORT && chunk.count > 0) {
+			buffer.chunks.push_back(chunk);
+		}
+	}
+	if(buffer.chunks.empty()) {
+		index_chunk chunk = { 0, count, 0 };
+		buffer.chunks.push_back(chunk);
+	}
+
+	// Write the indices relative to their chunk, straight in the buffer
+	size_t size = index_type_size(buffer.type);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * size, NULL, GL_STATIC_DRAW);
+	unsigned char *dst = (unsigned char *)glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, count * size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	for(size_t c = 0; c < buffer.chunks.size(); ++c) {
+		const index_chunk &chunk = buffer.chunks[c];
+		for(GLsizei i = chunk.first; i < chunk.first + chunk.count; ++i) {
+			GLuint index = indices[i] - chunk.base_vertex;
+			if(buffer.type == GL_UNSIGNED_BYTE) {
+				dst[i] = (GLubyte)index;
+			}
+			else if(buffer.type == GL_UNSIGNED_SHORT) {
+				((GLushort *)dst)[i] = (GLushort)index;
+			}
+			else {
+				((GLuint *)dst)[i] = index;
+			}
+		}
+	}
+	glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+}
+
+// Draw count indices from first, one call per chunk they cover
+// The base vertex draws are core from OpenGL 3.2, the chunk at the start of the mesh doesn't need one
+void draw_indices(const index_buffer &buffer, GLsizei first, GLsizei count) {
+	size_t size = index_type_size(buffer.type);
+	for(size_t c = 0; c < buffer.chunks.size(); ++c) {
+		const index_chunk &chunk = buffer.chunks[c];
+		GLsizei begin = std::max(first, chunk.first);
+		GLsizei end = std::min(first + count, chunk.first + chunk.count);
+		if(begin >= end) {
+			continue;
+		}
+		const GLvoid *offset = (const GLvoid *)(begin * size);
+		if(chunk.base_vertex == 0) {
+			glDrawElements(GL_TRIANGLES, end - begin, buffer.type, offset);
+		}
+		else {
+			glDrawElementsBaseVertex(GL_TRIANGLES, end - begin, buffer.type, offset, chunk.base_vertex);
+		}
+	}
+}
+
+// Size in bytes of an index type
+size_t index_type_size(GLenum type) {
+	return type == GL_UNSIGNED_BYTE ? 1 : type == GL_UNSIGNED_SHORT ? 2 : 4;
+}
+
+// Called when the window is resized
+void GLFWCALL window_resized(int width, int height) {
+	// Use red to clear the screen
+	//glClearColor(1, 0, 0, 1);
+
+	// Set the viewport
+	glViewport(0, 0, width, height);
+
+	glClear(GL_COLOR_BUFFER_BIT);
+	glfwSwapBuffers();
+}
+
+// Called for keyboard events
+void keyboard(int key, int action) {
+	if(key == 'Q' && action == GLFW_PRESS) {
+		glfwTerminate();
+		exit(0);
+	}
+}
+
+// Read a shader source from a file
+// store the shader source in a std::vector<char>
+void read_shader_src(const char *fname, std::vector<char> &buffer) {
+	std::ifstream in;
+	in.open(fname, std::ios::binary);
+
+	if(in.is_open()) {
+		// Get the number of bytes stored in this file
+		in.seekg(0, std::ios::end);
+		size_t length = (size_t)in.tellg();
+
+		// Go to start of the file
+		in.seekg(0, std::ios::beg);
+
+		// Read the content of the file in a buffer
+		buffer.resize(length + 1);
+		in.read(&buffer[0], length);
+		in.close();
+		// Add a valid C - string end
+		buffer[length] = '\0';
+	}
+	else {
+		std::cerr << "Unable to open " << fname << " I'm out!" << std::endl;
+		exit(-1);
+	}
+}
+
+// Compile a shader
+GLuint load_and_compile_shader(const char *fname, GLenum shaderType) {
+	// Load a shader from an external file
+	std::vector<char> buffer;
+	read_shader_src(fname, buffer);
+	const char *src = &buffer[0];
+
+	// Compile the shader
+	GLuint shader = glCreateShader(shaderType);
+	glShaderSource(shader, 1, &src, NULL);
+	glCompileShader(shader);
+	// Check the result of the compilation
+	GLint test;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &test);
+	if(!test) {
+		std::cerr << "Shader compilation failed with this message:" << std::endl;
+		std::vector<char> compilation_log(512);
+		glGetShaderInfoLog(shader, compilation_log.size(), NULL, &compilation_log[0]);
+		std::cerr << &compilation_log[0] << std::endl;
+		glfwTerminate();
+		exit(-1);
+	}
+	return shader;
+}
+
+// Create a program from two shaders
+GLuint create_program(const char *path_vert_shader, const char *path_frag_shader) {
+	// Load and compile the vertex and fragment shaders
+	GLuint vertexShader = load_and_compile_shader(path_vert_shader, GL_VERTEX_SHADER);
+	GLuint fragmentShader = load_and_compile_shader(path_frag_shader, GL_FRAGMENT_SHADER);
+
+	// Attach the above shader to a program
+	GLuint shaderProgram = glCreateProgram();
+	glAttachShader(shaderProgram, vertexShader);
+	glAttachShader(shaderProgram, fragmentShader);
+
+	// Flag the shaders for deletion
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+
+	// Same attribute locations for all the programs, those missing from a program are simply ignored
+	glBindAttribLocation(shaderProgram, POSITION_LOCATION, "position");
+	glBindAttribLocation(shaderProgram, TEXTURE_COORD_LOCATION, "texture_coord");
+	glBindAttribLocation(shaderProgram, LAYER_LOCATION, "layer");
+
+	// Link and use the program
+	glLinkProgram(shaderProgram);
+	glUseProgram(shaderProgram);
+
+	return shaderProgram;
+}
+
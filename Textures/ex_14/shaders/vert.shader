@@ -0,0 +1,11 @@
+#version 150
+
+in vec4 position;
+in vec2 texture_coord;
+in float layer;
+out vec3 texture_coord_from_vshader;
+
+void main() {
+	gl_Position = position;
+	texture_coord_from_vshader = vec3(texture_coord, layer);
+}
@@ -5,9 +5,42 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <thread>
 //#include <ctime>
 #include <FreeImage.h>
 
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <atomic>
+#endif
+
+// Build with -DEMBED_SHADERS to compile the shaders into the executable,
+// shaders/embedded_shaders.h is generated by running shaders/embed_shaders.sh
+#ifdef EMBED_SHADERS
+#include "shaders/embedded_shaders.h"
+#endif
+
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -16,12 +49,143 @@
 // store the shader source in a std::vector<char>
 void read_shader_src(const char *fname, std::vector<char> &buffer);
 
+// A shader source that can be given to glShaderSource without a copy,
+// either embedded in the executable or mapped from a file
+struct shader_source {
+	const char *data;
+	GLint length;
+	void *mapping;
+	size_t mapping_size;
+	std::vector<char> buffer;
+};
+
+// Find a shader source, embedded shaders are used first, otherwise the file is mapped in memory
+void open_shader_src(const char *fname, shader_source &src);
+
+// Release the memory mapping of a shader source
+void close_shader_src(shader_source &src);
+
+// Time spent getting the shader sources, printed at exit
+double shader_io_time = 0;
+
 // Compile a shader
 GLuint load_and_compile_shader(const char *fname, GLenum shaderType);
 
+// Compile a shader from a source already loaded in memory
+GLuint compile_shader_src(const char *src, GLint length, GLenum shaderType);
+
+// Send a shader to the driver for compilation, without waiting for the result
+GLuint submit_shader(const char *src, GLint length, GLenum shaderType);
+
+// Check the result of a shader compilation, this blocks until the compilation is done
+void check_shader(GLuint shader);
+
+// Same as check_shader, but only report the errors and return false
+bool shader_compiled(GLuint shader);
+
 // Create a program from two shaders
 GLuint create_program(const char *path_vert_shader, const char *path_frag_shader);
 
+// Start building a program from two shaders, returns an id for finish_program
+int submit_program(const char *path_vert_shader, const char *path_frag_shader);
+
+// Check, without blocking, if the driver finished building a submitted program
+bool program_ready(int id);
+
+// Wait for a submitted program, check that it linked and use it
+GLuint finish_program(int id);
+
+// Same as finish_program, but return 0 after reporting the errors
+GLuint try_finish_program(int id);
+
+// A program queued with submit_program, its status is queried only when first needed
+struct pending_program {
+	GLuint program;
+	GLuint vertexShader;
+	GLuint fragmentShader;
+	std::string cache_file;
+	bool finished;
+
+	// Content hash of the shader sources and number of users of the program
+	unsigned long long source_hash;
+	int references;
+};
+
+// All the programs submitted so far, indexed by the id returned from submit_program
+std::vector<pending_program> pending_programs;
+
+// Programs indexed by the content hash of their shader sources, identical
+// pipelines share one program, it is deleted when its last user releases it
+std::map<unsigned long long, int> program_registry;
+
+// Give back a program obtained with submit_program or create_program,
+// the GPU program is deleted when nobody uses it anymore
+void release_program(int id);
+
+// True if the driver compiles shaders on its own threads (KHR_parallel_shader_compile)
+bool parallel_shader_compile = false;
+
+// 64 bits FNV-1a hash, used to key the program binary cache
+unsigned long long fnv1a_hash(const char *data, size_t length, unsigned long long hash = 14695981039346656037ULL);
+
+// Same hash as fnv1a_hash, usable at compile time on the names of uniforms and attributes
+constexpr unsigned long long name_hash(const char *name, unsigned long long hash = 14695981039346656037ULL) {
+	return *name ? name_hash(name + 1, (hash ^ (unsigned char)*name) * 1099511628211ULL) : hash;
+}
+
+// An active uniform or attribute of a linked program
+struct program_variable {
+	unsigned long long hash;
+	GLint location;
+	GLenum type;
+	GLint size;
+
+	bool operator<(const program_variable &other) const { return hash < other.hash; }
+};
+
+// Uniforms and attributes of a linked program, sorted by the hash of their names
+struct program_reflection {
+	std::vector<program_variable> uniforms;
+	std::vector<program_variable> attributes;
+};
+
+// Reflection tables of all the linked programs
+std::map<GLuint, program_reflection> program_reflections;
+
+// Build the reflection table of a program, called once after the link
+void reflect_program(GLuint shaderProgram);
+
+// Location of a uniform from its hashed name, -1 if the program doesn't use it
+// Only the reflection table is searched, there is no string work and no GL query
+GLint uniform_location(GLuint shaderProgram, unsigned long long name);
+
+// Location of an attribute from its hashed name, -1 if the program doesn't use it
+GLint attrib_location(GLuint shaderProgram, unsigned long long name);
+
+// Find a hashed name in a sorted reflection table
+GLint find_location(const std::vector<program_variable> &variables, unsigned long long name);
+
+// Names of the scene attributes and uniforms, hashed at compile time
+constexpr unsigned long long position_name = name_hash("position");
+constexpr unsigned long long texture_coord_name = name_hash("texture_coord");
+constexpr unsigned long long model_name = name_hash("Model");
+constexpr unsigned long long view_name = name_hash("View");
+constexpr unsigned long long projection_name = name_hash("Projection");
+constexpr unsigned long long instance_transform_name = name_hash("instance_transform");
+
+// Try to create a program from a binary stored in the program cache
+GLuint load_cached_program(const std::string &cache_file);
+
+// Store the binary of a linked program in the program cache
+void save_cached_program(GLuint shaderProgram, const std::string &cache_file);
+
+// Folder used to store the linked program binaries between runs
+const char *program_cache_dir = "program_cache";
+
+// Program binary cache statistics, printed at exit
+int program_cache_hits = 0;
+int program_cache_misses = 0;
+
 // Called when the window is resized
 void GLFWCALL window_resized(int width, int height);
 
@@ -34,14 +198,219 @@ void display(GLuint &vao);
 // Initialize the data to be rendered
 void initialize(GLuint &vao);
 
+// Connect a freshly linked program to the vertex buffer and set its uniforms
+void setup_program(GLuint shaderProgram);
+
+// Shaders used by the scene, reloaded when they change on the disk
+const char *vert_shader_path = "shaders/vert.shader";
+const char *frag_shader_path = "shaders/frag.shader";
+
+// Program currently used by display, and its id from submit_program
+GLuint current_program = 0;
+int current_program_id = -1;
+
+// Model, view and projection matrices, kept to set up a reloaded program
+glm::mat4 Model, View, Projection;
+
+// Offset of the texture coordinates in the vertex buffer
+GLsizeiptr texture_coord_offset = 0;
+
+// Run with --instances [count] to draw a grid of quads, each with its own transform, in one instanced draw
+int instance_count = 0;
+
+// Vertex shader used by the instanced draws, the transform comes from a per instance attribute
+const char *instanced_vert_shader_path = "shaders/vert_instanced.shader";
+
+// Buffer of the per instance transforms, 4 floats for each quad: the translation in xy, the rotation in z
+// and the scale in w, a quad reads its transform once with a divisor of 1
+GLuint instance_vbo = 0;
+
+// Build the transforms of count quads on a grid covering the view and upload them to instance_vbo
+void fill_instances(int count, std::vector<GLfloat> &transforms);
+
+// Time the instanced draw for a growing number of quads, against one draw per quad, then exit
+void benchmark_instances(GLuint &vao, int max_count);
+
+// Run with --bench-instances [max] to time the instanced draws, up to max quads
+int bench_instances_max = 0;
+
+// Start watching the shaders folder for changes, on a background thread
+void start_shader_watcher(const char *dir);
+
+// Stop the background thread that watches the shaders folder
+void stop_shader_watcher();
+
+// Called between frames, rebuilds the program if a shader changed and swaps
+// it in once the driver is done, a shader with errors keeps the last good program
+// Only drivers with KHR_parallel_shader_compile keep the frames going during the rebuild
+void reload_shaders();
+
+#ifdef __linux__
+// Set by the watcher thread when a shader file was written
+std::atomic<bool> shaders_changed(false);
+std::atomic<bool> shader_watcher_running(false);
+std::thread shader_watcher;
+#endif
+
+// Id of the program being rebuilt after a change, -1 if there is none
+int reload_program_id = -1;
+
 // Load an image from the disk with FreeImage
 void load_image(const char *fname);
 
-int main () {
+// How the mip chain of the texture is built, chosen with --mipmaps cpu|gl|none
+enum mipmap_mode {
+	MIPMAPS_NONE,
+	MIPMAPS_CPU,
+	MIPMAPS_GL
+};
+mipmap_mode texture_mipmaps = MIPMAPS_CPU;
+
+// Number of levels of the scene texture
+int texture_levels = 1;
+
+// A level of a mip chain built on the CPU, BGR or BGRA rows 4 bytes aligned like FreeImage's
+struct mip_level {
+	unsigned int width;
+	unsigned int height;
+	unsigned int pitch;
+	std::vector<BYTE> pixels;
+};
+
+// Number of levels of a full mip chain
+int mip_level_count(unsigned int width, unsigned int height);
+
+// Build the levels 1 and up of a mip chain from the pixels of the level 0
+void build_mip_chain(const BYTE *pixels, unsigned int width, unsigned int height, unsigned int pitch, unsigned int bytes,
+	std::vector<mip_level> &levels);
+
+// Halve an image with a 2x2 box filter, the colors are averaged in linear space
+void downsample_level(const BYTE *src, unsigned int width, unsigned int height, unsigned int pitch, unsigned int bytes,
+	mip_level &dst);
+
+// sRGB to 14 bits linear conversion tables, and back, alpha is only scaled
+struct gamma_tables {
+	unsigned short to_linear[256];
+	unsigned short alpha_to_linear[256];
+	unsigned char to_srgb[1 << 14];
+	unsigned char alpha_to_byte[1 << 14];
+	gamma_tables();
+};
+
+// Time the sampling of the texture at several minification ratios, with and without the mipmaps, then exit
+void benchmark_minification(GLuint &vao);
+
+// Run with --bench-mipmaps to time the texture sampling
+bool bench_minification = false;
+
+// A timed phase of the startup, in nanoseconds from the process start
+struct trace_event {
+	const char *name;
+	long long start;
+	long long duration;
+};
+
+// Phases recorded so far, written as a Chrome trace at exit
+std::vector<trace_event> trace_events;
+
+// Taken when the executable is loaded, before main
+const std::chrono::steady_clock::time_point process_start = std::chrono::steady_clock::now();
+
+// Time of the first glfwSwapBuffers, -1 until the first frame is presented
+long long first_swap_time = -1;
+
+// Nanoseconds elapsed since the process start
+long long trace_now();
+
+// Record the time spent in a scope as a startup phase
+struct scoped_timer {
+	const char *name;
+	long long start;
+
+	scoped_timer(const char *name) : name(name), start(trace_now()) {}
+	~scoped_timer() {
+		trace_event event = { name, start, trace_now() - start };
+		trace_events.push_back(event);
+	}
+};
+
+// Write the startup phases in the Chrome trace format, open it with chrome://tracing or Perfetto
+void write_trace(const char *fname);
+
+// Print the statistics and write the startup trace, called before exiting
+void report_statistics();
+
+// Run with --startup to exit after the first frame, e.g. for headless timing runs
+bool exit_after_first_frame = false;
+
+// A run of triangle indices drawn with one call, its indices are stored relative to base_vertex
+struct index_chunk {
+	GLsizei first;
+	GLsizei count;
+	GLint base_vertex;
+};
+
+// Indices stored with the smallest type that holds them, GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+// A mesh with more vertices than 16 bits indices can address is split in chunks drawn with a base vertex
+struct index_buffer {
+	GLenum type;
+	GLsizei count;
+	std::vector<index_chunk> chunks;
+};
+
+// Fill the bound GL_ELEMENT_ARRAY_BUFFER with triangle indices, using the smallest index type
+void upload_indices(index_buffer &buffer, const GLuint *indices, GLsizei count);
+
+// Draw count indices from first, instanced when instances > 0, one call per chunk they cover
+void draw_indices(const index_buffer &buffer, GLsizei first, GLsizei count, GLsizei instances = 0);
+
+// Size in bytes of an index type
+size_t index_type_size(GLenum type);
+
+// Indices of the scene
+index_buffer scene_indices;
+
+int main (int argc, char **argv) {
+	for(int i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "--startup") == 0) {
+			exit_after_first_frame = true;
+		}
+		else if(strcmp(argv[i], "--mipmaps") == 0 && i + 1 < argc) {
+			++i;
+			texture_mipmaps = strcmp(argv[i], "gl") == 0 ? MIPMAPS_GL : strcmp(argv[i], "none") == 0 ? MIPMAPS_NONE : MIPMAPS_CPU;
+		}
+		else if(strcmp(argv[i], "--bench-mipmaps") == 0) {
+			bench_minification = true;
+		}
+		else if(strcmp(argv[i], "--instances") == 0) {
+			instance_count = 100000;
+			if(i + 1 < argc && atoi(argv[i + 1]) > 0) {
+				instance_count = atoi(argv[++i]);
+			}
+		}
+		else if(strcmp(argv[i], "--bench-instances") == 0) {
+			bench_instances_max = 1000000;
+			if(i + 1 < argc && atoi(argv[i + 1]) > 0) {
+				bench_instances_max = atoi(argv[++i]);
+			}
+		}
+	}
+
+	// The benchmark needs the instanced program, it starts with a small grid
+	if(bench_instances_max > 0 && instance_count == 0) {
+		instance_count = 1000;
+	}
+	if(instance_count > 0) {
+		vert_shader_path = instanced_vert_shader_path;
+	}
+
 	// Initialize GLFW
-	if ( !glfwInit()) {
-		std::cerr << "Failed to initialize GLFW! I'm out!" << std::endl;
-		exit(-1);
+	{
+		scoped_timer timer("glfwInit");
+		if ( !glfwInit()) {
+			std::cerr << "Failed to initialize GLFW! I'm out!" << std::endl;
+			exit(-1);
+		}
 	}
 
 	// Use OpenGL 3.2 core profile
@@ -51,10 +420,13 @@ int main () {
 	glfwOpenWindowHint(GLFW_OPENGL_VERSION_MINOR, 2);
 
 	// Open a window and attach an OpenGL rendering context to the window surface
-	if( !glfwOpenWindow(800, 600, 8, 8, 8, 0, 0, 0, GLFW_WINDOW)) {
-		std::cerr << "Failed to open a window! I'm out!" << std::endl;
-		glfwTerminate();
-		exit(-1);
+	{
+		scoped_timer timer("glfwOpenWindow");
+		if( !glfwOpenWindow(800, 600, 8, 8, 8, 0, 0, 0, GLFW_WINDOW)) {
+			std::cerr << "Failed to open a window! I'm out!" << std::endl;
+			glfwTerminate();
+			exit(-1);
+		}
 	}
 
 	// Register a callback function for window resize events
@@ -69,11 +441,20 @@ int main () {
 	std::cout << "OpenGL - " << major << "." << minor << "." << rev << std::endl;
 
 	// Initialize GLEW
-	glewExperimental = GL_TRUE;
-	if(glewInit() != GLEW_OK) {
-		std::cerr << "Failed to initialize GLEW! I'm out!" << std::endl;
-		glfwTerminate();
-		exit(-1);
+	{
+		scoped_timer timer("glewInit");
+		glewExperimental = GL_TRUE;
+		if(glewInit() != GLEW_OK) {
+			std::cerr << "Failed to initialize GLEW! I'm out!" << std::endl;
+			glfwTerminate();
+			exit(-1);
+		}
+	}
+
+	// Let the driver compile shaders on as many threads as it wants
+	if(GLEW_KHR_parallel_shader_compile) {
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		parallel_shader_compile = true;
 	}
 
 	// Create a vertex array object
@@ -82,12 +463,37 @@ int main () {
 	// Initialize the data to be rendered
 	initialize(vao);
 
+	if(bench_minification) {
+		benchmark_minification(vao);
+	}
+
+	if(bench_instances_max > 0) {
+		benchmark_instances(vao, bench_instances_max);
+	}
+
+	// Embedded shaders can't change, only watch the files
+	#ifndef EMBED_SHADERS
+		start_shader_watcher("shaders");
+	#endif
+
 	// Create a rendering loop
 	int running = GL_TRUE;
 
 	while(running) {
+		// Pick up the edited shaders, if any
+		reload_shaders();
+
 		// Display scene
-		display(vao);
+		if(first_swap_time < 0) {
+			scoped_timer timer("first display");
+			display(vao);
+		}
+		else {
+			display(vao);
+		}
+		if(exit_after_first_frame) {
+			break;
+		}
 
 		// Pool for events
 		glfwPollEvents();
@@ -95,9 +501,13 @@ int main () {
 		running = glfwGetWindowParam(GLFW_OPENED);
 	}
 
+	stop_shader_watcher();
+
 	// Terminate GLFW
 	glfwTerminate();
 
+	report_statistics();
+
 	return 0;
 }
 
@@ -106,13 +516,26 @@ void display(GLuint &vao) {
 	glClear(GL_COLOR_BUFFER_BIT);
 
 	glBindVertexArray(vao);
-	glDrawElements( GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	if(instance_count > 0) {
+		draw_indices(scene_indices, 0, scene_indices.count, instance_count);
+	}
+	else {
+		draw_indices(scene_indices, 0, scene_indices.count);
+	}
 
 	// Swap front and back buffers
 	glfwSwapBuffers();
+	if(first_swap_time < 0) {
+		first_swap_time = trace_now();
+	}
 }
 
 void initialize(GLuint &vao) {
+	scoped_timer timer("initialize");
+
+	// Queue the shaders first, the driver compiles them while we decode the image and fill the buffers
+	int program_id = submit_program(vert_shader_path, frag_shader_path);
+
 	// Use a Vertex Array Object
 	glGenVertexArrays(1, &vao);
 	glBindVertexArray(vao);
@@ -137,9 +560,6 @@ void initialize(GLuint &vao) {
 		2, 3, 0
 	};
 
-	// Initialize the model, view and projection matrices
-	glm::mat4 Model, View, Projection;
-
 	// Set the projection matrix
 	Projection = glm::ortho(-4.0f/3.0f, 4.0f/3.0f, -1.0f, 1.0f, -1.0f, 1.0f);
 
@@ -151,27 +571,43 @@ void initialize(GLuint &vao) {
 
 
 
-	// Create a Vector Buffer Object that will store the vertices on video memory
-	GLuint vbo;
-	glGenBuffers(1, &vbo);
+	{
+		scoped_timer timer("buffer uploads");
 
-	// Allocate space for vertex positions and texture coordinates
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices_position) + sizeof(texture_coord), NULL, GL_STATIC_DRAW);
+		// Create a Vector Buffer Object that will store the vertices on video memory
+		GLuint vbo;
+		glGenBuffers(1, &vbo);
+
+		// Allocate space for vertex positions and texture coordinates
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices_position) + sizeof(texture_coord), NULL, GL_STATIC_DRAW);
+
+		// Transfer the vertex positions:
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices_position), vertices_position);
 
-	// Transfer the vertex positions:
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices_position), vertices_position);
+		// Transfer the texture coordinates:
+		glBufferSubData(GL_ARRAY_BUFFER, sizeof(vertices_position), sizeof(texture_coord), texture_coord);
 
-	// Transfer the texture coordinates:
-	glBufferSubData(GL_ARRAY_BUFFER, sizeof(vertices_position), sizeof(texture_coord), texture_coord);
+		// Create an Element Array Buffer that will store the indices array:
+		GLuint eab;
+		glGenBuffers(1, &eab);
 
-	// Create an Element Array Buffer that will store the indices array:
-	GLuint eab;
-	glGenBuffers(1, &eab);
+		// Transfer the data from indices to eab
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eab);
+		upload_indices(scene_indices, indices, sizeof(indices) / sizeof(GLuint));
 
-	// Transfer the data from indices to eab
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eab);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+		// The transforms of the instanced quads, glVertexAttribDivisor is core from OpenGL 3.3
+		if(instance_count > 0) {
+			if(!GLEW_VERSION_3_3 && !GLEW_ARB_instanced_arrays) {
+				std::cerr << "Instanced arrays are not supported! I'm out!" << std::endl;
+				glfwTerminate();
+				exit(-1);
+			}
+			glGenBuffers(1, &instance_vbo);
+			std::vector<GLfloat> transforms;
+			fill_instances(instance_count, transforms);
+		}
+	}
 
 	// Create a texture
 	GLuint texture;
@@ -182,35 +618,64 @@ void initialize(GLuint &vao) {
 
 	load_image("squirrel.jpg");
 
-	GLuint shaderProgram = create_program("shaders/vert.shader", "shaders/frag.shader");
+	// The program is needed from here on, wait for it
+	texture_coord_offset = sizeof(vertices_position);
+	current_program_id = program_id;
+	current_program = finish_program(program_id);
+	setup_program(current_program);
+}
 
+// Connect a freshly linked program to the vertex buffer and set its uniforms
+// The vertex array object and the vertex buffer must be bound
+void setup_program(GLuint shaderProgram) {
 	// Get the location of the attributes that enters in the vertex shader
-	GLint position_attribute = glGetAttribLocation(shaderProgram, "position");
-
-	// Specify how the data for position can be accessed
-	glVertexAttribPointer(position_attribute, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-	// Enable the attribute
-	glEnableVertexAttribArray(position_attribute);
+	// An attribute unused by the shaders has no location, -1 must not reach the attribute calls
+	GLint position_attribute = attrib_location(shaderProgram, position_name);
+	if(position_attribute >= 0) {
+		// Specify how the data for position can be accessed
+		glVertexAttribPointer(position_attribute, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+		// Enable the attribute
+		glEnableVertexAttribArray(position_attribute);
+	}
 
 	// Texture coord attribute
-	GLint texture_coord_attribute = glGetAttribLocation(shaderProgram, "texture_coord");
-	glVertexAttribPointer(texture_coord_attribute, 2, GL_FLOAT, GL_FALSE, 0, (GLvoid *)sizeof(vertices_position));
-	glEnableVertexAttribArray(texture_coord_attribute);
+	GLint texture_coord_attribute = attrib_location(shaderProgram, texture_coord_name);
+	if(texture_coord_attribute >= 0) {
+		glVertexAttribPointer(texture_coord_attribute, 2, GL_FLOAT, GL_FALSE, 0, (GLvoid *)texture_coord_offset);
+		glEnableVertexAttribArray(texture_coord_attribute);
+	}
 
 	// Transfer the transformation matrices to the shader program
-	GLint model = glGetUniformLocation( shaderProgram, "Model" );
+	GLint model = uniform_location(shaderProgram, model_name);
 	glUniformMatrix4fv(model, 1, GL_FALSE, glm::value_ptr(Model));
 
-	GLint view = glGetUniformLocation( shaderProgram, "View" );
+	GLint view = uniform_location(shaderProgram, view_name);
 	glUniformMatrix4fv(view, 1, GL_FALSE, glm::value_ptr(View));
 
-	GLint projection = glGetUniformLocation( shaderProgram, "Projection" );
+	GLint projection = uniform_location(shaderProgram, projection_name);
 	glUniformMatrix4fv(projection, 1, GL_FALSE, glm::value_ptr(Projection));
 
+	// The instanced program reads its transform from instance_vbo, advanced once per quad
+	GLint instance_transform = attrib_location(shaderProgram, instance_transform_name);
+	if(instance_vbo && instance_transform >= 0) {
+		GLint vbo;
+		glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+		glVertexAttribPointer(instance_transform, 4, GL_FLOAT, GL_FALSE, 0, 0);
+		if(GLEW_VERSION_3_3) {
+			glVertexAttribDivisor(instance_transform, 1);
+		}
+		else {
+			glVertexAttribDivisorARB(instance_transform, 1);
+		}
+		glEnableVertexAttribArray(instance_transform);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	}
 }
 
 void load_image(const char *fname) {
+	scoped_timer timer("load_image");
 
 	// active only for static linking
 	#ifdef FREEIMAGE_LIB
@@ -244,18 +709,55 @@ void load_image(const char *fname) {
 		BYTE *data = (BYTE*)FreeImage_GetBits(bitmap);
 
 		// Process only RGB and RGBA images
+		GLenum internal_format, format;
 		if(pixel_size == 24) {
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_BGR, GL_UNSIGNED_BYTE, (GLvoid*)data);
+			internal_format = GL_RGB8;
+			format = GL_BGR;
 		}
 		else if (pixel_size == 32) {
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_BGRA, GL_UNSIGNED_BYTE, (GLvoid*)data);
+			internal_format = GL_RGBA8;
+			format = GL_BGRA;
 		}
 		else {
 			std::cerr << "pixel size = " << pixel_size << " don't know how to process this case. I'm out!" << std::endl;
 			exit(-1);
 		}
-		
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+		// The CPU mip chain is built on a worker thread while the level 0 is uploaded
+		std::vector<mip_level> levels;
+		std::thread mipmapper;
+		if(texture_mipmaps == MIPMAPS_CPU) {
+			mipmapper = std::thread(build_mip_chain, data, w, h, FreeImage_GetPitch(bitmap), pixel_size / 8, std::ref(levels));
+		}
+
+		// Allocate all the levels at once, with immutable storage when available
+		texture_levels = texture_mipmaps == MIPMAPS_NONE ? 1 : mip_level_count(w, h);
+		if(GLEW_ARB_texture_storage) {
+			glTexStorage2D(GL_TEXTURE_2D, texture_levels, internal_format, w, h);
+		}
+		else {
+			for(int level = 0; level < texture_levels; ++level) {
+				glTexImage2D(GL_TEXTURE_2D, level, internal_format, std::max(1u, w >> level), std::max(1u, h >> level), 0,
+					format, GL_UNSIGNED_BYTE, NULL);
+			}
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture_levels - 1);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, format, GL_UNSIGNED_BYTE, (GLvoid*)data);
+
+		if(texture_mipmaps == MIPMAPS_CPU) {
+			scoped_timer timer("mipmaps");
+			mipmapper.join();
+			for(size_t i = 0; i < levels.size(); ++i) {
+				glTexSubImage2D(GL_TEXTURE_2D, (GLint)i + 1, 0, 0, levels[i].width, levels[i].height, format, GL_UNSIGNED_BYTE,
+					(GLvoid*)&levels[i].pixels[0]);
+			}
+		}
+		else if(texture_mipmaps == MIPMAPS_GL) {
+			scoped_timer timer("mipmaps");
+			glGenerateMipmap(GL_TEXTURE_2D);
+		}
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, texture_levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	}
 	else {
@@ -273,6 +775,102 @@ void load_image(const char *fname) {
 }
 
 
+// Fill the bound GL_ELEMENT_ARRAY_BUFFER with triangle indices, using the smallest index type
+// Up to 65536 vertices the indices are stored as they are, in bytes or shorts. Past that, the triangles are
+// split in chunks whose vertices are within 65536 of the chunk base vertex, each chunk is a draw. A triangle
+// spanning more than that can't be split, the mesh then keeps 32 bits indices
+void upload_indices(index_buffer &buffer, const GLuint *indices, GLsizei count) {
+	GLuint max_index = 0;
+	for(GLsizei i = 0; i < count; ++i) {
+		max_index = std::max(max_index, indices[i]);
+	}
+	buffer.count = count;
+	buffer.chunks.clear();
+	buffer.type = max_index <= 0xFF ? GL_UNSIGNED_BYTE : max_index <= 0xFFFF ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+	if(buffer.type == GL_UNSIGNED_INT) {
+		// A chunk starts at the lowest vertex of its first triangle and ends with the first triangle out of range
+		buffer.type = GL_UNSIGNED_SHORT;
+		index_chunk chunk = { 0, 0, 0 };
+		for(GLsizei i = 0; i + 2 < count; i += 3) {
+			GLuint low = std::min(indices[i], std::min(indices[i + 1], indices[i + 2]));
+			GLuint high = std::max(indices[i], std::max(indices[i + 1], indices[i + 2]));
+			if(high - low > 0xFFFF) {
+				buffer.type = GL_UNSIGNED_INT;
+				buffer.chunks.clear();
+				break;
+			}
+			if(chunk.count == 0 || low < (GLuint)chunk.base_vertex || high - chunk.base_vertex > 0xFFFF) {
+				if(chunk.count > 0) {
+					buffer.chunks.push_back(chunk);
+				}
+				chunk.first = i;
+				chunk.count = 0;
+				chunk.base_vertex = (GLint)low;
+			}
+			chunk.count += 3;
+		}
+		if(buffer.type == GL_UNSIGNED_SHORT && chunk.count > 0) {
+			buffer.chunks.push_back(chunk);
+		}
+	}
+	if(buffer.chunks.empty()) {
+		index_chunk chunk = { 0, count, 0 };
+		buffer.chunks.push_back(chunk);
+	}
+
+	// Write the indices relative to their chunk, straight in the buffer
+	size_t size = index_type_size(buffer.type);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * size, NULL, GL_STATIC_DRAW);
+	unsigned char *dst = (unsigned char *)glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, count * size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	for(size_t c = 0; c < buffer.chunks.size(); ++c) {
+		const index_chunk &chunk = buffer.chunks[c];
+		for(GLsizei i = chunk.first; i < chunk.first + chunk.count; ++i) {
+			GLuint index = indices[i] - chunk.base_vertex;
+			if(buffer.type == GL_UNSIGNED_BYTE) {
+				dst[i] = (GLubyte)index;
+			}
+			else if(buffer.type == GL_UNSIGNED_SHORT) {
+				((GLushort *)dst)[i] = (GLushort)index;
+			}
+			else {
+				((GLuint *)dst)[i] = index;
+			}
+		}
+	}
+	glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+}
+
+// Draw count indices from first, instanced when instances > 0, one call per chunk they cover
+// The base vertex draws are core from OpenGL 3.2, the chunk at the start of the mesh doesn't need one
+void draw_indices(const index_buffer &buffer, GLsizei first, GLsizei count, GLsizei instances) {
+	size_t size = index_type_size(buffer.type);
+	for(size_t c = 0; c < buffer.chunks.size(); ++c) {
+		const index_chunk &chunk = buffer.chunks[c];
+		GLsizei begin = std::max(first, chunk.first);
+		GLsizei end = std::min(first + count, chunk.first + chunk.count);
+		if(begin >= end) {
+			continue;
+		}
+		const GLvoid *offset = (const GLvoid *)(begin * size);
+		if(instances > 0) {
+			glDrawElementsInstancedBaseVertex(GL_TRIANGLES, end - begin, buffer.type, offset, instances, chunk.base_vertex);
+		}
+		else if(chunk.base_vertex == 0) {
+			glDrawElements(GL_TRIANGLES, end - begin, buffer.type, offset);
+		}
+		else {
+			glDrawElementsBaseVertex(GL_TRIANGLES, end - begin, buffer.type, offset, chunk.base_vertex);
+		}
+	}
+}
+
+// Size in bytes of an index type
+size_t index_type_size(GLenum type) {
+	return type == GL_UNSIGNED_BYTE ? 1 : type == GL_UNSIGNED_SHORT ? 2 : 4;
+}
+
 // Called when the window is resized
 void GLFWCALL window_resized(int width, int height) {
 	// Use red to clear the screen
@@ -288,7 +886,9 @@ void GLFWCALL window_resized(int width, int height) {
 // Called for keyboard events
 void keyboard(int key, int action) {
 	if(key == 'Q' && action == GLFW_PRESS) {
+		stop_shader_watcher();
 		glfwTerminate();
+		report_statistics();
 		exit(0);
 	}
 }
@@ -323,15 +923,100 @@ void read_shader_src(const char *fname, std::vector<char> &buffer) {
 // Compile a shader
 GLuint load_and_compile_shader(const char *fname, GLenum shaderType) {
 	// Load a shader from an external file
-	std::vector<char> buffer;
-	read_shader_src(fname, buffer);
-	const char *src = &buffer[0];
+	shader_source src;
+	open_shader_src(fname, src);
+	GLuint shader = compile_shader_src(src.data, src.length, shaderType);
+	close_shader_src(src);
+	return shader;
+}
 
-	// Compile the shader
+// Compile a shader from a source already loaded in memory
+GLuint compile_shader_src(const char *src, GLint length, GLenum shaderType) {
+	GLuint shader = submit_shader(src, length, shaderType);
+	check_shader(shader);
+	return shader;
+}
+
+// Send a shader to the driver for compilation, without waiting for the result
+// The source doesn't need to be null terminated, its length is given explicitly
+GLuint submit_shader(const char *src, GLint length, GLenum shaderType) {
 	GLuint shader = glCreateShader(shaderType);
-	glShaderSource(shader, 1, &src, NULL);
+	glShaderSource(shader, 1, &src, &length);
 	glCompileShader(shader);
-	// Check the result of the compilation
+	return shader;
+}
+
+// Find a shader source, embedded shaders are used first, otherwise the file is mapped in memory
+void open_shader_src(const char *fname, shader_source &src) {
+	double start = glfwGetTime();
+	src.data = NULL;
+	src.length = 0;
+	src.mapping = NULL;
+	src.mapping_size = 0;
+
+	#ifdef EMBED_SHADERS
+		for(size_t i = 0; i < sizeof(embedded_shaders)/sizeof(embedded_shaders[0]); ++i) {
+			if(strcmp(embedded_shaders[i].name, fname) == 0) {
+				src.data = embedded_shaders[i].src;
+				src.length = embedded_shaders[i].length;
+				shader_io_time += glfwGetTime() - start;
+				return;
+			}
+		}
+	#endif
+
+	#ifdef _WIN32
+		// No mmap here, fall back to reading the file in a buffer
+		read_shader_src(fname, src.buffer);
+		src.data = &src.buffer[0];
+		src.length = (GLint)src.buffer.size() - 1;
+	#else
+		int fd = open(fname, O_RDONLY);
+		if(fd < 0) {
+			std::cerr << "Unable to open " << fname << " I'm out!" << std::endl;
+			exit(-1);
+		}
+		struct stat info;
+		fstat(fd, &info);
+		src.mapping_size = (size_t)info.st_size;
+		if(src.mapping_size > 0) {
+			src.mapping = mmap(NULL, src.mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(src.mapping == MAP_FAILED) {
+				std::cerr << "Unable to map " << fname << " I'm out!" << std::endl;
+				exit(-1);
+			}
+			src.data = (const char *)src.mapping;
+		}
+		else {
+			src.data = "";
+		}
+		src.length = (GLint)src.mapping_size;
+		close(fd);
+	#endif
+	shader_io_time += glfwGetTime() - start;
+}
+
+// Release the memory mapping of a shader source
+void close_shader_src(shader_source &src) {
+	#ifndef _WIN32
+		if(src.mapping) {
+			munmap(src.mapping, src.mapping_size);
+		}
+	#endif
+	src.mapping = NULL;
+	src.data = NULL;
+}
+
+// Check the result of a shader compilation, this blocks until the compilation is done
+void check_shader(GLuint shader) {
+	if(!shader_compiled(shader)) {
+		glfwTerminate();
+		exit(-1);
+	}
+}
+
+// Same as check_shader, but only report the errors and return false
+bool shader_compiled(GLuint shader) {
 	GLint test;
 	glGetShaderiv(shader, GL_COMPILE_STATUS, &test);
 	if(!test) {
@@ -339,31 +1024,708 @@ GLuint load_and_compile_shader(const char *fname, GLenum shaderType) {
 		std::vector<char> compilation_log(512);
 		glGetShaderInfoLog(shader, compilation_log.size(), NULL, &compilation_log[0]);
 		std::cerr << &compilation_log[0] << std::endl;
-		glfwTerminate();
-		exit(-1);
+		return false;
 	}
-	return shader;
+	return true;
 }
 
 // Create a program from two shaders
+// The program is kept for the whole run, use submit_program to be able to release it
 GLuint create_program(const char *path_vert_shader, const char *path_frag_shader) {
-	// Load and compile the vertex and fragment shaders
-	GLuint vertexShader = load_and_compile_shader(path_vert_shader, GL_VERTEX_SHADER);
-	GLuint fragmentShader = load_and_compile_shader(path_frag_shader, GL_FRAGMENT_SHADER);
+	return finish_program(submit_program(path_vert_shader, path_frag_shader));
+}
+
+// Start building a program from two shaders, returns an id for finish_program
+// Compilation and linking are only queued here, no status is queried, so with
+// KHR_parallel_shader_compile the driver threads work while the caller continues
+// Shaders with the same content as an already submitted program share it
+int submit_program(const char *path_vert_shader, const char *path_frag_shader) {
+	scoped_timer timer("submit_program");
+	pending_program pending;
+	pending.vertexShader = 0;
+	pending.fragmentShader = 0;
+	pending.finished = false;
+	pending.references = 1;
+
+	// Get the vertex and fragment shaders sources
+	shader_source vert_src, frag_src;
+	open_shader_src(path_vert_shader, vert_src);
+	open_shader_src(path_frag_shader, frag_src);
+
+	// The file names don't matter, identical sources give the same program
+	// A zero byte separates the two sources, moving text from one to the other changes the hash
+	pending.source_hash = fnv1a_hash(vert_src.data, vert_src.length);
+	pending.source_hash = fnv1a_hash("", 1, pending.source_hash);
+	pending.source_hash = fnv1a_hash(frag_src.data, frag_src.length, pending.source_hash);
+
+	std::map<unsigned long long, int>::iterator shared = program_registry.find(pending.source_hash);
+	if(shared != program_registry.end()) {
+		close_shader_src(vert_src);
+		close_shader_src(frag_src);
+		pending_programs[shared->second].references++;
+		return shared->second;
+	}
+	program_registry[pending.source_hash] = (int)pending_programs.size();
+
+	// Program binaries are only valid for the driver that produced them, so the
+	// cache key covers both shader sources, the renderer and the driver version
+	bool use_cache = GLEW_ARB_get_program_binary || GLEW_VERSION_4_1;
+	if(use_cache) {
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		use_cache = formats > 0;
+	}
+	if(use_cache) {
+		const char *renderer = (const char *)glGetString(GL_RENDERER);
+		const char *version = (const char *)glGetString(GL_VERSION);
+		unsigned long long hash = fnv1a_hash(renderer, strlen(renderer), pending.source_hash);
+		hash = fnv1a_hash(version, strlen(version), hash);
+
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.bin", hash);
+		pending.cache_file = std::string(program_cache_dir) + "/" + name;
+
+		pending.program = load_cached_program(pending.cache_file);
+		if(pending.program) {
+			program_cache_hits++;
+			close_shader_src(vert_src);
+			close_shader_src(frag_src);
+			pending_programs.push_back(pending);
+			return (int)pending_programs.size() - 1;
+		}
+		program_cache_misses++;
+	}
+
+	// Queue the compilation of the vertex and fragment shaders
+	// glShaderSource copies the source, so the mappings can be released right away
+	pending.vertexShader = submit_shader(vert_src.data, vert_src.length, GL_VERTEX_SHADER);
+	pending.fragmentShader = submit_shader(frag_src.data, frag_src.length, GL_FRAGMENT_SHADER);
+	close_shader_src(vert_src);
+	close_shader_src(frag_src);
 
 	// Attach the above shader to a program
-	GLuint shaderProgram = glCreateProgram();
-	glAttachShader(shaderProgram, vertexShader);
-	glAttachShader(shaderProgram, fragmentShader);
+	pending.program = glCreateProgram();
+	glAttachShader(pending.program, pending.vertexShader);
+	glAttachShader(pending.program, pending.fragmentShader);
+
+	// Ask the driver to keep the binary around so we can store it in the cache
+	if(use_cache) {
+		glProgramParameteri(pending.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
+	// Queue the link, the shaders are kept alive until finish_program in case we need their logs
+	glLinkProgram(pending.program);
+
+	pending_programs.push_back(pending);
+	return (int)pending_programs.size() - 1;
+}
+
+// Give back a program obtained with submit_program or create_program,
+// the GPU program is deleted when nobody uses it anymore
+void release_program(int id) {
+	pending_program &pending = pending_programs[id];
+	if(pending.references <= 0 || --pending.references > 0) {
+		return;
+	}
+
+	// A program still being built can be deleted right away, the driver drops the build,
+	// only its shaders, normally deleted once the link is checked, are left to delete here
+	if(!pending.finished) {
+		if(pending.vertexShader) {
+			glDeleteShader(pending.vertexShader);
+			glDeleteShader(pending.fragmentShader);
+		}
+		pending.finished = true;
+	}
+	program_reflections.erase(pending.program);
+	glDeleteProgram(pending.program);
+	pending.program = 0;
+	program_registry.erase(pending.source_hash);
+}
+
+// Check, without blocking, if the driver finished building a submitted program
+bool program_ready(int id) {
+	const pending_program &pending = pending_programs[id];
+	if(pending.finished || !pending.vertexShader || !parallel_shader_compile) {
+		return true;
+	}
+	GLint done = GL_FALSE;
+	glGetProgramiv(pending.program, GL_COMPLETION_STATUS_KHR, &done);
+	return done == GL_TRUE;
+}
+
+// Wait for a submitted program, check that it linked and use it
+GLuint finish_program(int id) {
+	GLuint shaderProgram = try_finish_program(id);
+	if(!shaderProgram) {
+		glfwTerminate();
+		exit(-1);
+	}
+	return shaderProgram;
+}
+
+// Same as finish_program, but return 0 after reporting the errors
+GLuint try_finish_program(int id) {
+	scoped_timer timer("finish_program");
+	pending_program &pending = pending_programs[id];
+	if(pending.finished) {
+		glUseProgram(pending.program);
+		return pending.program;
+	}
+	pending.finished = true;
+
+	// Programs loaded from the cache were already validated
+	if(pending.vertexShader) {
+		// Check the result of the link, this waits for the driver if needed
+		GLint test;
+		glGetProgramiv(pending.program, GL_LINK_STATUS, &test);
+		if(!test) {
+			// Report compilation errors first, they are the usual cause of a failed link
+			if(shader_compiled(pending.vertexShader) && shader_compiled(pending.fragmentShader)) {
+				std::cerr << "Program linking failed with this message:" << std::endl;
+				std::vector<char> link_log(512);
+				glGetProgramInfoLog(pending.program, link_log.size(), NULL, &link_log[0]);
+				std::cerr << &link_log[0] << std::endl;
+			}
+			glDeleteShader(pending.vertexShader);
+			glDeleteShader(pending.fragmentShader);
+			glDeleteProgram(pending.program);
+			pending.program = 0;
+			pending.references = 0;
+
+			// Let a later submit of the same sources try again
+			program_registry.erase(pending.source_hash);
+			return 0;
+		}
+
+		// Flag the shaders for deletion
+		glDetachShader(pending.program, pending.vertexShader);
+		glDetachShader(pending.program, pending.fragmentShader);
+		glDeleteShader(pending.vertexShader);
+		glDeleteShader(pending.fragmentShader);
+
+		if(!pending.cache_file.empty()) {
+			save_cached_program(pending.program, pending.cache_file);
+		}
+	}
+
+	reflect_program(pending.program);
+	glUseProgram(pending.program);
+	return pending.program;
+}
+
+// Build the reflection table of a program, called once after the link
+void reflect_program(GLuint shaderProgram) {
+	program_reflection &reflection = program_reflections[shaderProgram];
+	reflection.uniforms.clear();
+	reflection.attributes.clear();
+
+	GLint max_length = 0, length_attrib = 0;
+	glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+	glGetProgramiv(shaderProgram, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &length_attrib);
+	std::vector<char> name(std::max(max_length, length_attrib) + 1);
+
+	GLint count = 0;
+	glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORMS, &count);
+	for(GLint i = 0; i < count; ++i) {
+		program_variable variable;
+		GLsizei length = 0;
+		glGetActiveUniform(shaderProgram, i, name.size(), &length, &variable.size, &variable.type, &name[0]);
+		variable.location = glGetUniformLocation(shaderProgram, &name[0]);
+		// Arrays are reported as "name[0]", they are looked up by their plain name
+		if(length > 3 && strcmp(&name[length - 3], "[0]") == 0) {
+			length -= 3;
+		}
+		variable.hash = fnv1a_hash(&name[0], length);
+		reflection.uniforms.push_back(variable);
+	}
+
+	glGetProgramiv(shaderProgram, GL_ACTIVE_ATTRIBUTES, &count);
+	for(GLint i = 0; i < count; ++i) {
+		program_variable variable;
+		GLsizei length = 0;
+		glGetActiveAttrib(shaderProgram, i, name.size(), &length, &variable.size, &variable.type, &name[0]);
+		variable.location = glGetAttribLocation(shaderProgram, &name[0]);
+		variable.hash = fnv1a_hash(&name[0], length);
+		reflection.attributes.push_back(variable);
+	}
+
+	std::sort(reflection.uniforms.begin(), reflection.uniforms.end());
+	std::sort(reflection.attributes.begin(), reflection.attributes.end());
+}
+
+// Find a hashed name in a sorted reflection table
+GLint find_location(const std::vector<program_variable> &variables, unsigned long long name) {
+	program_variable key;
+	key.hash = name;
+	std::vector<program_variable>::const_iterator it = std::lower_bound(variables.begin(), variables.end(), key);
+	if(it == variables.end() || it->hash != name) {
+		return -1;
+	}
+	return it->location;
+}
+
+// Location of a uniform from its hashed name, -1 if the program doesn't use it
+GLint uniform_location(GLuint shaderProgram, unsigned long long name) {
+	std::map<GLuint, program_reflection>::const_iterator reflection = program_reflections.find(shaderProgram);
+	if(reflection == program_reflections.end()) {
+		return -1;
+	}
+	return find_location(reflection->second.uniforms, name);
+}
+
+// Location of an attribute from its hashed name, -1 if the program doesn't use it
+GLint attrib_location(GLuint shaderProgram, unsigned long long name) {
+	std::map<GLuint, program_reflection>::const_iterator reflection = program_reflections.find(shaderProgram);
+	if(reflection == program_reflections.end()) {
+		return -1;
+	}
+	return find_location(reflection->second.attributes, name);
+}
 
-	// Flag the shaders for deletion
-	glDeleteShader(vertexShader);
-	glDeleteShader(fragmentShader);
+// 64 bits FNV-1a hash, used to key the program binary cache
+unsigned long long fnv1a_hash(const char *data, size_t length, unsigned long long hash) {
+	for(size_t i = 0; i < length; ++i) {
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
 
-	// Link and use the program
-	glLinkProgram(shaderProgram);
-	glUseProgram(shaderProgram);
+// Try to create a program from a binary stored in the program cache
+// returns 0 if the binary is missing or was rejected by the driver
+GLuint load_cached_program(const std::string &cache_file) {
+	std::ifstream in(cache_file.c_str(), std::ios::binary);
+	if(!in.is_open()) {
+		return 0;
+	}
 
+	// A cache file stores the binary format followed by the binary itself
+	GLenum format;
+	in.read((char *)&format, sizeof(format));
+	in.seekg(0, std::ios::end);
+	std::streamoff length = (std::streamoff)in.tellg() - (std::streamoff)sizeof(format);
+	if(!in || length <= 0) {
+		return 0;
+	}
+	std::vector<char> binary((size_t)length);
+	in.seekg(sizeof(format), std::ios::beg);
+	in.read(&binary[0], length);
+	if(!in) {
+		return 0;
+	}
+
+	GLuint shaderProgram = glCreateProgram();
+	glProgramBinary(shaderProgram, format, &binary[0], (GLsizei)length);
+
+	// A driver update can make a stored binary stale, in which case the link fails
+	GLint test;
+	glGetProgramiv(shaderProgram, GL_LINK_STATUS, &test);
+	if(!test) {
+		glDeleteProgram(shaderProgram);
+		return 0;
+	}
 	return shaderProgram;
 }
 
+// Store the binary of a linked program in the program cache
+void save_cached_program(GLuint shaderProgram, const std::string &cache_file) {
+	GLint length = 0;
+	glGetProgramiv(shaderProgram, GL_PROGRAM_BINARY_LENGTH, &length);
+	if(length <= 0) {
+		return;
+	}
+
+	std::vector<char> binary(length);
+	GLenum format;
+	glGetProgramBinary(shaderProgram, length, NULL, &format, &binary[0]);
+
+	#ifdef _WIN32
+		_mkdir(program_cache_dir);
+	#else
+		mkdir(program_cache_dir, 0755);
+	#endif
+
+	// Written under a temporary name then renamed, so a reader never sees half of it
+	std::string temp_file = cache_file + ".tmp";
+	std::ofstream out(temp_file.c_str(), std::ios::binary);
+	if(!out.is_open()) {
+		std::cerr << "Unable to write the program cache file " << cache_file << std::endl;
+		return;
+	}
+	out.write((const char *)&format, sizeof(format));
+	out.write(&binary[0], length);
+	out.close();
+
+	// rename doesn't replace an existing file on Windows
+	#ifdef _WIN32
+		remove(cache_file.c_str());
+	#endif
+	if(!out || rename(temp_file.c_str(), cache_file.c_str()) != 0) {
+		std::cerr << "Unable to write the program cache file " << cache_file << std::endl;
+		remove(temp_file.c_str());
+	}
+}
+
+// Start watching the shaders folder for changes, on a background thread
+void start_shader_watcher(const char *dir) {
+	#ifdef __linux__
+		int fd = inotify_init1(IN_NONBLOCK);
+		if(fd < 0) {
+			std::cerr << "Unable to watch " << dir << ", shaders won't be reloaded" << std::endl;
+			return;
+		}
+		// Editors either rewrite the file or replace it with a renamed copy
+		if(inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+			std::cerr << "Unable to watch " << dir << ", shaders won't be reloaded" << std::endl;
+			close(fd);
+			return;
+		}
+
+		shader_watcher_running = true;
+		shader_watcher = std::thread([fd]() {
+			std::vector<char> events(4096);
+			while(shader_watcher_running) {
+				// Wake up regularly to check if we were asked to stop
+				pollfd pfd = { fd, POLLIN, 0 };
+				if(poll(&pfd, 1, 100) <= 0) {
+					continue;
+				}
+				ssize_t length = read(fd, &events[0], events.size());
+				for(ssize_t i = 0; i < length; ) {
+					const inotify_event *event = (const inotify_event *)&events[i];
+					if(event->len > 0 && strstr(event->name, ".shader") != NULL) {
+						shaders_changed = true;
+					}
+					i += sizeof(inotify_event) + event->len;
+				}
+			}
+			close(fd);
+		});
+	#endif
+}
+
+// Stop the background thread that watches the shaders folder
+void stop_shader_watcher() {
+	#ifdef __linux__
+		if(shader_watcher_running) {
+			shader_watcher_running = false;
+			shader_watcher.join();
+		}
+	#endif
+}
+
+// Called between frames, rebuilds the program if a shader changed and swaps
+// it in once the driver is done, a shader with errors keeps the last good program
+void reload_shaders() {
+	#ifdef __linux__
+		// Queue the new program, the old one is still used while it compiles
+		if(reload_program_id < 0 && shaders_changed.exchange(false)) {
+			reload_program_id = submit_program(vert_shader_path, frag_shader_path);
+		}
+	#endif
+
+	// Without KHR_parallel_shader_compile, program_ready is always true and the
+	// status check below waits for the compilation, like at startup: the render loop
+	// stalls for the whole rebuild. GLFW 2 has no shared contexts, so the compilation
+	// can't be moved to a worker thread, the stall is accepted for a development tool
+	if(reload_program_id < 0 || !program_ready(reload_program_id)) {
+		return;
+	}
+
+	int program_id = reload_program_id;
+	reload_program_id = -1;
+	GLuint shaderProgram = try_finish_program(program_id);
+	if(!shaderProgram) {
+		std::cerr << "Keeping the previous shaders" << std::endl;
+		glUseProgram(current_program);
+		return;
+	}
+
+	// Sources saved back to their current content give the same shared program
+	if(program_id == current_program_id) {
+		release_program(program_id);
+	}
+	else {
+		release_program(current_program_id);
+		current_program_id = program_id;
+		current_program = shaderProgram;
+		setup_program(current_program);
+	}
+	std::cout << "Shaders reloaded" << std::endl;
+}
+
+// Nanoseconds elapsed since the process start
+long long trace_now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - process_start).count();
+}
+
+// Write the startup phases in the Chrome trace format, open it with chrome://tracing or Perfetto
+// The trace timestamps are in microseconds, the fractional part keeps the nanoseconds
+void write_trace(const char *fname) {
+	std::ofstream out(fname);
+	if(!out.is_open()) {
+		std::cerr << "Unable to write the trace file " << fname << std::endl;
+		return;
+	}
+
+	out << "{\"traceEvents\":[\n";
+	for(size_t i = 0; i < trace_events.size(); ++i) {
+		const trace_event &event = trace_events[i];
+		char line[256];
+		snprintf(line, sizeof(line), "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f},\n",
+			event.name, event.start / 1000.0, event.duration / 1000.0);
+		out << line;
+	}
+	if(first_swap_time >= 0) {
+		char line[256];
+		snprintf(line, sizeof(line), "{\"name\":\"first swap\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":1,\"ts\":%.3f},\n",
+			first_swap_time / 1000.0);
+		out << line;
+	}
+	char line[256];
+	snprintf(line, sizeof(line), "{\"name\":\"exit\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":1,\"ts\":%.3f}\n", trace_now() / 1000.0);
+	out << line << "]}\n";
+}
+
+// Print the statistics and write the startup trace, called before exiting
+void report_statistics() {
+	std::cout << "Program cache: " << program_cache_hits << " hits, " << program_cache_misses << " misses" << std::endl;
+	std::cout << "Shader source I/O: " << shader_io_time * 1000.0 << " ms" << std::endl;
+	if(first_swap_time >= 0) {
+		std::cout << "Time to first swap: " << first_swap_time / 1.0e6 << " ms" << std::endl;
+	}
+	write_trace("startup_trace.json");
+}
+
+// Number of levels of a full mip chain
+int mip_level_count(unsigned int width, unsigned int height) {
+	int levels = 1;
+	for(unsigned int size = std::max(width, height); size > 1; size /= 2) {
+		levels++;
+	}
+	return levels;
+}
+
+// Build the levels 1 and up of a mip chain from the pixels of the level 0
+// Each level is computed from the previous one
+void build_mip_chain(const BYTE *pixels, unsigned int width, unsigned int height, unsigned int pitch, unsigned int bytes,
+	std::vector<mip_level> &levels) {
+	levels.resize(mip_level_count(width, height) - 1);
+	for(size_t i = 0; i < levels.size(); ++i) {
+		downsample_level(pixels, width, height, pitch, bytes, levels[i]);
+		pixels = &levels[i].pixels[0];
+		width = levels[i].width;
+		height = levels[i].height;
+		pitch = levels[i].pitch;
+	}
+}
+
+gamma_tables::gamma_tables() {
+	const int linear_max = (1 << 14) - 1;
+	for(int i = 0; i < 256; ++i) {
+		double c = i / 255.0;
+		double linear = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+		to_linear[i] = (unsigned short)(linear * linear_max + 0.5);
+		alpha_to_linear[i] = (unsigned short)((i * linear_max + 127) / 255);
+	}
+	for(int i = 0; i <= linear_max; ++i) {
+		double linear = (double)i / linear_max;
+		double c = linear <= 0.0031308 ? linear * 12.92 : 1.055 * pow(linear, 1.0 / 2.4) - 0.055;
+		to_srgb[i] = (unsigned char)(c * 255.0 + 0.5);
+		alpha_to_byte[i] = (unsigned char)((i * 255 + linear_max / 2) / linear_max);
+	}
+}
+
+// Halve an image with a 2x2 box filter, the colors are averaged in linear space
+// Two source rows are converted to linear 4 channels pixels, their 2x2 sums are done 2 pixels at a time
+// An odd last row or column is dropped, a single row or column is repeated
+void downsample_level(const BYTE *src, unsigned int width, unsigned int height, unsigned int pitch, unsigned int bytes,
+	mip_level &dst) {
+	static const gamma_tables tables;
+
+	dst.width = std::max(1u, width / 2);
+	dst.height = std::max(1u, height / 2);
+	dst.pitch = (dst.width * bytes + 3) & ~3u;
+	dst.pixels.resize((size_t)dst.pitch * dst.height);
+
+	std::vector<unsigned short> rows[2];
+	rows[0].resize(dst.width * 8);
+	rows[1].resize(dst.width * 8);
+	std::vector<unsigned short> average(dst.width * 4 + 4);
+	for(unsigned int y = 0; y < dst.height; ++y) {
+		for(int r = 0; r < 2; ++r) {
+			const BYTE *row = src + (size_t)std::min(2 * y + r, height - 1) * pitch;
+			unsigned short *linear = &rows[r][0];
+			for(unsigned int x = 0; x < dst.width * 2; ++x) {
+				const BYTE *p = row + (size_t)std::min(x, width - 1) * bytes;
+				linear[x * 4] = tables.to_linear[p[0]];
+				linear[x * 4 + 1] = tables.to_linear[p[1]];
+				linear[x * 4 + 2] = tables.to_linear[p[2]];
+				linear[x * 4 + 3] = bytes == 4 ? tables.alpha_to_linear[p[3]] : 0;
+			}
+		}
+
+		// 4 * (2^14 - 1) still fits in 16 bits
+		unsigned int x = 0;
+		#ifdef __SSE2__
+			const __m128i rounding = _mm_set1_epi16(2);
+			for(; x + 2 <= dst.width; x += 2) {
+				__m128i a0 = _mm_loadu_si128((const __m128i *)&rows[0][x * 8]);
+				__m128i a1 = _mm_loadu_si128((const __m128i *)&rows[0][x * 8 + 8]);
+				__m128i b0 = _mm_loadu_si128((const __m128i *)&rows[1][x * 8]);
+				__m128i b1 = _mm_loadu_si128((const __m128i *)&rows[1][x * 8 + 8]);
+				__m128i s0 = _mm_add_epi16(a0, b0);
+				__m128i s1 = _mm_add_epi16(a1, b1);
+				__m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+				_mm_storeu_si128((__m128i *)&average[x * 4], _mm_srli_epi16(_mm_add_epi16(sum, rounding), 2));
+			}
+		#endif
+		for(; x < dst.width; ++x) {
+			for(int c = 0; c < 4; ++c) {
+				average[x * 4 + c] = (unsigned short)((rows[0][x * 8 + c] + rows[0][x * 8 + 4 + c] +
+					rows[1][x * 8 + c] + rows[1][x * 8 + 4 + c] + 2) >> 2);
+			}
+		}
+
+		BYTE *out = &dst.pixels[(size_t)y * dst.pitch];
+		for(x = 0; x < dst.width; ++x) {
+			out[x * bytes] = tables.to_srgb[average[x * 4]];
+			out[x * bytes + 1] = tables.to_srgb[average[x * 4 + 1]];
+			out[x * bytes + 2] = tables.to_srgb[average[x * 4 + 2]];
+			if(bytes == 4) {
+				out[x * bytes + 3] = tables.alpha_to_byte[average[x * 4 + 3]];
+			}
+		}
+	}
+}
+
+// Time the sampling of the texture at several minification ratios, with and without the mipmaps, then exit
+// The texture coordinates are scaled so the texture repeats over the same quad, the number of
+// fragments stays the same and only the texture footprint of each one grows
+void benchmark_minification(GLuint &vao) {
+	const float ratios[] = {1, 2, 4, 8, 16, 32};
+	const int draws = 500;
+	const GLfloat texture_coord[8] = {
+		0.0, 0.0,
+		1.0, 0.0,
+		1.0, 1.0,
+		0.0, 1.0,
+	};
+
+	glBindVertexArray(vao);
+	std::cout << "Minification benchmark, " << texture_levels << " levels, ms per draw" << std::endl;
+	for(size_t r = 0; r < sizeof(ratios) / sizeof(ratios[0]); ++r) {
+		GLfloat scaled[8];
+		for(int i = 0; i < 8; ++i) {
+			scaled[i] = texture_coord[i] * ratios[r];
+		}
+		glBufferSubData(GL_ARRAY_BUFFER, texture_coord_offset, sizeof(scaled), scaled);
+
+		GLenum filters[2] = {GL_LINEAR, GL_LINEAR_MIPMAP_LINEAR};
+		double times[2] = {0, 0};
+		for(int f = 0; f < (texture_levels > 1 ? 2 : 1); ++f) {
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filters[f]);
+
+			// Warm up, then time many draws of the quad
+			glClear(GL_COLOR_BUFFER_BIT);
+			draw_indices(scene_indices, 0, scene_indices.count);
+			glFinish();
+			double start = glfwGetTime();
+			for(int i = 0; i < draws; ++i) {
+				draw_indices(scene_indices, 0, scene_indices.count);
+			}
+			glFinish();
+			times[f] = (glfwGetTime() - start) * 1000.0 / draws;
+		}
+		std::cout << "  x" << ratios[r] << ": GL_LINEAR " << times[0] << " ms";
+		if(texture_levels > 1) {
+			std::cout << ", GL_LINEAR_MIPMAP_LINEAR " << times[1] << " ms";
+		}
+		std::cout << std::endl;
+	}
+
+	glfwTerminate();
+	exit(0);
+}
+
+// Build the transforms of count quads on a grid covering the view and upload them to instance_vbo
+// The grid has the aspect ratio of the projection, each quad gets a rotation from a hash of its index
+void fill_instances(int count, std::vector<GLfloat> &transforms) {
+	const float width = 8.0f / 3.0f, height = 2.0f;
+	int columns = (int)ceil(sqrt(count * width / height));
+	int rows = (count + columns - 1) / columns;
+	float cell = std::min(width / columns, height / rows);
+
+	transforms.resize((size_t)count * 4);
+	for(int i = 0; i < count; ++i) {
+		unsigned int hash = (unsigned int)i * 2654435761u;
+		GLfloat *transform = &transforms[(size_t)i * 4];
+		transform[0] = -width / 2 + (i % columns + 0.5f) * cell;
+		transform[1] = height / 2 - (i / columns + 0.5f) * cell;
+		transform[2] = (hash >> 16) * (6.2831853f / 65536.0f);
+		transform[3] = cell * 0.7f;
+	}
+
+	GLint vbo;
+	glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+	glBufferData(GL_ARRAY_BUFFER, transforms.size() * sizeof(GLfloat), &transforms[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+}
+
+// Time the instanced draw for a growing number of quads, against one draw per quad, then exit
+// Each frame is a clear and the draws, glFinish makes sure the GPU time is counted. Without the
+// instance array the attribute keeps its current value, so the per quad draws set it with glVertexAttrib4fv
+void benchmark_instances(GLuint &vao, int max_count) {
+	const int frames = 50;
+	const int max_single_draws = 100000;
+	GLint instance_transform = attrib_location(current_program, instance_transform_name);
+
+	glBindVertexArray(vao);
+	std::cout << "Instancing benchmark, ms per frame" << std::endl;
+	for(int count = std::min(1000, max_count); count > 0; ) {
+		std::vector<GLfloat> transforms;
+		fill_instances(count, transforms);
+
+		glClear(GL_COLOR_BUFFER_BIT);
+		draw_indices(scene_indices, 0, scene_indices.count, count);
+		glFinish();
+		double start = glfwGetTime();
+		for(int f = 0; f < frames; ++f) {
+			glClear(GL_COLOR_BUFFER_BIT);
+			draw_indices(scene_indices, 0, scene_indices.count, count);
+		}
+		glFinish();
+		double instanced = (glfwGetTime() - start) * 1000.0 / frames;
+		std::cout << "  " << count << " quads: instanced " << instanced << " ms (" <<
+			count / (instanced * 1000.0) << " M quads/s)";
+
+		// One draw per quad gets slow fast, it is only timed on the smaller grids
+		if(count <= max_single_draws) {
+			glDisableVertexAttribArray(instance_transform);
+			start = glfwGetTime();
+			for(int f = 0; f < frames; ++f) {
+				glClear(GL_COLOR_BUFFER_BIT);
+				for(int i = 0; i < count; ++i) {
+					glVertexAttrib4fv(instance_transform, &transforms[(size_t)i * 4]);
+					draw_indices(scene_indices, 0, scene_indices.count);
+				}
+			}
+			glFinish();
+			double single = (glfwGetTime() - start) * 1000.0 / frames;
+			glEnableVertexAttribArray(instance_transform);
+			std::cout << ", one draw per quad " << single << " ms";
+		}
+		std::cout << std::endl;
+
+		// The last grid has max_count quads, the next count is computed in 64 bits so it can't overflow
+		if(count == max_count) {
+			break;
+		}
+		count = (int)std::min((long long)count * 10, (long long)max_count);
+	}
+
+	glfwTerminate();
+	exit(0);
+}
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Generate embedded_shaders.h from the *.shader files of this folder
+# Run it from the folder of the example, before compiling with -DEMBED_SHADERS:
+#   sh shaders/embed_shaders.sh
+# The shaders are stored as raw string literals, glShaderSource gets them
+# with their exact length, so there is no file access at startup
+cd "$(dirname "$0")" || exit 1
+out=embedded_shaders.h
+
+{
+	echo "// Generated by embed_shaders.sh, don't edit"
+	echo "#pragma once"
+	echo ""
+	echo "struct embedded_shader {"
+	echo "	const char *name;"
+	echo "	const char *src;"
+	echo "	GLint length;"
+	echo "};"
+	echo ""
+	i=0
+	for f in *.shader; do
+		echo "constexpr char embedded_shader_$i[] = R\"glsl($(cat "$f")"
+		echo ")glsl\";"
+		echo ""
+		i=$((i + 1))
+	done
+	echo "constexpr embedded_shader embedded_shaders[] = {"
+	i=0
+	for f in *.shader; do
+		echo "	{ \"shaders/$f\", embedded_shader_$i, sizeof(embedded_shader_$i) - 1 },"
+		i=$((i + 1))
+	done
+	echo "};"
+} > "$out"
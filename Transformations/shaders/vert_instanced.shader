@@ -0,0 +1,18 @@
+#version 150
+
+in vec4 position;
+in vec2 texture_coord;
+in vec4 instance_transform;
+out vec2 texture_coord_from_vshader;
+
+uniform mat4 View;
+uniform mat4 Projection;
+
+// Each instance has its own transform, the translation in xy, the rotation around Oz in z and the scale in w
+void main() {
+	float c = cos(instance_transform.z);
+	float s = sin(instance_transform.z);
+	vec2 xy = mat2(c, s, -s, c) * position.xy * instance_transform.w + instance_transform.xy;
+	gl_Position = Projection * View * vec4(xy, position.z, position.w);
+	texture_coord_from_vshader = texture_coord;
+}